@@ -0,0 +1,32 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <minimal_mangle.c>
+#include <mply_attr.c>
+
+int
+main( int argc, char **argv )
+{
+    MANGLE_PLY *ply;
+    MANGLE_INT nmiss;
+
+    if( argc < 4 ) {
+        printf( "Usage: %s  POLYGON  TABLE  OUTPUT_ATTR\n", argv[0] );
+        printf( "  TABLE has a '# polyid NAME NAME ...' header, then a line per polyid\n" );
+        printf( "  (use OUTPUT_ATTR with MANGLE_ATTR=OUTPUT_ATTR:NAME,... in the tools)\n" );
+        return EXIT_FAILURE;
+    }
+
+    fprintf( stderr, "READING polygon file: %s\n", argv[1] );
+    ply = mply_read_file( argv[1] );
+
+    fprintf( stderr, "WRITING: attributes from %s to %s\n", argv[2], argv[3] );
+    nmiss = mply_attr_write( ply, argv[2], argv[3] );
+    if( nmiss > 0 )
+        fprintf( stderr, "WARNING: %zd of %zd polygons not in the table (set to NaN)\n",
+                 ( ssize_t ) nmiss, ( ssize_t ) ply->npoly );
+
+    ply = mply_kill( ply );
+
+    return EXIT_SUCCESS;
+}
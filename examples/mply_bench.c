@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <minimal_mangle.c>
+#include <mply_pipe.c>
+#include <mply_group.c>
+
+/* each method is run this many times, and the fastest run reported */
+#define BENCH_REPEAT 3
+
+typedef struct {
+    size_t n;
+    size_t nalloc;
+    double *ra;
+    double *dec;
+    MANGLE_INT *index;
+    MANGLE_INT *index_batch;
+} BENCH_POINTS;
+
+/* collect the catalog positions (nothing is written out) */
+static void
+bench_chunk( MANGLE_PIPE_CHUNK * const c, void *arg )
+{
+    BENCH_POINTS *b = ( BENCH_POINTS * ) arg;
+
+    if( b->n + c->nline > b->nalloc ) {
+        b->nalloc = 2 * ( b->n + c->nline );
+        b->ra = ( double * ) check_realloc( b->ra, b->nalloc, sizeof( double ) );
+        b->dec = ( double * ) check_realloc( b->dec, b->nalloc, sizeof( double ) );
+    }
+    memcpy( &( b->ra[b->n] ), c->ra, c->nline * sizeof( double ) );
+    memcpy( &( b->dec[b->n] ), c->dec, c->nline * sizeof( double ) );
+    b->n += c->nline;
+}
+
+static double
+bench_now( void )
+{
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+static void
+bench_report( char const *const name, const double t, const double t_batch, const size_t n )
+{
+    fprintf( stdout, "%-14s %10.1f ns/point", name, 1e9 * t / n );
+    if( t_batch > 0.0 )
+        fprintf( stdout, "  x%.2f vs batch", t_batch / t );
+    fprintf( stdout, "\n" );
+}
+
+/* group = 0 for single lookups, -1 for the batch call; returns the fastest time */
+static double
+bench_time( MANGLE_PLY const *const ply, BENCH_POINTS * const b, const int group )
+{
+    double t, best = 0.0;
+    size_t i;
+    int r;
+
+    for( r = 0; r < BENCH_REPEAT; r++ ) {
+        t = bench_now(  );
+        if( group < 0 ) {
+            mply_find_polyindex_radec_batch( ply, b->n, b->ra, b->dec, b->index_batch );
+        } else if( group == 0 ) {
+            for( i = 0; i < b->n; i++ )
+                b->index[i] = mply_find_polyindex_radec( ply, b->ra[i], b->dec[i] );
+        } else {
+            mply_find_polyindex_radec_group( ply, b->n, b->ra, b->dec, b->index, group );
+        }
+        t = bench_now(  ) - t;
+        if( r == 0 || t < best )
+            best = t;
+    }
+
+    return best;
+}
+
+int
+main( int argc, char **argv )
+{
+    static const int group_default[] = { 1, 2, 4, 8, 16, 32 };
+    BENCH_POINTS b;
+    MANGLE_PLY *ply;
+    FILE *fp;
+    double t_batch;
+    size_t i;
+    int g, ngroup, group[MPLY_GROUP_MAX];
+
+    if( argc < 3 ) {
+        printf( "Usage: %s  POLYGON  RA_DEC_FILE  [GROUP_SIZE ...]\n", argv[0] );
+        printf( "  (times single, batch and grouped lookups; default group sizes 1 2 4 8 16 32)\n" );
+        return EXIT_FAILURE;
+    }
+
+    if( argc > 3 ) {
+        ngroup = argc - 3 < MPLY_GROUP_MAX ? argc - 3 : MPLY_GROUP_MAX;
+        for( g = 0; g < ngroup; g++ ) {
+            group[g] = atoi( argv[g + 3] );
+            if( group[g] < 1 || group[g] > MPLY_GROUP_MAX ) {
+                fprintf( stderr, "ERROR: group size must be 1 .. %d: %s\n", MPLY_GROUP_MAX,
+                         argv[g + 3] );
+                return EXIT_FAILURE;
+            }
+        }
+    } else {
+        ngroup = sizeof( group_default ) / sizeof( group_default[0] );
+        for( g = 0; g < ngroup; g++ )
+            group[g] = group_default[g];
+    }
+
+    ply = mply_read_file( argv[1] );
+
+    memset( &b, 0, sizeof( BENCH_POINTS ) );
+    fp = check_fopen( argv[2], "r" );
+    mply_pipe_run( NULL, fp, argv[2], stdout, bench_chunk, &b );
+    fclose( fp );
+    if( b.n == 0 ) {
+        fprintf( stderr, "ERROR: no points in %s\n", argv[2] );
+        return EXIT_FAILURE;
+    }
+    b.index = ( MANGLE_INT * ) check_alloc( b.n, sizeof( MANGLE_INT ) );
+    b.index_batch = ( MANGLE_INT * ) check_alloc( b.n, sizeof( MANGLE_INT ) );
+
+    fprintf( stdout, "mask:   %zd polygons, %zd caps, pixel resolution %d\n",
+             ( ssize_t ) ply->npoly, ( ssize_t ) ply->ncap, ( int ) ply->pix_res );
+    fprintf( stdout, "points: %zu\n", b.n );
+
+    bench_report( "single", bench_time( ply, &b, 0 ), 0.0, b.n );
+    t_batch = bench_time( ply, &b, -1 );
+    bench_report( "batch", t_batch, 0.0, b.n );
+
+    for( g = 0; g < ngroup; g++ ) {
+        char name[32];
+        double t = bench_time( ply, &b, group[g] );
+
+        for( i = 0; i < b.n; i++ ) {
+            if( b.index[i] != b.index_batch[i] ) {
+                fprintf( stderr, "ERROR: group size %d differs from batch at point %zu\n",
+                         group[g], i );
+                return EXIT_FAILURE;
+            }
+        }
+        snprintf( name, sizeof( name ), "group G=%d", group[g] );
+        bench_report( name, t, t_batch, b.n );
+    }
+
+    CHECK_FREE( b.ra );
+    CHECK_FREE( b.dec );
+    CHECK_FREE( b.index );
+    CHECK_FREE( b.index_batch );
+    ply = mply_kill( ply );
+
+    return EXIT_SUCCESS;
+}
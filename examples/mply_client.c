@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <minimal_mangle.c>
+#include <mply_pipe.c>
+#include <mply_server.c>
+
+typedef struct {
+    int fd;
+    uint32_t mask;
+    size_t nalloc;
+    int64_t *polyid;
+} CLIENT_ARGS;
+
+/* same output as mply_polyid, but the lookups are done by a running mply_serve */
+static void
+client_chunk( MANGLE_PIPE_CHUNK * const c, void *arg )
+{
+    CLIENT_ARGS *q = ( CLIENT_ARGS * ) arg;
+    size_t i;
+    int status;
+
+    if( c->nline > q->nalloc ) {
+        q->nalloc = c->nline;
+        q->polyid = ( int64_t * ) check_realloc( q->polyid, q->nalloc, sizeof( int64_t ) );
+    }
+
+    status = mply_client_query( q->fd, q->mask, c->nline, c->ra, c->dec, q->polyid, NULL, NULL );
+    if( status != MPLY_SERVER_OK ) {
+        fprintf( stderr, "MANGLE Error: query failed (status %d)\n", status );
+        exit( EXIT_FAILURE );
+    }
+
+    for( i = 0; i < c->nline; i++ ) {
+        size_t len = c->line_len[i] + 32;
+        char *o = mply_pipe_out_reserve( c, len );
+        c->out_len += snprintf( o, len, "%6zd %s\n", ( ssize_t ) q->polyid[i], c->line[i] );
+    }
+}
+
+int
+main( int argc, char **argv )
+{
+    CLIENT_ARGS q;
+    FILE *fp;
+
+    if( argc < 3 ) {
+        printf( "Usage: %s  SOCKET_PATH  RA_DEC_FILE  [MASK_NUMBER]  > OUTPUT \n", argv[0] );
+        return EXIT_FAILURE;
+    }
+
+    q.mask = 0;
+    q.nalloc = 0;
+    q.polyid = NULL;
+    if( argc > 3 )
+        q.mask = ( uint32_t ) atoi( argv[3] );
+
+    q.fd = mply_client_connect( argv[1] );
+    if( q.fd < 0 ) {
+        perror( "MANGLE Error: cannot connect to server" );
+        return EXIT_FAILURE;
+    }
+
+    fp = check_fopen( argv[2], "r" );
+    mply_pipe_run( NULL, fp, argv[2], stdout, client_chunk, &q );
+    fclose( fp );
+
+    mply_client_close( q.fd );
+    CHECK_FREE( q.polyid );
+
+    return EXIT_SUCCESS;
+}
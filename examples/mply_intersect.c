@@ -0,0 +1,46 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <minimal_mangle.c>
+#include <mply_intersect.c>
+
+int
+main( int argc, char **argv )
+{
+    MANGLE_PLY *a, *b, *ply;
+    int rule = MPLY_INTERSECT_PRODUCT;
+
+    if( argc < 4 ) {
+        printf( "Usage: %s  POLYGON_A  POLYGON_B  OUTPUT_POLYGON  [product|min]\n", argv[0] );
+        printf( "  weights of overlapping polygons are combined by the rule (default product)\n" );
+        return EXIT_FAILURE;
+    }
+    if( argc > 4 ) {
+        if( strcmp( argv[4], "min" ) == 0 ) {
+            rule = MPLY_INTERSECT_MIN;
+        } else if( strcmp( argv[4], "product" ) != 0 ) {
+            fprintf( stderr, "ERROR: unknown weight rule '%s'\n", argv[4] );
+            return EXIT_FAILURE;
+        }
+    }
+
+    fprintf( stderr, "READING polygon file: %s\n", argv[1] );
+    a = mply_load_file( argv[1] );
+    fprintf( stderr, "READING polygon file: %s\n", argv[2] );
+    b = mply_load_file( argv[2] );
+
+    fprintf( stderr, "INTERSECTING: %zd x %zd polygons, weights by %s\n", ( ssize_t ) a->npoly,
+             ( ssize_t ) b->npoly, MPLY_INTERSECT_MIN == rule ? "min" : "product" );
+    ply = mply_intersect( a, b, rule, NULL );
+
+    fprintf( stderr, "WRITING: %zd polygons, %zd caps to %s\n", ( ssize_t ) ply->npoly,
+             ( ssize_t ) ply->ncap, argv[3] );
+    mply_write_file( ply, argv[3] );
+
+    a = mply_kill( a );
+    b = mply_kill( b );
+    ply = mply_kill( ply );
+
+    return EXIT_SUCCESS;
+}
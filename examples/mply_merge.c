@@ -0,0 +1,23 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <minimal_mangle.c>
+#include <mply_shard.c>
+
+int
+main( int argc, char **argv )
+{
+    size_t n;
+
+    if( argc < 2 ) {
+        printf( "Usage: %s  SHARD_FILE  [SHARD_FILE ...]  >  OUTPUT\n", argv[0] );
+        printf( "  merges the output of tools run with MANGLE_SHARD=K/N back into input order\n" );
+        return EXIT_FAILURE;
+    }
+
+    fprintf( stderr, "MERGING: %d shard files\n", argc - 1 );
+    n = mply_shard_merge( stdout, &argv[1], argc - 1 );
+    fprintf( stderr, "DONE: %zu lines\n", n );
+
+    return EXIT_SUCCESS;
+}
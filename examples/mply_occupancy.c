@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <minimal_mangle.c>
+#include <mply_count.c>
+#include <mply_mem.c>
+#include <mply_load.c>
+#include <mply_pipe.c>
+
+typedef struct {
+    MANGLE_COUNT *cnt;
+    int weight_col;
+    char const *name;
+    size_t nread;
+} OCCUPANCY_ARGS;
+
+/* read column col (1-based) as a double, returns FALSE if not there */
+static int
+read_column( char const *line, const int col, double *val )
+{
+    int i;
+    char *end;
+
+    for( i = 1; i < col; i++ ) {
+        line += strspn( line, " \t" );
+        line += strcspn( line, " \t" );
+    }
+    *val = strtod( line, &end );
+    if( end == line )
+        return FALSE;
+    return TRUE;
+}
+
+/* count the points of a chunk, already looked up by the pipe (into slot 0:
+ * the callback runs on one thread) */
+static void
+occupancy_chunk( MANGLE_PIPE_CHUNK * const c, void *arg )
+{
+    OCCUPANCY_ARGS *a = ( OCCUPANCY_ARGS * ) arg;
+    size_t i;
+
+    if( a->weight_col <= 0 ) {
+        mply_count_add_index( a->cnt, 0, c->nline, c->index, NULL );
+        a->nread += c->nline;
+        return;
+    }
+
+    for( i = 0; i < c->nline; i++ ) {
+        double w;
+        if( !read_column( c->line[i], a->weight_col, &w ) ) {
+            fprintf( stderr, "WARNING: skipped line, couldn't read WEIGHT in file %s: %s\n",
+                     a->name, c->line[i] );
+            continue;
+        }
+        mply_count_add_index( a->cnt, 0, 1, &( c->index[i] ), &w );
+        a->nread += 1;
+    }
+}
+
+int
+main( int argc, char **argv )
+{
+    MANGLE_PLY *ply;
+    OCCUPANCY_ARGS a;
+    FILE *fp;
+
+    const char *mode = "poly";
+    MANGLE_INT i, nempty;
+
+    if( argc < 3 ) {
+        printf( "Usage: %s  POLYGON  RA_DEC_FILE  [WEIGHT_COLUMN]  [poly|empty|pix]  >  OUTPUT\n",
+                argv[0] );
+        return EXIT_FAILURE;
+    }
+
+    fprintf( stderr, "READING polygon file: %s\n", argv[1] );
+    ply = mply_load_file( argv[1] );    /* parallel with OpenMP */
+    /* threads are placed with OMP_PROC_BIND / OMP_PLACES */
+    mply_mem_place( ply, mply_mem_policy( getenv( "MANGLE_MEM" ) ) );
+
+    a.weight_col = 0;
+    if( argc > 3 )
+        a.weight_col = atoi( argv[3] );
+    if( argc > 4 )
+        mode = argv[4];
+
+    /* reading and parsing overlap with the lookups, as in mply_polyid */
+    a.cnt = mply_count_init( ply );
+    a.name = argv[2];
+    a.nread = 0;
+    fprintf( stderr, "PROCESSING: ra dec from %s\n", argv[2] );
+    fp = check_fopen( argv[2], "r" );
+    mply_pipe_run( ply, fp, argv[2], stdout, occupancy_chunk, &a );
+    fclose( fp );
+
+    mply_count_merge( a.cnt, ply );
+    nempty = mply_count_nempty( a.cnt );
+
+    if( strcmp( mode, "pix" ) == 0 ) {
+        size_t ipix;
+        MANGLE_INT sid = mply_pix_id_start( ply );
+        for( ipix = 0; ipix < a.cnt->npix; ipix++ ) {
+            fprintf( stdout, "%6zd %10zu\n", ( ssize_t ) ( ipix + sid ), a.cnt->pix_count[ipix] );
+        }
+    } else {
+        int empty_only = ( strcmp( mode, "empty" ) == 0 );
+        for( i = 0; i < ply->npoly; i++ ) {
+            size_t c = mply_count_from_index( a.cnt, i );
+            double area = mply_area_from_index( ply, i );
+            if( empty_only && c > 0 )
+                continue;
+            fprintf( stdout, "%6zd %10zu %14.8g %14.8g %14.8g %g\n",
+                     ( ssize_t ) mply_polyid_from_index( ply, i ), c,
+                     mply_count_weighted_from_index( a.cnt, i ), area,
+                     area > 0.0 ? c / area : 0.0, mply_weight_from_index( ply, i ) );
+        }
+    }
+
+    fprintf( stderr, "DONE: %zu points, %zu outside mask, %zd of %zd polygons empty\n",
+             a.nread, mply_count_from_index( a.cnt, -1 ), ( ssize_t ) nempty,
+             ( ssize_t ) ply->npoly );
+
+    a.cnt = mply_count_kill( a.cnt );
+    ply = mply_kill( ply );
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,27 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <minimal_mangle.c>
+#include <mply_partial.c>
+
+int
+main( int argc, char **argv )
+{
+    MANGLE_INT n;
+    char const *pidx = NULL;
+
+    if( argc < 2 ) {
+        printf( "Usage: %s  POLYGON  [INDEX_FILE]\n", argv[0] );
+        printf( "  (default INDEX_FILE is POLYGON.pidx; make it again if POLYGON is changed or "
+                "copied)\n" );
+        return EXIT_FAILURE;
+    }
+    if( argc > 2 )
+        pidx = argv[2];
+
+    fprintf( stderr, "INDEXING polygon file: %s\n", argv[1] );
+    n = mply_pidx_write( argv[1], pidx );
+    fprintf( stderr, "DONE: %zd polygons\n", ( ssize_t ) n );
+
+    return EXIT_SUCCESS;
+}
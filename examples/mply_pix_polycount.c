@@ -7,8 +7,8 @@ int
 main( int argc, char **argv )
 {
     MANGLE_PLY *ply;
-    MANGLE_INT i, sid;
-    size_t npix, count;
+    MANGLE_INT sid;
+    size_t i, npix, count;
 
     if( argc < 2 ) {
         printf( "Usage: %s  POLYGON  >  OUTPUT\n", argv[0] );
@@ -21,7 +21,7 @@ main( int argc, char **argv )
 
     fprintf( stderr, "Sky pixelized into %zd pixels", npix );
     if( npix > 0 ) {
-        fprintf( stderr, " (IDs: %d - %zd)\n", sid, sid + npix - 1 );
+        fprintf( stderr, " (IDs: %zd - %zd)\n", ( ssize_t ) sid, ( ssize_t ) ( sid + npix - 1 ) );
     } else {
         fprintf( stderr, "\n" );
     }
@@ -30,7 +30,7 @@ main( int argc, char **argv )
     for( i = 0; i < npix; i++ ) {
         count = mply_pix_npoly( ply, i );
         if( count > 0 ) {
-            fprintf( stdout, "%6d %6d %6zd\n", i, i + sid, count );
+            fprintf( stdout, "%6zd %6zd %6zd\n", ( ssize_t ) i, ( ssize_t ) ( i + sid ), count );
         }
     }
 
@@ -2,50 +2,95 @@
 #include <stdio.h>
 
 #include <minimal_mangle.c>
-#include <simple_reader.c>
+#include <mply_pipe.c>
+#include <mply_shard.c>
+#include <mply_attr.c>
+
+typedef struct {
+    MANGLE_PLY *ply;
+    int sharded;
+    MANGLE_SHARD shard;
+    int has_attr;
+    MANGLE_ATTR attr;
+} POLYID_ARGS;
+
+static void
+polyid_chunk( MANGLE_PIPE_CHUNK * const c, void *arg )
+{
+    POLYID_ARGS *a = ( POLYID_ARGS * ) arg;
+    MANGLE_PLY *ply = a->ply;
+    size_t i;
+
+    for( i = 0; i < c->nline; i++ ) {
+        MANGLE_INT polyid;      /* listed POLYID */
+        size_t len = c->line_len[i] + 32;
+        char *o;
+
+        if( a->sharded ) {
+            if( !mply_shard_owns( c, i ) )
+                continue;
+            mply_shard_out_row( &a->shard, c, i );
+        }
+
+        polyid = mply_polyid_from_index( ply, c->index[i] );
+
+        if( a->has_attr ) {
+            char *e;
+
+            len += a->attr.nsel * MPLY_DTOA_SIZE;
+            o = mply_pipe_out_reserve( c, len );
+            e = o + snprintf( o, len, "%6zd", ( ssize_t ) polyid );
+            e = mply_attr_write_row( &a->attr, c->index[i], e );
+            *e++ = ' ';
+            memcpy( e, c->line[i], c->line_len[i] );
+            e[c->line_len[i]] = '\n';
+            c->out_len += e - o + c->line_len[i] + 1;
+        } else {
+            o = mply_pipe_out_reserve( c, len );
+            c->out_len += snprintf( o, len, "%6zd %s\n", ( ssize_t ) polyid, c->line[i] );
+        }
+    }
+    if( a->sharded )
+        mply_shard_next( &a->shard, c );
+}
 
 int
 main( int argc, char **argv )
 {
-    MANGLE_PLY *ply;
-    simple_reader *sr;
+    POLYID_ARGS a;
+    FILE *fp;
 
     if( argc < 3 ) {
         printf( "Usage: %s  POLYGON  RA_DEC_FILE > OUTPUT \n", argv[0] );
+        printf( "  (with MANGLE_SHARD=K/N, run as shard K of N: see mply_merge)\n" );
+        printf( "  (with MANGLE_ATTR=FILE.attr:NAME,..., print those columns after polyid)\n" );
         return EXIT_FAILURE;
     }
-    ply = mply_read_file( argv[1] );
-    sr = sr_init( argv[2] );
-
-    while( sr_readline( sr ) ) {
-        char *line;
-        int check;
-        MANGLE_INT ipoly;       /* this is an internal index */
-        MANGLE_INT polyid;      /* listed POLYID */
-        double ra, dec;
-
-        line = sr_line( sr );
 
-        if( sr_line_isempty( sr ) )
-            continue;
-        if( '#' == line[0] )
-            continue;
+    a.sharded = mply_shard_parse( &a.shard, getenv( "MANGLE_SHARD" ) );
+    if( a.sharded )
+        a.ply = mply_shard_read( &a.shard, argv[1] );
+    else
+        a.ply = mply_read_file( argv[1] );
 
-        check = sscanf( line, "%lf %lf", &ra, &dec );
-        if( 2 != check ) {
-            fprintf( stderr, "WARNING: skipped line, couldn't read RA/DEC on line %d in file %s\n",
-                     sr_linenum( sr ), sr_filename( sr ) );
-            continue;
+    a.has_attr = FALSE;
+    if( NULL != getenv( "MANGLE_ATTR" ) && '\0' != getenv( "MANGLE_ATTR" )[0] ) {
+        if( a.sharded ) {
+            /* attribute rows follow the whole mask's INDEX */
+            fprintf( stderr, "ERROR: MANGLE_ATTR is not supported with MANGLE_SHARD\n" );
+            return EXIT_FAILURE;
         }
-
-        ipoly = mply_find_polyindex_radec( ply, ra, dec );
-        polyid = mply_polyid_from_index( ply, ipoly );
-
-        fprintf( stdout, "%6zd %s\n", ( ssize_t ) polyid, line );
+        a.has_attr = mply_attr_env( &a.attr, a.ply, getenv( "MANGLE_ATTR" ) );
     }
 
-    ply = mply_kill( ply );
-    sr = sr_kill( sr );
+    fp = check_fopen( argv[2], "r" );
+    mply_pipe_run_filter( a.ply, fp, argv[2], stdout, a.sharded ? mply_shard_filter : NULL,
+                          &a.shard, polyid_chunk, &a );
+    fclose( fp );
+
+    if( a.has_attr )
+        mply_attr_close( &a.attr );
+    a.ply = mply_kill( a.ply );
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <minimal_mangle.c>
+#include <mply_raster.c>
+#include <mply_mem.c>
+#include <mply_load.c>
+
+int
+main( int argc, char **argv )
+{
+    MANGLE_PLY *ply;
+    MANGLE_RASTER *r;
+    int scheme, res, sub = 4;
+    size_t i;
+    double sum = 0.0, pix_area;
+
+    if( argc < 5 ) {
+        printf( "Usage: %s  POLYGON  simple|healpix  RES  OUTPUT_MAP  [SUB_LEVEL]\n", argv[0] );
+        printf( "  RES: simple resolution (4^RES pixels) or HEALPix order (nside = 2^RES)\n" );
+        printf( "  SUB_LEVEL: boundary pixels use 4^SUB_LEVEL samples (default %d)\n", sub );
+        return EXIT_FAILURE;
+    }
+
+    if( strcmp( argv[2], "simple" ) == 0 )
+        scheme = MPLY_RASTER_SIMPLE;
+    else if( strcmp( argv[2], "healpix" ) == 0 )
+        scheme = MPLY_RASTER_HEALPIX;
+    else {
+        fprintf( stderr, "ERROR: unknown scheme '%s' (simple or healpix)\n", argv[2] );
+        return EXIT_FAILURE;
+    }
+    res = atoi( argv[3] );
+    if( argc > 5 )
+        sub = atoi( argv[5] );
+
+    fprintf( stderr, "READING polygon file: %s\n", argv[1] );
+    ply = mply_load_file( argv[1] );    /* parallel with OpenMP */
+    /* threads are placed with OMP_PROC_BIND / OMP_PLACES */
+    mply_mem_place( ply, mply_mem_policy( getenv( "MANGLE_MEM" ) ) );
+
+    r = mply_raster_init( scheme, res, sub );
+    fprintf( stderr, "RASTERIZING: %zu pixels\n", r->npix );
+    mply_raster_fill( r, ply );
+
+    for( i = 0; i < r->npix; i++ )
+        sum += r->map[i];
+    pix_area = 4.0 * PI / r->npix;
+    fprintf( stderr, "PIXELS: %zu empty, %zu full, %zu boundary\n", r->nempty, r->nfull,
+             r->nboundary );
+    fprintf( stderr, "WEIGHTED AREA: %g str (mask: %g str)\n", sum * pix_area,
+             mply_area_weighted_total( ply, 0.0 ) );
+
+    mply_raster_write( r, argv[4] );
+
+    r = mply_raster_kill( r );
+    ply = mply_kill( ply );
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <minimal_mangle.c>
+#include <mply_region.c>
+#include <mply_partial.c>
+
+int
+main( int argc, char **argv )
+{
+    MANGLE_PLY *ply;
+    MANGLE_INT n, *index = NULL;
+    char *pidx;
+    FILE *fp;
+
+    if( argc < 6 || ( strcmp( argv[2], "cap" ) == 0 && argc < 6 ) ||
+        ( strcmp( argv[2], "box" ) == 0 && argc < 7 ) ) {
+        printf( "Usage: %s  POLYGON  cap  RA  DEC  RADIUS  >  OUTPUT_POLYGON\n", argv[0] );
+        printf( "       %s  POLYGON  box  RA_MIN  RA_MAX  DEC_MIN  DEC_MAX  >  OUTPUT_POLYGON\n",
+                argv[0] );
+        printf( "  (all in degrees; RA_MAX < RA_MIN wraps through 0, RA_MAX = RA_MIN is empty,\n" );
+        printf( "   use 0 360 for all RA)\n" );
+        return EXIT_FAILURE;
+    }
+
+    if( strcmp( argv[2], "cap" ) != 0 && strcmp( argv[2], "box" ) != 0 ) {
+        fprintf( stderr, "ERROR: unknown region type '%s' (cap or box)\n", argv[2] );
+        return EXIT_FAILURE;
+    }
+
+    /* with a pixel index (see mply_pidx), only load the pixels in the region */
+    pidx = mply_pidx_name( argv[1] );
+    fp = fopen( pidx, "rb" );
+    if( NULL != fp )
+        fclose( fp );
+
+    ply = mply_init( 0 );
+    if( strcmp( argv[2], "cap" ) == 0 ) {
+        MANGLE_CAP cap;
+        mply_cap_from_radec( &cap, strtod( argv[3], NULL ), strtod( argv[4], NULL ),
+                             strtod( argv[5], NULL ) );
+        if( NULL != fp ) {
+            fprintf( stderr, "READING polygon file: %s (region only, from %s)\n", argv[1], pidx );
+            mply_read_caps_into( ply, argv[1], pidx, &cap, 1 );
+        } else {
+            fprintf( stderr, "READING polygon file: %s\n", argv[1] );
+            mply_read_file_into( ply, argv[1] );
+        }
+        n = mply_find_polys_in_cap( ply, &cap, &index );
+    } else {
+        double ra0 = strtod( argv[3], NULL ), ra1 = strtod( argv[4], NULL );
+        double dec0 = strtod( argv[5], NULL ), dec1 = strtod( argv[6], NULL );
+        if( NULL != fp ) {
+            fprintf( stderr, "READING polygon file: %s (region only, from %s)\n", argv[1], pidx );
+            mply_read_box_into( ply, argv[1], pidx, ra0, ra1, dec0, dec1 );
+        } else {
+            fprintf( stderr, "READING polygon file: %s\n", argv[1] );
+            mply_read_file_into( ply, argv[1] );
+        }
+        n = mply_find_polys_in_box( ply, ra0, ra1, dec0, dec1, &index );
+    }
+
+    fprintf( stderr, "SELECTED: %zd of %zd polygons\n", ( ssize_t ) n, ( ssize_t ) ply->npoly );
+    if( n < 1 ) {
+        /* a polygon file without polygons could not be read back */
+        fprintf( stderr, "ERROR: no polygons in the region, nothing written\n" );
+        CHECK_FREE( index );
+        CHECK_FREE( pidx );
+        ply = mply_kill( ply );
+        return EXIT_FAILURE;
+    }
+    mply_write_fp( stdout, ply, index, n );
+
+    CHECK_FREE( index );
+    CHECK_FREE( pidx );
+    ply = mply_kill( ply );
+
+    return EXIT_SUCCESS;
+}
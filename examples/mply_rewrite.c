@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <minimal_mangle.c>
+#include <mply_rewrite.c>
+
+int
+main( int argc, char **argv )
+{
+    MANGLE_PLY *ply;
+    int i, sort = FALSE, nozero = FALSE, dedupe = FALSE, renumber = FALSE;
+
+    if( argc < 3 ) {
+        printf( "Usage: %s  POLYGON  OUTPUT_POLYGON  [sort]  [nozero]  [dedupe]  [renumber]\n",
+                argv[0] );
+        printf( "  sort:     order polygons by pixel\n" );
+        printf( "  nozero:   drop polygons with zero weight (an error if that is all of them)\n" );
+        printf( "  dedupe:   drop repeated polygons (same caps and weight)\n" );
+        printf( "  renumber: set polyids to 0 .. N-1 (after the above)\n" );
+        return EXIT_FAILURE;
+    }
+
+    for( i = 3; i < argc; i++ ) {
+        if( strcmp( argv[i], "sort" ) == 0 )
+            sort = TRUE;
+        else if( strcmp( argv[i], "nozero" ) == 0 )
+            nozero = TRUE;
+        else if( strcmp( argv[i], "dedupe" ) == 0 )
+            dedupe = TRUE;
+        else if( strcmp( argv[i], "renumber" ) == 0 )
+            renumber = TRUE;
+        else {
+            fprintf( stderr, "ERROR: unknown option '%s'\n", argv[i] );
+            return EXIT_FAILURE;
+        }
+    }
+
+    fprintf( stderr, "READING polygon file: %s\n", argv[1] );
+    ply = mply_read_file( argv[1] );
+    fprintf( stderr, "READ: %zd polygons\n", ( ssize_t ) ply->npoly );
+
+    if( nozero )
+        fprintf( stderr, "DROPPED: %zd zero weight polygons\n",
+                 ( ssize_t ) mply_drop_zero_weight( ply ) );
+    if( dedupe )
+        fprintf( stderr, "DROPPED: %zd repeated polygons\n", ( ssize_t ) mply_dedupe( ply ) );
+    if( sort ) {
+        if( ply->pix_res < 1 )
+            fprintf( stderr, "WARNING: polygon file is not pixelized, not sorting\n" );
+        else
+            mply_sort_by_pixel( ply );
+    }
+    if( renumber )
+        mply_renumber( ply );
+
+    fprintf( stderr, "WRITING: %zd polygons to %s\n", ( ssize_t ) ply->npoly, argv[2] );
+    mply_write_file( ply, argv[2] );
+
+    ply = mply_kill( ply );
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <minimal_mangle.c>
+#include <mply_server.c>
+#include <mply_mem.c>
+
+typedef struct {
+    int listen_fd;
+    MANGLE_PLY **ply;
+    size_t nply;
+    int pin;
+} SERVE_ARGS;
+
+typedef struct {
+    SERVE_ARGS *s;
+    int id;
+} SERVE_WORKER;
+
+static void *
+serve_worker( void *arg )
+{
+    SERVE_WORKER *w = ( SERVE_WORKER * ) arg;
+    SERVE_ARGS *s = w->s;
+
+    if( s->pin && !mply_mem_pin( w->id ) )
+        fprintf( stderr, "WARNING: could not pin worker %d\n", w->id );
+
+    /* each worker takes the next connection, and serves it until it closes */
+    while( TRUE ) {
+        int fd = accept( s->listen_fd, NULL, NULL );
+        if( fd < 0 ) {
+            if( EINTR == errno || ECONNABORTED == errno )
+                continue;
+            perror( "MANGLE Error: accept" );
+            break;
+        }
+        mply_server_handle( fd, s->ply, s->nply );
+        close( fd );
+    }
+    return NULL;
+}
+
+int
+main( int argc, char **argv )
+{
+    SERVE_ARGS s;
+    SERVE_WORKER *worker;
+    pthread_t *thread;
+    sigset_t sigs;
+    size_t i;
+    int nthread, sig, policy;
+
+    if( argc < 4 ) {
+        printf( "Usage: %s  SOCKET_PATH  NTHREADS  POLYGON  [POLYGON ...]\n", argv[0] );
+        return EXIT_FAILURE;
+    }
+
+    nthread = atoi( argv[2] );
+    if( nthread < 1 )
+        nthread = 1;
+
+    /* e.g. MANGLE_MEM=huge,interleave,pin */
+    policy = mply_mem_policy( getenv( "MANGLE_MEM" ) );
+    s.pin = ( policy & MPLY_MEM_PIN ) != 0;
+
+    s.nply = argc - 3;
+    s.ply = ( MANGLE_PLY ** ) check_alloc( s.nply, sizeof( MANGLE_PLY * ) );
+    for( i = 0; i < s.nply; i++ ) {
+        int applied;
+        fprintf( stderr, "READING mask %zu: %s\n", i, argv[i + 3] );
+        s.ply[i] = mply_read_file( argv[i + 3] );
+        applied = mply_mem_place( s.ply[i], policy );
+        if( applied )
+            fprintf( stderr, "PLACED mask %zu:%s%s\n", i,
+                     applied & MPLY_MEM_HUGE ? " huge pages" : "",
+                     applied & MPLY_MEM_INTERLEAVE ? " interleaved" : "" );
+    }
+
+    /* only the main thread handles shutdown, so it can remove the socket */
+    sigemptyset( &sigs );
+    sigaddset( &sigs, SIGINT );
+    sigaddset( &sigs, SIGTERM );
+    sigaddset( &sigs, SIGHUP );
+    pthread_sigmask( SIG_BLOCK, &sigs, NULL );
+
+    s.listen_fd = mply_server_listen( argv[1] );
+
+    thread = ( pthread_t * ) check_alloc( nthread, sizeof( pthread_t ) );
+    worker = ( SERVE_WORKER * ) check_alloc( nthread, sizeof( SERVE_WORKER ) );
+    for( i = 0; i < ( size_t ) nthread; i++ ) {
+        worker[i].s = &s;
+        worker[i].id = ( int ) i;
+        if( pthread_create( &thread[i], NULL, serve_worker, &worker[i] ) != 0 ) {
+            fprintf( stderr, "MANGLE Error: cannot start worker threads\n" );
+            unlink( argv[1] );
+            return EXIT_FAILURE;
+        }
+    }
+    fprintf( stderr, "SERVING: %zu masks on %s with %d threads\n", s.nply, argv[1], nthread );
+
+    sigwait( &sigs, &sig );
+
+    fprintf( stderr, "DONE: shutting down on signal %d\n", sig );
+    close( s.listen_fd );
+    unlink( argv[1] );
+
+    /* workers may be in the middle of a request: just exit */
+    return EXIT_SUCCESS;
+}
@@ -2,32 +2,124 @@
 #include <stdio.h>
 
 #include <minimal_mangle.c>
-#include <simple_reader.c>
+#include <mply_pipe.c>
+#include <mply_edge.c>
+#include <mply_shard.c>
+#include <mply_attr.c>
 
 #ifndef TRUE
 #define TRUE  1
 #define FALSE 0
 #endif
 
+typedef struct {
+    MANGLE_PLY *ply;
+    int reverse_trim;
+    double min_weight;
+    double buffer;              /* radians, 0 for no buffer */
+    double *dist;
+    size_t ndist;
+    size_t nkeep;
+    int sharded;
+    MANGLE_SHARD shard;
+    int has_attr;
+    MANGLE_ATTR attr;
+} TRIM_ARGS;
+
+static void
+trim_chunk( MANGLE_PIPE_CHUNK * const c, void *arg )
+{
+    TRIM_ARGS *t = ( TRIM_ARGS * ) arg;
+    size_t i;
+
+    if( t->buffer > 0.0 ) {
+        if( c->nline > t->ndist ) {
+            t->ndist = c->nline;
+            t->dist = ( double * ) check_realloc( t->dist, t->ndist, sizeof( double ) );
+        }
+        mply_edge_distance_radec_batch( t->ply, c->nline, c->ra, c->dec, c->index, t->buffer,
+                                        t->dist );
+    }
+
+    for( i = 0; i < c->nline; i++ ) {
+        double weight;
+
+        if( t->sharded && !mply_shard_owns( c, i ) )
+            continue;
+
+        if( c->index[i] < 0 )
+            weight = 0.0;
+        else
+            weight = mply_weight_from_index( t->ply, c->index[i] );
+
+        {
+            int skip = FALSE;
+
+            if( weight < t->min_weight )
+                skip = TRUE;
+
+            /* too close to the edge of the mask */
+            if( t->buffer > 0.0 && t->dist[i] < t->buffer )
+                skip = TRUE;
+
+            if( t->reverse_trim )
+                skip = skip ? FALSE : TRUE;
+
+            if( skip )
+                continue;
+        }
+
+        t->nkeep += 1;
+        if( t->sharded )
+            mply_shard_out_row( &t->shard, c, i );
+        if( t->has_attr ) {
+            /* the kept line, then the selected columns */
+            size_t len = c->line_len[i] + t->attr.nsel * MPLY_DTOA_SIZE + 1;
+            char *o = mply_pipe_out_reserve( c, len ), *e;
+
+            memcpy( o, c->line[i], c->line_len[i] );
+            e = mply_attr_write_row( &t->attr, c->index[i], o + c->line_len[i] );
+            *e++ = '\n';
+            c->out_len += e - o;
+        } else {
+            mply_pipe_out_line( c, i );
+        }
+    }
+    if( t->sharded )
+        mply_shard_next( &t->shard, c );
+}
+
 int
 main( int argc, char **argv )
 {
     /* these could also be declared as "void *" */
     MANGLE_PLY *ply;
-    simple_reader *sr;
+    FILE *fp;
+    TRIM_ARGS t;
 
     int reverse_trim = FALSE;
     double min_weight = 0.0;
-    size_t nread = 0, nkeep = 0;
+    double buffer = 0.0;
+    size_t nread = 0;
 
     if( argc < 3 ) {
-        printf( "Usage: %s  RA_DEC_FILE POLYGON  [MIN_WEIGHT]  [REVERSE_TRIM]  >  OUTPUT\n",
-                argv[0] );
+        printf( "Usage: %s  RA_DEC_FILE POLYGON  [MIN_WEIGHT]  [REVERSE_TRIM]  [BUFFER_ARCSEC]"
+                "  >  OUTPUT\n", argv[0] );
+        printf( "  (with MANGLE_SHARD=K/N, run as shard K of N: see mply_merge)\n" );
+        printf( "  (with MANGLE_ATTR=FILE.attr:NAME,..., append those columns to each line)\n" );
         return EXIT_FAILURE;
     }
 
+    t.sharded = mply_shard_parse( &t.shard, getenv( "MANGLE_SHARD" ) );
     fprintf( stderr, "READING polygon file: %s\n", argv[2] );
-    ply = mply_read_file( argv[2] );
+    if( t.sharded ) {
+        ply = mply_shard_read( &t.shard, argv[2] );
+        fprintf( stderr, "SHARD %d of %d: pixels %zd to %zd, %zd polygons\n", t.shard.ishard,
+                 t.shard.nshard, ( ssize_t ) t.shard.pix0, ( ssize_t ) t.shard.pix1 - 1,
+                 ( ssize_t ) ply->npoly );
+    } else {
+        ply = mply_read_file( argv[2] );
+    }
 
     if( argc > 3 ) {
         min_weight = strtod( argv[3], NULL );
@@ -45,64 +137,54 @@ main( int argc, char **argv )
         else if( strncasecmp( "on", s, 2 ) == 0 )
             reverse_trim = TRUE;
     }
+    if( argc > 5 ) {
+        buffer = strtod( argv[5], NULL );
+    }
+    if( buffer > 0.0 && t.sharded ) {
+        /* the edge walk can leave the shard's pixels */
+        fprintf( stderr, "ERROR: BUFFER_ARCSEC is not supported with MANGLE_SHARD\n" );
+        return EXIT_FAILURE;
+    }
+
+    t.has_attr = FALSE;
+    if( NULL != getenv( "MANGLE_ATTR" ) && '\0' != getenv( "MANGLE_ATTR" )[0] ) {
+        if( t.sharded ) {
+            /* attribute rows follow the whole mask's INDEX */
+            fprintf( stderr, "ERROR: MANGLE_ATTR is not supported with MANGLE_SHARD\n" );
+            return EXIT_FAILURE;
+        }
+        t.has_attr = mply_attr_env( &t.attr, ply, getenv( "MANGLE_ATTR" ) );
+        fprintf( stderr, "ATTRIBUTES: %d columns from %s\n", t.attr.nsel,
+                 getenv( "MANGLE_ATTR" ) );
+    }
 
     if( reverse_trim )
         fprintf( stderr, "FILTERING: vetoing weight >= %g (REVERSED!)\n", min_weight );
     else
         fprintf( stderr, "FILTERING: keeping weight >= %g\n", min_weight );
-
-    sr = sr_init( argv[1] );    /* simple line-by-line reader */
-    fprintf( stderr, "PROCESSING: ra dec from %s\n", sr_filename( sr ) );
-    while( sr_readline( sr ) ) {
-        char *line;
-        int check;
-        MANGLE_INT index;
-        double ra, dec, weight;
-
-        line = sr_line( sr );
-
-        if( sr_line_isempty( sr ) )
-            continue;
-        if( '#' == line[0] )
-            continue;
-
-        check = sscanf( line, "%lf %lf", &ra, &dec );
-        if( 2 != check ) {
-            fprintf( stderr, "WARNING: skipped line, couldn't read RA/DEC on line %d in file %s\n",
-                     sr_linenum( sr ), sr_filename( sr ) );
-            continue;
-        }
-
-        nread += 1;
-
-        index = mply_find_polyindex_radec( ply, ra, dec );
-
-        if( index < 0 )
-            weight = 0.0;
-        else
-            weight = mply_weight_from_index( ply, index );
-
-        {
-            int skip = FALSE;
-
-            if( weight < min_weight )
-                skip = TRUE;
-
-            if( reverse_trim )
-                skip = skip ? FALSE : TRUE;
-
-            if( skip )
-                continue;
-        }
-
-        nkeep += 1;
-        fprintf( stdout, "%s\n", line );
-    }
+    if( buffer > 0.0 )
+        fprintf( stderr, "FILTERING: %g arcsec or more from the mask edge\n", buffer );
+
+    t.ply = ply;
+    t.reverse_trim = reverse_trim;
+    t.min_weight = min_weight;
+    t.buffer = buffer * DEG2RAD / 3600.0;
+    t.dist = NULL;
+    t.ndist = 0;
+    t.nkeep = 0;
+
+    fp = check_fopen( argv[1], "r" );
+    fprintf( stderr, "PROCESSING: ra dec from %s\n", argv[1] );
+    nread = mply_pipe_run_filter( ply, fp, argv[1], stdout, t.sharded ? mply_shard_filter : NULL,
+                                  &t.shard, trim_chunk, &t );
+    fclose( fp );
+    CHECK_FREE( t.dist );
+    if( t.has_attr )
+        mply_attr_close( &t.attr );
 
     ply = mply_kill( ply );
-    sr = sr_kill( sr );
 
-    fprintf( stderr, "DONE: %zu -> %zu\n", nread, nkeep );
+    fprintf( stderr, "DONE: %zu -> %zu\n", nread, t.nkeep );
 
     return EXIT_SUCCESS;
 }
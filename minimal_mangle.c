@@ -49,10 +49,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
+#include <stdint.h>
 
 #include <check_alloc.c>
 #include <check_fopen.c>
 #include <simple_reader.c>
+#include <mply_sincos.c>
+#include <mply_dtoa.c>
 
 #ifndef TRUE
 #define TRUE 1
@@ -69,7 +73,22 @@
 
 #define DEG2RAD ( PI / 180.0 )
 
+/* Define MANGLE_INT64 to use a 64-bit signed integer for polygon counts,
+ * indices, cap offsets and pixel IDs.  This is only needed for very large
+ * masks or pixel resolutions beyond 15 (pixel IDs past 2^31). */
+#ifdef MANGLE_INT64
+typedef int64_t MANGLE_INT;     /* signed integer */
+#define MANGLE_INT_MIN INT64_MIN
+#define MANGLE_INT_MAX INT64_MAX
+#else
 typedef int MANGLE_INT;         /* signed integer */
+#define MANGLE_INT_MIN INT_MIN
+#define MANGLE_INT_MAX INT_MAX
+#endif
+
+/* largest simple pixelization resolution where every pixel ID fits in MANGLE_INT:
+ * IDs run up to (4^(res+1) - 1) / 3 */
+#define MANGLE_PIX_RES_MAX ( ( int ) ( 8 * sizeof( MANGLE_INT ) ) / 2 - 1 )
 
 typedef struct {
     double x[3];
@@ -80,16 +99,43 @@ typedef struct {
     double m;
 } MANGLE_CAP;
 
+/* Define MANGLE_FLOAT_CAPS to keep a float copy of every cap (16 bytes
+ * instead of 32) for the point-in-polygon scans.  A float test only decides
+ * when the point is clearly inside or outside; within MPLY_CAPF_EPS of the
+ * boundary the double cap is tested instead, so results are identical to
+ * the double-only code. */
+#ifdef MANGLE_FLOAT_CAPS
+/* the sign of m is folded in, so the test is x.v + k > 0 for either kind
+ * of cap: x = s c and k = m - s, with s = +1 (m >= 0) or -1 (m < 0) */
+typedef struct {
+    float x[3];
+    float k;
+} MANGLE_CAPF;
+
+/* bound on the float error of x.v + k (about 10 float ulps at 1), with
+ * room to spare */
+#define MPLY_CAPF_EPS 4.0e-6f
+#endif
+
+/* per-polygon metadata: this is "cold" data, only consulted after a match */
 typedef struct {
     MANGLE_INT ipoly;           /* internal index: will be unique */
     MANGLE_INT polyid;
     MANGLE_INT pixel;
     MANGLE_INT ncap;
-    MANGLE_CAP *cap;
+    MANGLE_CAP *cap;            /* view into MANGLE_PLY cap array */
     double weight;
     double area;
 } MANGLE_POLY;
 
+/* "hot" query data: everything needed to test a point against a polygon.
+ * Kept in a compact array parallel to the MANGLE_POLY array, so scanning
+ * candidates does not drag the metadata through cache. */
+typedef struct {
+    MANGLE_INT icap;            /* offset of first cap in MANGLE_PLY cap array */
+    MANGLE_INT ncap;
+} MANGLE_HOT;
+
 /* this is a linked list structure */
 typedef struct {
     void *data;
@@ -98,7 +144,14 @@ typedef struct {
 
 typedef struct {
     MANGLE_INT npoly;
-    MANGLE_POLY *poly;
+    MANGLE_POLY *poly;          /* cold: metadata, indexed by INDEX */
+    MANGLE_HOT *hot;            /* hot: cap offset and count, indexed by INDEX */
+    MANGLE_INT ncap;
+    MANGLE_INT ncap_alloc;
+    MANGLE_CAP *cap;            /* caps for all polygons, stored contiguously */
+#ifdef MANGLE_FLOAT_CAPS
+    MANGLE_CAPF *capf;          /* float copy of cap, built by mply_cap_link() */
+#endif
     MANGLE_INT pix_res;         /* pix_res = 0 is full sky: aka no pixels */
     DATA_LIST *pix;             /* pixel-indexed array of linked-lists */
 } MANGLE_PLY;
@@ -108,7 +161,16 @@ static inline size_t
 mply_pow2i( const int x )
 {
     /* as long as x is small, do pow() via bitshift! */
-    return ( 1 << x );
+    return ( ( size_t ) 1 << x );
+}
+
+/* range check for integers read from file, before storing as MANGLE_INT */
+static inline int
+mply_int_fits( const long long x )
+{
+    if( x < MANGLE_INT_MIN || x > MANGLE_INT_MAX )
+        return FALSE;
+    return TRUE;
 }
 
 INLINE size_t
@@ -126,6 +188,12 @@ mply_pix_alloc( MANGLE_PLY * const ply, const int pix_res )
 {
     /* use pix_res to allocate ply->pix array */
     size_t i, count;
+    if( pix_res > MANGLE_PIX_RES_MAX ) {
+        fprintf( stderr,
+                 "MANGLE Error: pixel_res=%d too large, maximum is %d (see MANGLE_INT64)\n",
+                 pix_res, MANGLE_PIX_RES_MAX );
+        exit( EXIT_FAILURE );
+    }
     count = mply_pix_count( pix_res );
     ply->pix = ( DATA_LIST * ) check_alloc( count, sizeof( DATA_LIST ) );
     ply->pix_res = pix_res;
@@ -167,37 +235,89 @@ mply_pix_clean( MANGLE_PLY * const ply )
 INLINE MANGLE_INT
 mply_pix_id_start( MANGLE_PLY const *const ply )
 {
-    int pix_id;
-    MANGLE_INT res;
+    MANGLE_INT pix_id;
+    int res;
 
     res = ply->pix_res;
-    pix_id = ( mply_pow2i( 2 * res ) - 1 ) / 3;
+    pix_id = ( MANGLE_INT ) ( ( mply_pow2i( 2 * res ) - 1 ) / 3 );
     return pix_id;
 }
 
 /* INDEX refers to the internal storage index, which is in pixel order but
  * zero-indexed rather than numbered according to resolution as the
- * "simple pixelization" scheme in MANGLE does */
+ * "simple pixelization" scheme in MANGLE does.  Any azimuth is accepted
+ * (e.g. ra = 360 or -10 degrees): it is wrapped into [0, 2 PI) first. */
 INLINE MANGLE_INT
-mply_pix_which_index( MANGLE_PLY const *const ply, const double az, double el )
+mply_pix_which_index_sin( MANGLE_PLY const *const ply, double az, const double sin_el )
 {
-    int n, m;
+    MANGLE_INT n, m;
     MANGLE_INT base_pix, pow2r;
 
     pow2r = mply_pow2i( ply->pix_res );
 
+    if( az < 0.0 || az >= 2.0 * PI ) {
+        az = fmod( az, 2.0 * PI );
+        if( az < 0.0 )
+            az += 2.0 * PI;
+        if( az >= 2.0 * PI )    /* tiny negative azimuth rounded up */
+            az = 0.0;
+    }
+
     /* algorithm made to replicate comparisons in Mangle's which_pixel.c */
-    if( sin( el ) == 1.0 ) {
+    if( sin_el == 1.0 ) {
         n = 0;
     } else {
-        n = ( int ) ceil( ( 1.0 - sin( el ) ) / 2.0 * pow2r ) - 1;
+        n = ( MANGLE_INT ) ceil( ( 1.0 - sin_el ) / 2.0 * pow2r ) - 1;
     }
-    m = ( int ) floor( az / 2.0 / PI * pow2r );
+    m = ( MANGLE_INT ) floor( az / 2.0 / PI * pow2r );
+    if( m >= pow2r )            /* az just under 2 PI, rounded up */
+        m = pow2r - 1;
     base_pix = pow2r * n + m;
 
     return base_pix;
 }
 
+INLINE MANGLE_INT
+mply_pix_which_index( MANGLE_PLY const *const ply, const double az, double el )
+{
+    return mply_pix_which_index_sin( ply, az, sin( el ) );
+}
+
+/* same, but directly from a unit vector: z is already sin(el), so only
+ * the azimuth needs any trig (a single atan2) */
+INLINE MANGLE_INT
+mply_pix_which_index_vec( MANGLE_PLY const *const ply, MANGLE_VEC const *const vec3 )
+{
+    double az, z;
+
+    az = atan2( vec3->x[1], vec3->x[0] );       /* wrapped below */
+
+    /* guard against round-off in the vector normalization */
+    z = vec3->x[2];
+    if( z > 1.0 )
+        z = 1.0;
+    else if( z < -1.0 )
+        z = -1.0;
+
+    return mply_pix_which_index_sin( ply, az, z );
+}
+
+/* Is an approximate sin(el), good to MPLY_SINCOS_TOL, far enough from a
+ * pixel band edge that it gives the same pixel as libm sin(el)? */
+INLINE int
+mply_pix_sin_is_safe( MANGLE_PLY const *const ply, const double sin_el )
+{
+    double t, tol;
+    MANGLE_INT pow2r = mply_pow2i( ply->pix_res );
+
+    t = ( 1.0 - sin_el ) / 2.0 * pow2r;
+    tol = MPLY_SINCOS_TOL * pow2r;
+    t -= floor( t );
+    if( t <= tol || t >= 1.0 - tol )
+        return FALSE;
+    return TRUE;
+}
+
 INLINE MANGLE_INT
 mply_pix_which_id( MANGLE_PLY const *const ply, const double az, const double el )
 {
@@ -262,26 +382,115 @@ mply_pix_addpoly( MANGLE_PLY const *const ply, MANGLE_POLY const *const p )
     dl->next = NULL;            /* pointer to next DATA_LIST */
 }
 
-/* The POLY structure holds a list of caps, not the umbrella PLY structure */
+/* The PLY structure holds all caps in one contiguous array.  Reserve room
+ * for ncap more caps and return the offset of the first one.  This may move
+ * the cap array, so any MANGLE_POLY cap pointers have to be re-linked
+ * afterwards (see mply_cap_link). */
+MANGLE_INT
+mply_cap_reserve( MANGLE_PLY * const ply, const MANGLE_INT ncap )
+{
+    MANGLE_INT icap = ply->ncap;
+
+    if( ncap > MANGLE_INT_MAX - ply->ncap ) {
+        fprintf( stderr, "MANGLE Error: too many caps (%zd + %zd), see MANGLE_INT64\n",
+                 ( ssize_t ) ply->ncap, ( ssize_t ) ncap );
+        exit( EXIT_FAILURE );
+    }
+
+    if( ply->ncap + ncap > ply->ncap_alloc ) {
+        MANGLE_INT nalloc = ply->ncap_alloc > 0 ? ply->ncap_alloc : 64;
+        while( nalloc < ply->ncap + ncap ) {
+            if( nalloc > MANGLE_INT_MAX / 2 ) {
+                nalloc = MANGLE_INT_MAX;
+                break;
+            }
+            nalloc *= 2;
+        }
+        ply->cap = ( MANGLE_CAP * ) check_realloc( ply->cap, nalloc, sizeof( MANGLE_CAP ) );
+        ply->ncap_alloc = nalloc;
+    }
+    ply->ncap += ncap;
+
+    return icap;
+}
+
+#ifdef MANGLE_FLOAT_CAPS
+INLINE void
+mply_capf_from_cap( MANGLE_CAPF * const cf, MANGLE_CAP const *const c )
+{
+    double sign = c->m < 0.0 ? -1.0 : 1.0;
+    cf->x[0] = ( float ) ( sign * c->x[0] );
+    cf->x[1] = ( float ) ( sign * c->x[1] );
+    cf->x[2] = ( float ) ( sign * c->x[2] );
+    cf->k = ( float ) ( c->m - sign );
+}
+#endif
+
+/* point each MANGLE_POLY cap view at the current (final) cap storage */
 void
-mply_poly_alloc( MANGLE_POLY * p, const MANGLE_INT ipoly, const MANGLE_INT polyid,
+mply_cap_link( MANGLE_PLY * const ply )
+{
+    MANGLE_INT i;
+    for( i = 0; i < ply->npoly; i++ ) {
+        if( ply->hot[i].ncap > 0 )
+            ply->poly[i].cap = &( ply->cap[ply->hot[i].icap] );
+        else
+            ply->poly[i].cap = NULL;
+    }
+#ifdef MANGLE_FLOAT_CAPS
+    CHECK_FREE( ply->capf );
+    if( ply->ncap > 0 ) {
+        ply->capf = ( MANGLE_CAPF * ) check_alloc( ply->ncap, sizeof( MANGLE_CAPF ) );
+        for( i = 0; i < ply->ncap; i++ )
+            mply_capf_from_cap( &( ply->capf[i] ), &( ply->cap[i] ) );
+    }
+#endif
+}
+
+/* the cap array grows while reading: trim it and fix up the views */
+void
+mply_cap_shrink( MANGLE_PLY * const ply )
+{
+    if( ply->ncap < ply->ncap_alloc ) {
+        ply->cap = ( MANGLE_CAP * ) check_realloc( ply->cap, ply->ncap, sizeof( MANGLE_CAP ) );
+        ply->ncap_alloc = ply->ncap;
+    }
+    mply_cap_link( ply );
+}
+
+/* The POLY structure only holds metadata and a view of its caps; the caps
+ * themselves are owned by the umbrella PLY structure.  The returned cap
+ * pointer is valid until the next call to mply_cap_reserve(). */
+MANGLE_POLY *
+mply_poly_alloc( MANGLE_PLY * const ply, const MANGLE_INT ipoly, const MANGLE_INT polyid,
                  const MANGLE_INT ncap, const double weight, const MANGLE_INT pixel,
                  const double area )
 {
+    MANGLE_POLY *p;
+    MANGLE_HOT *h;
+
+    p = &( ply->poly[ipoly] );
+    h = &( ply->hot[ipoly] );
+
+    h->icap = mply_cap_reserve( ply, ncap );
+    h->ncap = ncap;
+
     p->ipoly = ipoly;
     p->polyid = polyid;
-    p->cap = ( MANGLE_CAP * ) check_alloc( ncap, sizeof( MANGLE_CAP ) );
+    p->cap = &( ply->cap[h->icap] );
     p->ncap = ncap;
     p->weight = weight;
     p->pixel = pixel;
     p->area = area;
+
+    return p;
 }
 
 void
 mply_poly_clean( MANGLE_POLY * p )
 {
     p->polyid = -1;
-    CHECK_FREE( p->cap );
+    p->cap = NULL;              /* owned by MANGLE_PLY */
     p->ncap = 0;
     p->weight = 0.0;
     p->pixel = -1;
@@ -294,10 +503,18 @@ mply_alloc( MANGLE_PLY * ply, MANGLE_INT npoly )
 {
     if( npoly > 0 ) {
         ply->poly = ( MANGLE_POLY * ) check_alloc( npoly, sizeof( MANGLE_POLY ) );
+        ply->hot = ( MANGLE_HOT * ) check_alloc( npoly, sizeof( MANGLE_HOT ) );
     } else {
         ply->poly = NULL;
+        ply->hot = NULL;
     }
     ply->npoly = npoly;
+    ply->cap = NULL;
+#ifdef MANGLE_FLOAT_CAPS
+    ply->capf = NULL;
+#endif
+    ply->ncap = 0;
+    ply->ncap_alloc = 0;
     ply->pix_res = 0;
 }
 
@@ -311,7 +528,14 @@ mply_clean( MANGLE_PLY * ply )
         mply_poly_clean( p );
     }
     CHECK_FREE( ply->poly );
+    CHECK_FREE( ply->hot );
+    CHECK_FREE( ply->cap );
+#ifdef MANGLE_FLOAT_CAPS
+    CHECK_FREE( ply->capf );
+#endif
     ply->npoly = 0;
+    ply->ncap = 0;
+    ply->ncap_alloc = 0;
     if( ply->pix_res > 0 )
         mply_pix_clean( ply );
 }
@@ -333,12 +557,61 @@ mply_kill( MANGLE_PLY * ply )
     return NULL;
 }
 
+/* Parse the "polygon" line currently in sr, and the cap lines after it,
+ * into polygon INDEX ipoly.  Does not touch the pixel index. */
+MANGLE_POLY *
+mply_read_poly( MANGLE_PLY * const ply, const MANGLE_INT ipoly, simple_reader * const sr )
+{
+    int check;
+    MANGLE_INT i;
+    long long polyid, ncap, pixel;
+    double weight, area;
+    char *line;
+    MANGLE_POLY *p;
+
+    line = sr_line( sr );
+    check =
+        sscanf( line,
+                "polygon %lld ( %lld caps, %lf weight, %lld pixel, %lf",
+                &polyid, &ncap, &weight, &pixel, &area );
+    if( check != 5 || ncap < 1 ) {
+        fprintf( stderr,
+                 "MANGLE Error: polygon read error line %zu in file: %s\n",
+                 sr_linenum( sr ), sr_filename( sr ) );
+        exit( EXIT_FAILURE );
+    }
+    if( !mply_int_fits( polyid ) || !mply_int_fits( ncap ) || !mply_int_fits( pixel ) ) {
+        fprintf( stderr,
+                 "MANGLE Error: polygon values overflow MANGLE_INT line %zu in file: %s\n",
+                 sr_linenum( sr ), sr_filename( sr ) );
+        exit( EXIT_FAILURE );
+    }
+
+    p = mply_poly_alloc( ply, ipoly, ( MANGLE_INT ) polyid, ( MANGLE_INT ) ncap, weight,
+                         ( MANGLE_INT ) pixel, area );
+    for( i = 0; i < ncap; i++ ) {
+        MANGLE_CAP *c;
+        c = &p->cap[i];
+        line = sr_readline( sr );
+        check = NULL == line ? 0 :
+            sscanf( line, "%lf %lf %lf %lf", &c->x[0], &c->x[1], &c->x[2], &c->m );
+        if( check != 4 ) {
+            fprintf( stderr,
+                     "MANGLE Error: cap read error on line %zu in file: %s\n",
+                     sr_linenum( sr ), sr_filename( sr ) );
+            exit( EXIT_FAILURE );
+        }
+    }
+
+    return p;
+}
+
 void
 mply_read_file_into( MANGLE_PLY * const ply, char const *const filename )
 {
     /* read in polygon format */
     int check;
-    int npoly = 0;
+    long long npoly = 0;
     MANGLE_INT ipoly = 0;
     simple_reader *sr;
     char *line;
@@ -350,15 +623,21 @@ mply_read_file_into( MANGLE_PLY * const ply, char const *const filename )
 
     /* first line sets up the polygons */
     line = sr_readline( sr );
-    check = sscanf( line, "%d polygons", &npoly );
+    check = sscanf( line, "%lld polygons", &npoly );
     if( check != 1 || npoly < 1 ) {
         fprintf( stderr,
-                 "MANGLE Error: polygons (%d) must be positive in file: %s\n",
+                 "MANGLE Error: polygons (%lld) must be positive in file: %s\n",
+                 npoly, sr_filename( sr ) );
+        exit( EXIT_FAILURE );
+    }
+    if( !mply_int_fits( npoly ) ) {
+        fprintf( stderr,
+                 "MANGLE Error: polygons (%lld) too many for MANGLE_INT in file: %s\n",
                  npoly, sr_filename( sr ) );
         exit( EXIT_FAILURE );
     }
 
-    mply_alloc( ply, npoly );
+    mply_alloc( ply, ( MANGLE_INT ) npoly );
 
     /* read other header directives */
     while( sr_readline( sr ) ) {
@@ -388,8 +667,6 @@ mply_read_file_into( MANGLE_PLY * const ply, char const *const filename )
     /* now off to POLY processing */
     ipoly = 0;
     do {
-        int i, polyid, ncap, pixel;
-        double weight, area;
         MANGLE_POLY *p;
 
         if( sr_line_isempty( sr ) )
@@ -398,39 +675,13 @@ mply_read_file_into( MANGLE_PLY * const ply, char const *const filename )
         line = sr_line( sr );
 
         if( strncmp( "polygon", line, 7 ) == 0 ) {
-            check =
-                sscanf( line,
-                        "polygon %d ( %d caps, %lf weight, %d pixel, %lf",
-                        &polyid, &ncap, &weight, &pixel, &area );
-            if( check != 5 || ncap < 1 ) {
-                fprintf( stderr,
-                         "MANGLE Error: polygon read error line %d in file: %s\n",
-                         sr_linenum( sr ), sr_filename( sr ) );
-                exit( EXIT_FAILURE );
-            }
-
             if( ipoly >= ply->npoly ) {
                 fprintf( stderr,
-                         "MANGLE Error: too many polygons on line %d in file: %s\n",
+                         "MANGLE Error: too many polygons on line %zu in file: %s\n",
                          sr_linenum( sr ), sr_filename( sr ) );
                 exit( EXIT_FAILURE );
             }
-
-            /* we're starting a valid polygon! */
-            p = &ply->poly[ipoly];
-            mply_poly_alloc( p, ipoly, polyid, ncap, weight, pixel, area );
-            for( i = 0; i < ncap; i++ ) {
-                MANGLE_CAP *c;
-                c = &p->cap[i];
-                line = sr_readline( sr );
-                check = sscanf( line, "%lf %lf %lf %lf", &c->x[0], &c->x[1], &c->x[2], &c->m );
-                if( check != 4 ) {
-                    fprintf( stderr,
-                             "MANGLE Error: cap read error on line %d in file: %s\n",
-                             sr_linenum( sr ), sr_filename( sr ) );
-                    exit( EXIT_FAILURE );
-                }
-            }
+            p = mply_read_poly( ply, ipoly, sr );
             if( ply->pix_res > 0 ) {
                 mply_pix_addpoly( ply, p );
             }
@@ -447,6 +698,8 @@ mply_read_file_into( MANGLE_PLY * const ply, char const *const filename )
                  ( ssize_t ) ply->npoly, ( ssize_t ) ipoly );
         exit( EXIT_FAILURE );
     }
+
+    mply_cap_shrink( ply );
 }
 
 MANGLE_PLY *
@@ -458,6 +711,82 @@ mply_read_file( char const *const filename )
     return ply;
 }
 
+/* write polygons in the same format that mply_read_file_into() reads.
+ * Doubles are written with mply_dtoa(), so they read back exactly. */
+static inline char *
+mply_write_double( char *p, const double x )
+{
+    *p++ = ' ';
+    return p + mply_dtoa( x, p );
+}
+
+void
+mply_write_poly( FILE * fp, MANGLE_PLY const *const ply, const MANGLE_INT index )
+{
+    MANGLE_INT i;
+    MANGLE_POLY const *p = &( ply->poly[index] );
+    MANGLE_HOT const *h = &( ply->hot[index] );
+    char weight[MPLY_DTOA_SIZE], area[MPLY_DTOA_SIZE];
+    char line[4 * ( MPLY_DTOA_SIZE + 1 ) + 1];
+
+    mply_dtoa( p->weight, weight );
+    mply_dtoa( p->area, area );
+    fprintf( fp, "polygon %zd ( %zd caps, %s weight, %zd pixel, %s str):\n",
+             ( ssize_t ) p->polyid, ( ssize_t ) h->ncap, weight, ( ssize_t ) p->pixel, area );
+    for( i = 0; i < h->ncap; i++ ) {
+        MANGLE_CAP const *c = &( ply->cap[h->icap + i] );
+        char *e = line;
+        e = mply_write_double( e, c->x[0] );
+        e = mply_write_double( e, c->x[1] );
+        e = mply_write_double( e, c->x[2] );
+        e = mply_write_double( e, c->m );
+        *e++ = '\n';
+        fwrite( line, 1, e - line, fp );
+    }
+}
+
+/* write n polygons, given by INDEX, or all of them if index is NULL (n must
+ * be at least 1: the readers refuse a file without polygons) */
+void
+mply_write_fp( FILE * fp, MANGLE_PLY const *const ply, MANGLE_INT const *const index,
+               const MANGLE_INT n )
+{
+    MANGLE_INT i;
+
+    if( n < 1 ) {
+        fprintf( stderr, "MANGLE Error: no polygons to write\n" );
+        exit( EXIT_FAILURE );
+    }
+
+    fprintf( fp, "%zd polygons\n", ( ssize_t ) n );
+    if( ply->pix_res > 0 )
+        fprintf( fp, "pixelization %zds\n", ( ssize_t ) ply->pix_res );
+
+    for( i = 0; i < n; i++ ) {
+        mply_write_poly( fp, ply, index != NULL ? index[i] : i );
+    }
+}
+
+/* A mask without polygons is refused (before the file is created): the
+ * readers require at least one, so it could not be read back. */
+void
+mply_write_file( MANGLE_PLY const *const ply, char const *const filename )
+{
+    FILE *fp;
+
+    if( ply->npoly < 1 ) {
+        fprintf( stderr, "MANGLE Error: no polygons to write to %s\n", filename );
+        exit( EXIT_FAILURE );
+    }
+
+    fp = check_fopen( filename, "w" );
+    mply_write_fp( fp, ply, NULL, ply->npoly );
+    if( ferror( fp ) || fclose( fp ) != 0 ) {
+        perror( "MANGLE Error: cannot write polygon file" );
+        exit( EXIT_FAILURE );
+    }
+}
+
 /* this can be abstracted: a calling code can just use (void *) */
 MANGLE_VEC *
 mply_vec_init( void )
@@ -513,29 +842,95 @@ mply_within_cap( MANGLE_CAP const *const cap, MANGLE_VEC const *const vec3 )
     return FALSE;
 }
 
+/* The early exit is what makes this fast: most candidates fail on their
+ * first caps.  Branch-free versions specialized on ncap (a table of
+ * unrolled kernels, or an inlined switch with a single AND) were slower on
+ * masks of 4 and 10 caps per polygon, so there are none. */
 INLINE MANGLE_INT
-mply_within_poly( MANGLE_POLY const *const p, MANGLE_VEC const *const vec3 )
+mply_within_caps( MANGLE_CAP const *const c, const MANGLE_INT ncap,
+                  MANGLE_VEC const *const vec3 )
 {
     MANGLE_INT i;
-    MANGLE_CAP *c;
-    c = p->cap;
-    for( i = 0; i < p->ncap; i++ ) {
+    for( i = 0; i < ncap; i++ ) {
         if( !mply_within_cap( &c[i], vec3 ) )
             return FALSE;
     }
     return TRUE;
 }
 
+INLINE MANGLE_INT
+mply_within_poly( MANGLE_POLY const *const p, MANGLE_VEC const *const vec3 )
+{
+    return mply_within_caps( p->cap, p->ncap, vec3 );
+}
+
+#ifdef MANGLE_FLOAT_CAPS
+/* float test first; the double cap is only read near the boundary */
+INLINE MANGLE_INT
+mply_within_capsf( MANGLE_CAPF const *const cf, MANGLE_CAP const *const c,
+                   const MANGLE_INT ncap, float const *const vf, MANGLE_VEC const *const vec3 )
+{
+    MANGLE_INT i;
+    for( i = 0; i < ncap; i++ ) {
+        float d = cf[i].x[0] * vf[0] + cf[i].x[1] * vf[1] + cf[i].x[2] * vf[2] + cf[i].k;
+        if( d > MPLY_CAPF_EPS )
+            continue;
+        if( d < -MPLY_CAPF_EPS || !mply_within_cap( &c[i], vec3 ) )
+            return FALSE;
+    }
+    return TRUE;
+}
+
+INLINE void
+mply_vecf_from_vec( float *const vf, MANGLE_VEC const *const vec3 )
+{
+    vf[0] = ( float ) vec3->x[0];
+    vf[1] = ( float ) vec3->x[1];
+    vf[2] = ( float ) vec3->x[2];
+}
+#endif
+
+/* same as mply_within_poly(), but only touches the hot data */
+INLINE MANGLE_INT
+mply_within_index( MANGLE_PLY const *const ply, const MANGLE_INT index,
+                   MANGLE_VEC const *const vec3 )
+{
+    MANGLE_HOT const *const h = &( ply->hot[index] );
+#ifdef MANGLE_FLOAT_CAPS
+    if( NULL != ply->capf ) {
+        float vf[3];
+        mply_vecf_from_vec( vf, vec3 );
+        return mply_within_capsf( &( ply->capf[h->icap] ), &( ply->cap[h->icap] ), h->ncap, vf,
+                                  vec3 );
+    }
+#endif
+    return mply_within_caps( &( ply->cap[h->icap] ), h->ncap, vec3 );
+}
+
 /* short circuit: finds FIRST matching polygon and does not continue checking! */
 INLINE MANGLE_INT
 mply_find_polyindex_vec( MANGLE_PLY const *const ply, MANGLE_VEC const *const vec3 )
 {
     MANGLE_INT i;
-    MANGLE_POLY *p;
-
+    MANGLE_HOT const *h;
+    MANGLE_CAP const *cap;
+
+    h = ply->hot;
+    cap = ply->cap;
+#ifdef MANGLE_FLOAT_CAPS
+    if( NULL != ply->capf ) {
+        float vf[3];
+        mply_vecf_from_vec( vf, vec3 );
+        for( i = 0; i < ply->npoly; i++ ) {
+            if( mply_within_capsf( &( ply->capf[h[i].icap] ), &cap[h[i].icap], h[i].ncap, vf,
+                                   vec3 ) )
+                return i;
+        }
+        return -1;
+    }
+#endif
     for( i = 0; i < ply->npoly; i++ ) {
-        p = &( ply->poly[i] );
-        if( mply_within_poly( p, vec3 ) )
+        if( mply_within_caps( &cap[h[i].icap], h[i].ncap, vec3 ) )
             return i;
     }
     return -1;
@@ -556,28 +951,38 @@ mply_find_polyindex_vec( MANGLE_PLY const *const ply, MANGLE_VEC const *const ve
  * 2. iterates over linked-list, so more random access memory
  */
 INLINE MANGLE_INT
-mply_find_polyindex_pix( MANGLE_PLY const *const ply, const double az, const double el )
+mply_find_polyindex_in_pix( MANGLE_PLY const *const ply, const MANGLE_INT ipix,
+                            MANGLE_VEC const *const vec3 )
 {
-    MANGLE_INT ipix;
-    MANGLE_POLY *p;
-    MANGLE_VEC vec3;
+    MANGLE_INT index;
     DATA_LIST *dl;
 
-    mply_vec_from_polar( &vec3, az, el );
-    ipix = mply_pix_which_index( ply, az, el );
     dl = ( DATA_LIST * ) & ply->pix[ipix];
 
-    /* transverse our linked-list and test for matches */
+    /* transverse our linked-list and test for matches: the INDEX comes from
+     * pointer arithmetic, so the cold MANGLE_POLY is never dereferenced */
     while( dl != NULL && dl->data != NULL ) {
-        p = ( MANGLE_POLY * ) dl->data;
+        index = ( MANGLE_INT ) ( ( MANGLE_POLY const * ) dl->data - ply->poly );
         dl = ( DATA_LIST * ) dl->next;
-        if( mply_within_poly( p, &vec3 ) )
-            return p->ipoly;
+        if( mply_within_index( ply, index, vec3 ) )
+            return index;
     }
 
     return -1;
 }
 
+INLINE MANGLE_INT
+mply_find_polyindex_pix( MANGLE_PLY const *const ply, const double az, const double el )
+{
+    MANGLE_INT ipix;
+    MANGLE_VEC vec3;
+
+    mply_vec_from_polar( &vec3, az, el );
+    ipix = mply_pix_which_index( ply, az, el );
+
+    return mply_find_polyindex_in_pix( ply, ipix, &vec3 );
+}
+
 INLINE MANGLE_INT
 mply_find_polyindex_polar( MANGLE_PLY const *const ply, const double az, const double el )
 {
@@ -600,6 +1005,198 @@ mply_find_polyindex_radec( MANGLE_PLY const *const ply, const double ra, const d
     return mply_find_polyindex_polar( ply, ra * DEG2RAD, dec * DEG2RAD );
 }
 
+/* for callers that already hold unit vectors: uses the pixel index when
+ * there is one, without converting back to angles */
+INLINE MANGLE_INT
+mply_find_polyindex_xyz( MANGLE_PLY const *const ply, MANGLE_VEC const *const vec3 )
+{
+    MANGLE_INT i = -1;
+
+    if( ply->pix_res > 0 ) {
+        i = mply_find_polyindex_in_pix( ply, mply_pix_which_index_vec( ply, vec3 ), vec3 );
+    } else {
+        i = mply_find_polyindex_vec( ply, vec3 );
+    }
+
+    return i;
+}
+
+/* Batch versions: look up n points at once, writing the INDEX (or -1) of
+ * each into index[].  The trig for the unit vectors is done in chunks of
+ * MANGLE_BATCH with mply_sincos_batch() (SIMD when available).  The results
+ * are identical to the single point functions: whenever the fast sin(el)
+ * is within its error bound of a pixel band edge, libm is used for the
+ * pixel, and whenever a cap test with the fast unit vector is within its
+ * error bound of the cap edge, the point is looked up again with the libm
+ * vector (mply_find_polyindex_polar()). */
+#ifndef MANGLE_BATCH
+#define MANGLE_BATCH 256
+#endif
+
+/* Bound on the error of 1 - c.v with a fast unit vector: each component is
+ * within about 2 MPLY_SINCOS_TOL of the libm one, plus rounding. */
+#define MPLY_BATCH_CAP_TOL ( 16.0 * MPLY_SINCOS_TOL )
+
+/* "can't tell" from the _fast tests below, and the lookups built on them */
+#define MPLY_NEAR ( -2 )
+
+/* mply_within_cap() for a fast unit vector: TRUE, FALSE, or MPLY_NEAR when
+ * the libm vector might land on the other side of the edge */
+INLINE MANGLE_INT
+mply_within_cap_fast( MANGLE_CAP const *const cap, MANGLE_VEC const *const vec3 )
+{
+    const double *c = cap->x;
+    const double *v = vec3->x;
+    double cd = 1.0 - c[0] * v[0] - c[1] * v[1] - c[2] * v[2];
+    double t = cap->m < 0.0 ? cd - fabs( cap->m ) : cap->m - cd;      /* > 0 inside */
+
+    if( fabs( t ) <= MPLY_BATCH_CAP_TOL )
+        return MPLY_NEAR;
+    return t > 0.0;
+}
+
+/* mply_within_index() for a fast unit vector.  It stops at the first cap it
+ * cannot decide. */
+INLINE MANGLE_INT
+mply_within_index_fast( MANGLE_PLY const *const ply, const MANGLE_INT index,
+                        MANGLE_VEC const *const vec3 )
+{
+    MANGLE_HOT const *const h = &( ply->hot[index] );
+    MANGLE_CAP const *c = &( ply->cap[h->icap] );
+    MANGLE_INT i, in;
+#ifdef MANGLE_FLOAT_CAPS
+    if( NULL != ply->capf ) {
+        /* MPLY_CAPF_EPS dwarfs the vector error: only the double test can
+         * be too close to call */
+        MANGLE_CAPF const *cf = &( ply->capf[h->icap] );
+        float vf[3];
+        mply_vecf_from_vec( vf, vec3 );
+        for( i = 0; i < h->ncap; i++ ) {
+            float d = cf[i].x[0] * vf[0] + cf[i].x[1] * vf[1] + cf[i].x[2] * vf[2] + cf[i].k;
+            if( d > MPLY_CAPF_EPS )
+                continue;
+            if( d < -MPLY_CAPF_EPS )
+                return FALSE;
+            in = mply_within_cap_fast( &c[i], vec3 );
+            if( TRUE != in )
+                return in;
+        }
+        return TRUE;
+    }
+#endif
+    for( i = 0; i < h->ncap; i++ ) {
+        in = mply_within_cap_fast( &c[i], vec3 );
+        if( TRUE != in )
+            return in;
+    }
+    return TRUE;
+}
+
+/* mply_find_polyindex_in_pix() / _vec() for a fast unit vector: the INDEX,
+ * -1, or MPLY_NEAR */
+static MANGLE_INT
+mply_find_polyindex_in_pix_fast( MANGLE_PLY const *const ply, const MANGLE_INT ipix,
+                                 MANGLE_VEC const *const vec3 )
+{
+    MANGLE_INT index, in;
+    DATA_LIST const *dl = &( ply->pix[ipix] );
+
+    while( dl != NULL && dl->data != NULL ) {
+        index = ( MANGLE_INT ) ( ( MANGLE_POLY const * ) dl->data - ply->poly );
+        dl = ( DATA_LIST const * ) dl->next;
+        in = mply_within_index_fast( ply, index, vec3 );
+        if( TRUE == in )
+            return index;
+        if( MPLY_NEAR == in )
+            return MPLY_NEAR;
+    }
+
+    return -1;
+}
+
+static MANGLE_INT
+mply_find_polyindex_vec_fast( MANGLE_PLY const *const ply, MANGLE_VEC const *const vec3 )
+{
+    MANGLE_INT index, in;
+
+    for( index = 0; index < ply->npoly; index++ ) {
+        in = mply_within_index_fast( ply, index, vec3 );
+        if( TRUE == in )
+            return index;
+        if( MPLY_NEAR == in )
+            return MPLY_NEAR;
+    }
+
+    return -1;
+}
+
+void
+mply_find_polyindex_polar_batch( MANGLE_PLY const *const ply, const size_t n,
+                                 double const *const az, double const *const el,
+                                 MANGLE_INT * const index )
+{
+    size_t i, j, nb;
+    double s_el[MANGLE_BATCH], c_el[MANGLE_BATCH];
+    double s_az[MANGLE_BATCH], c_az[MANGLE_BATCH];
+
+    for( i = 0; i < n; i += nb ) {
+        nb = n - i < MANGLE_BATCH ? n - i : MANGLE_BATCH;
+
+        mply_sincos_batch( nb, &el[i], s_el, c_el );
+        mply_sincos_batch( nb, &az[i], s_az, c_az );
+
+        for( j = 0; j < nb; j++ ) {
+            MANGLE_VEC vec3;
+
+            vec3.x[0] = c_el[j] * c_az[j];
+            vec3.x[1] = c_el[j] * s_az[j];
+            vec3.x[2] = s_el[j];
+
+            if( ply->pix_res > 0 ) {
+                MANGLE_INT ipix;
+                double sin_el = s_el[j];
+                if( !mply_pix_sin_is_safe( ply, sin_el ) )
+                    sin_el = sin( el[i + j] );
+                ipix = mply_pix_which_index_sin( ply, az[i + j], sin_el );
+                index[i + j] = mply_find_polyindex_in_pix_fast( ply, ipix, &vec3 );
+            } else {
+                index[i + j] = mply_find_polyindex_vec_fast( ply, &vec3 );
+            }
+            if( MPLY_NEAR == index[i + j] )
+                index[i + j] = mply_find_polyindex_polar( ply, az[i + j], el[i + j] );
+        }
+    }
+}
+
+void
+mply_find_polyindex_radec_batch( MANGLE_PLY const *const ply, const size_t n,
+                                 double const *const ra, double const *const dec,
+                                 MANGLE_INT * const index )
+{
+    size_t i, j, nb;
+    double az[MANGLE_BATCH], el[MANGLE_BATCH];
+
+    for( i = 0; i < n; i += nb ) {
+        nb = n - i < MANGLE_BATCH ? n - i : MANGLE_BATCH;
+        for( j = 0; j < nb; j++ ) {
+            az[j] = ra[i + j] * DEG2RAD;
+            el[j] = dec[i + j] * DEG2RAD;
+        }
+        mply_find_polyindex_polar_batch( ply, nb, az, el, &index[i] );
+    }
+}
+
+void
+mply_find_polyindex_xyz_batch( MANGLE_PLY const *const ply, const size_t n,
+                               MANGLE_VEC const *const vec3, MANGLE_INT * const index )
+{
+    size_t i;
+
+    for( i = 0; i < n; i++ ) {
+        index[i] = mply_find_polyindex_xyz( ply, &vec3[i] );
+    }
+}
+
 MANGLE_POLY *
 mply_poly_from_index( MANGLE_PLY const *const ply, const MANGLE_INT index )
 {
@@ -644,6 +1241,34 @@ mply_area_from_index( MANGLE_PLY const *const ply, const MANGLE_INT index )
     return p->area;
 }
 
+/* batch versions of the three above, for n INDEX values from a batch lookup */
+void
+mply_polyid_from_index_batch( MANGLE_PLY const *const ply, const size_t n,
+                              MANGLE_INT const *const index, MANGLE_INT * const polyid )
+{
+    size_t i;
+    for( i = 0; i < n; i++ )
+        polyid[i] = mply_polyid_from_index( ply, index[i] );
+}
+
+void
+mply_weight_from_index_batch( MANGLE_PLY const *const ply, const size_t n,
+                              MANGLE_INT const *const index, double *const weight )
+{
+    size_t i;
+    for( i = 0; i < n; i++ )
+        weight[i] = mply_weight_from_index( ply, index[i] );
+}
+
+void
+mply_area_from_index_batch( MANGLE_PLY const *const ply, const size_t n,
+                            MANGLE_INT const *const index, double *const area )
+{
+    size_t i;
+    for( i = 0; i < n; i++ )
+        area[i] = mply_area_from_index( ply, index[i] );
+}
+
 INLINE double
 mply_area_total( MANGLE_PLY const *const ply, const double min_weight )
 {
@@ -673,7 +1298,7 @@ mply_area_weighted_total( MANGLE_PLY const *const ply, const double min_weight )
 INLINE MANGLE_INT
 mply_find_polyid( MANGLE_PLY const *const ply, MANGLE_VEC const *const vec3 )
 {
-    MANGLE_INT index = mply_find_polyindex_vec( ply, vec3 );
+    MANGLE_INT index = mply_find_polyindex_xyz( ply, vec3 );
 
     if( index < 0 )
         return -1;
@@ -0,0 +1,608 @@
+/* optional header-only C++ interface to minimal_mangle.c
+ *
+ * mply::Mask wraps a MANGLE_PLY, either owning it (read from a file, freed
+ * with mply_kill()) or viewing one the caller keeps.  It is a template on
+ * three policies, each a plain tag type:
+ *
+ *   Real    double   exact, same answers as the C lookups
+ *           float    float copy of the caps; points near a cap edge are
+ *                    re-tested in double (as with MANGLE_FLOAT_CAPS), so
+ *                    the answers do not change
+ *   Layout  mply::aos   caps as {x, y, z, m} records (the C layout; with
+ *                       double this is a view of ply->cap, not a copy)
+ *           mply::soa   one array per component
+ *   Index   mply::pixel_lists  the C pixel lists (ply->pix)
+ *           mply::pixel_flat   the same lists copied into one flat array
+ *           mply::scan         test every polygon, in INDEX order
+ *
+ * e.g. mply::Mask< float, mply::soa, mply::pixel_flat >.  Everything is
+ * resolved at compile time: the cap test and the candidate walk are inlined
+ * into each query loop, with no virtual calls.  The pixel backends fall
+ * back to a scan for a mask without pixels.
+ *
+ * Batch queries take spans (anything with data() and size(), or a pointer
+ * and a count) of ra/dec in degrees or of MANGLE_VEC, and give the INDEX
+ * of each point, or -1.  The ra/dec batch uses the same fast sin/cos as
+ * mply_find_polyindex_radec_batch(), with the same libm re-test near cap
+ * edges, so it and find() on one point both match
+ * mply_find_polyindex_radec().  lookups() iterates over the results
+ * for a catalog, computing them a batch at a time.
+ *
+ * Copies (float or soa caps, flat index) are made when the Mask is built:
+ * call rebuild() after changing a viewed MANGLE_PLY.  Errors are handled
+ * the C way (message and exit), not with exceptions.  The C functions are
+ * unchanged, and are compiled into the C++ code like any other include.
+ */
+#pragma once
+#ifndef MINIMAL_MANGLE_HPP_INCLUDED
+#define MINIMAL_MANGLE_HPP_INCLUDED
+
+#include <cstddef>
+#include <vector>
+
+#include <minimal_mangle.c>
+
+namespace mply {
+
+/* cap layouts */
+struct aos {
+};
+struct soa {
+};
+
+/* index backends */
+struct pixel_lists {
+};
+struct pixel_flat {
+};
+struct scan {
+};
+
+/* a minimal pointer + count view (std::span converts to it) */
+template < class T > class span {
+  public:
+    span(  ):p_( NULL ), n_( 0 ) {
+    }
+    span( T * p, size_t n ):p_( p ), n_( n ) {
+    }
+    template < size_t N > span( T( &a )[N] ):p_( a ), n_( N ) {
+    }
+    template < class C > span( C & c ):p_( c.data(  ) ), n_( c.size(  ) ) {
+    }
+    template < class C > span( C const &c ):p_( c.data(  ) ), n_( c.size(  ) ) {
+    }
+
+    T *data(  ) const {
+        return p_;
+    }
+    size_t size(  ) const {
+        return n_;
+    }
+    T & operator[] ( size_t i ) const {
+        return p_[i];
+    }
+    T *begin(  ) const {
+        return p_;
+    }
+    T *end(  ) const {
+        return p_ + n_;
+    }
+
+  private:
+    T * p_;
+    size_t n_;
+};
+
+namespace detail {
+
+/* a query point: the double vector, and a float copy for the float caps.
+ * A fast (batch sin/cos) vector sets near when a double cap test is too
+ * close to call, and the point is then looked up again with libm. */
+struct point {
+    MANGLE_VEC vec;
+    float vf[3];
+    bool fast;
+    mutable bool near;
+
+    point(  ):fast( false ), near( false ) {
+    }
+};
+
+/* the double cap test, from cd = 1 - c.v (as mply_within_cap_fast()) */
+INLINE bool
+cap_in( double cd, double m, point const &p )
+{
+    double t = m < 0.0 ? cd - fabs( m ) : m - cd;       /* > 0 inside */
+
+    if( p.fast && fabs( t ) <= MPLY_BATCH_CAP_TOL )
+        p.near = true;
+    return t > 0.0;
+}
+
+INLINE bool
+cap_in( MANGLE_CAP const *const c, point const &p )
+{
+    double const *v = p.vec.x;
+    return cap_in( 1.0 - c->x[0] * v[0] - c->x[1] * v[1] - c->x[2] * v[2], c->m, p );
+}
+
+INLINE void
+check_sizes( size_t n0, size_t n1, char const *const what )
+{
+    if( n0 != n1 ) {
+        fprintf( stderr, "MANGLE Error: %s sizes differ: %zu and %zu\n", what, n0, n1 );
+        exit( EXIT_FAILURE );
+    }
+}
+
+/* caps< Real, Layout >::in( k, p ) tests point p against cap k of the
+ * MANGLE_PLY cap array */
+template < class Real, class Layout > class caps;
+
+/* the C layout: a view, with the C test */
+template <> class caps < double, aos > {
+  public:
+    static const bool need_vf = false;
+
+    void build( MANGLE_PLY const *const ply ) {
+        c_ = ply->cap;
+    }
+    bool in( MANGLE_INT k, point const &p ) const {
+        return cap_in( &c_[k], p );
+    }
+
+  private:
+    MANGLE_CAP const *c_;
+};
+
+/* the C test on one array per component (same arithmetic, same answers) */
+template <> class caps < double, soa > {
+  public:
+    static const bool need_vf = false;
+
+    void build( MANGLE_PLY const *const ply ) {
+        MANGLE_INT k;
+        x_.resize( ply->ncap );
+        y_.resize( ply->ncap );
+        z_.resize( ply->ncap );
+        m_.resize( ply->ncap );
+        for( k = 0; k < ply->ncap; k++ ) {
+            x_[k] = ply->cap[k].x[0];
+            y_[k] = ply->cap[k].x[1];
+            z_[k] = ply->cap[k].x[2];
+            m_[k] = ply->cap[k].m;
+        }
+    }
+    bool in( MANGLE_INT k, point const &p ) const {
+        double const *v = p.vec.x;
+        return cap_in( 1.0 - x_[k] * v[0] - y_[k] * v[1] - z_[k] * v[2], m_[k], p );
+    }
+
+  private:
+    std::vector < double >x_, y_, z_, m_;
+};
+
+/* Float caps in the MANGLE_CAPF form: x = s c and k = m - s (s = +1 for
+ * m >= 0, -1 for m < 0), so the point is inside when x.v + k > 0.  Within
+ * MPLY_CAPF_EPS of 0 the double cap decides. */
+#define MPLY_HPP_CAPF_EPS 4.0e-6f
+
+INLINE bool
+capf_in( float d, MANGLE_CAP const *const c, point const &p )
+{
+    if( d > MPLY_HPP_CAPF_EPS )
+        return true;
+    if( d < -MPLY_HPP_CAPF_EPS )
+        return false;
+    return cap_in( c, p );
+}
+
+template <> class caps < float, aos > {
+  public:
+    static const bool need_vf = true;
+
+    void build( MANGLE_PLY const *const ply ) {
+        MANGLE_INT k;
+        c_ = ply->cap;
+        f_.resize( ply->ncap );
+        for( k = 0; k < ply->ncap; k++ ) {
+            double s = ply->cap[k].m < 0.0 ? -1.0 : 1.0;
+            f_[k].x[0] = ( float ) ( s * ply->cap[k].x[0] );
+            f_[k].x[1] = ( float ) ( s * ply->cap[k].x[1] );
+            f_[k].x[2] = ( float ) ( s * ply->cap[k].x[2] );
+            f_[k].k = ( float ) ( ply->cap[k].m - s );
+        }
+    }
+    bool in( MANGLE_INT k, point const &p ) const {
+        float const *v = p.vf;
+        float d = f_[k].x[0] * v[0] + f_[k].x[1] * v[1] + f_[k].x[2] * v[2] + f_[k].k;
+        return capf_in( d, &c_[k], p );
+    }
+
+  private:
+    struct capf {
+        float x[3];
+        float k;
+    };
+    MANGLE_CAP const *c_;
+    std::vector < capf > f_;
+};
+
+template <> class caps < float, soa > {
+  public:
+    static const bool need_vf = true;
+
+    void build( MANGLE_PLY const *const ply ) {
+        MANGLE_INT k;
+        c_ = ply->cap;
+        x_.resize( ply->ncap );
+        y_.resize( ply->ncap );
+        z_.resize( ply->ncap );
+        k_.resize( ply->ncap );
+        for( k = 0; k < ply->ncap; k++ ) {
+            double s = ply->cap[k].m < 0.0 ? -1.0 : 1.0;
+            x_[k] = ( float ) ( s * ply->cap[k].x[0] );
+            y_[k] = ( float ) ( s * ply->cap[k].x[1] );
+            z_[k] = ( float ) ( s * ply->cap[k].x[2] );
+            k_[k] = ( float ) ( ply->cap[k].m - s );
+        }
+    }
+    bool in( MANGLE_INT k, point const &p ) const {
+        float const *v = p.vf;
+        float d = x_[k] * v[0] + y_[k] * v[1] + z_[k] * v[2] + k_[k];
+        return capf_in( d, &c_[k], p );
+    }
+
+  private:
+    MANGLE_CAP const *c_;
+    std::vector < float >x_, y_, z_, k_;
+};
+
+/* index< Index >::find( ply, ipix, test ) gives the first candidate INDEX
+ * for which test( INDEX ) holds, or -1.  pixels( ply ) says whether ipix
+ * is needed (otherwise it is ignored). */
+template < class Index > class index;
+
+template < class Test > MANGLE_INT
+scan_find( MANGLE_PLY const *const ply, Test const &test )
+{
+    MANGLE_INT i;
+    for( i = 0; i < ply->npoly; i++ ) {
+        if( test( i ) )
+            return i;
+    }
+    return -1;
+}
+
+template <> class index < scan > {
+  public:
+    void build( MANGLE_PLY const *const ) {
+    }
+    bool pixels( MANGLE_PLY const *const ) const {
+        return false;
+    }
+    template < class Test > MANGLE_INT find( MANGLE_PLY const *const ply, MANGLE_INT,
+                                             Test const &test ) const {
+        return scan_find( ply, test );
+    }
+};
+
+template <> class index < pixel_lists > {
+  public:
+    void build( MANGLE_PLY const *const ) {
+    }
+    bool pixels( MANGLE_PLY const *const ply ) const {
+        return ply->pix_res > 0;
+    }
+    template < class Test > MANGLE_INT find( MANGLE_PLY const *const ply, MANGLE_INT ipix,
+                                             Test const &test ) const {
+        DATA_LIST const *dl;
+
+        if( ply->pix_res <= 0 )
+            return scan_find( ply, test );
+
+        /* as in mply_find_polyindex_in_pix() */
+        for( dl = &ply->pix[ipix]; dl != NULL && dl->data != NULL;
+             dl = ( DATA_LIST const * ) dl->next ) {
+            MANGLE_INT i = ( MANGLE_INT ) ( ( MANGLE_POLY const * ) dl->data - ply->poly );
+            if( test( i ) )
+                return i;
+        }
+        return -1;
+    }
+};
+
+/* the pixel lists as one array of INDEX values, in list order, with
+ * offsets per pixel: no pointer chasing */
+template <> class index < pixel_flat > {
+  public:
+    void build( MANGLE_PLY const *const ply ) {
+        size_t ipix, npix;
+
+        offset_.clear(  );
+        poly_.clear(  );
+        if( ply->pix_res <= 0 )
+            return;
+
+        npix = mply_pix_count( ply->pix_res );
+        offset_.resize( npix + 1 );
+        for( ipix = 0; ipix < npix; ipix++ ) {
+            DATA_LIST const *dl;
+            offset_[ipix] = poly_.size(  );
+            for( dl = &ply->pix[ipix]; dl != NULL && dl->data != NULL;
+                 dl = ( DATA_LIST const * ) dl->next )
+                poly_.push_back( ( MANGLE_INT ) ( ( MANGLE_POLY const * ) dl->data - ply->poly ) );
+        }
+        offset_[npix] = poly_.size(  );
+    }
+    bool pixels( MANGLE_PLY const *const ply ) const {
+        return ply->pix_res > 0;
+    }
+    template < class Test > MANGLE_INT find( MANGLE_PLY const *const ply, MANGLE_INT ipix,
+                                             Test const &test ) const {
+        size_t j;
+
+        if( ply->pix_res <= 0 )
+            return scan_find( ply, test );
+
+        for( j = offset_[ipix]; j < offset_[ipix + 1]; j++ ) {
+            if( test( poly_[j] ) )
+                return poly_[j];
+        }
+        return -1;
+    }
+
+  private:
+    std::vector < size_t > offset_;
+    std::vector < MANGLE_INT > poly_;
+};
+
+/* is the point in polygon INDEX i? */
+template < class Caps > class poly_test {
+  public:
+    poly_test( Caps const &c, MANGLE_HOT const *const hot, point const &p )
+    :c_( c ), hot_( hot ), p_( p ) {
+    }
+    bool operator(  ) ( MANGLE_INT i ) const {
+        MANGLE_INT k, k1 = hot_[i].icap + hot_[i].ncap;
+        for( k = hot_[i].icap; k < k1; k++ ) {
+            if( !c_.in( k, p_ ) )
+                return false;
+        }
+        return true;
+    }
+
+  private:
+    Caps const &c_;
+    MANGLE_HOT const *hot_;
+    point const &p_;
+};
+
+}                               /* namespace detail */
+
+template < class Real = double, class Layout = aos, class Index = pixel_lists > class Mask;
+
+/* results of a ra/dec batch lookup, one INDEX per point, computed a batch
+ * (MANGLE_BATCH points) at a time as they are iterated over */
+template < class M > class lookup_range {
+  public:
+    class iterator {
+      public:
+        iterator( lookup_range * r, size_t i ):r_( r ), i_( i ) {
+        }
+        MANGLE_INT operator*(  ) const {
+            return r_->at( i_ );
+        }
+        iterator & operator++(  ) {
+            i_ += 1;
+            return *this;
+        }
+        bool operator==( iterator const &o ) const {
+            return i_ == o.i_;
+        }
+        bool operator!=( iterator const &o ) const {
+            return i_ != o.i_;
+        }
+
+      private:
+        lookup_range * r_;
+        size_t i_;
+    };
+
+    lookup_range( M const &m, span < const double >ra, span < const double >dec )
+    :m_( m ), ra_( ra ), dec_( dec ), i0_( 0 ), nb_( 0 ) {
+        detail::check_sizes( ra.size(  ), dec.size(  ), "ra and dec" );
+    }
+    iterator begin(  ) {
+        return iterator( this, 0 );
+    }
+    iterator end(  ) {
+        return iterator( this, ra_.size(  ) );
+    }
+    size_t size(  ) const {
+        return ra_.size(  );
+    }
+
+  private:
+    MANGLE_INT at( size_t i ) {
+        if( i < i0_ || i >= i0_ + nb_ ) {
+            i0_ = i - i % MANGLE_BATCH;
+            nb_ = ra_.size(  ) - i0_ < MANGLE_BATCH ? ra_.size(  ) - i0_ : MANGLE_BATCH;
+            m_.find( span < const double >( ra_.data(  ) + i0_, nb_ ),
+                     span < const double >( dec_.data(  ) + i0_, nb_ ),
+                     span < MANGLE_INT > ( buf_, nb_ ) );
+        }
+        return buf_[i - i0_];
+    }
+
+    M const &m_;
+    span < const double >ra_, dec_;
+    size_t i0_, nb_;
+    MANGLE_INT buf_[MANGLE_BATCH];
+};
+
+template < class Real, class Layout, class Index > class Mask {
+  public:
+    typedef detail::caps < Real, Layout > caps_type;
+    typedef detail::index < Index > index_type;
+
+    /* read (and own) a polygon file */
+    explicit Mask( char const *const filename )
+    :ply_( mply_read_file( filename ) ), own_( true ) {
+        rebuild(  );
+    }
+
+    /* use ply; with own = true it is freed with the Mask */
+    explicit Mask( MANGLE_PLY * ply, bool own = false )
+    :ply_( ply ), own_( own ) {
+        rebuild(  );
+    }
+
+    ~Mask(  ) {
+        if( own_ )
+            ply_ = mply_kill( ply_ );
+    }
+
+    /* the float / soa caps and flat index copy the MANGLE_PLY: refresh them
+     * after changing it */
+    void rebuild(  ) {
+        caps_.build( ply_ );
+        index_.build( ply_ );
+    }
+
+    MANGLE_PLY *ply(  ) const {
+        return ply_;
+    }
+    MANGLE_INT size(  ) const {
+        return ply_->npoly;
+    }
+
+    MANGLE_INT polyid( MANGLE_INT index ) const {
+        return mply_polyid_from_index( ply_, index );
+    }
+    double weight( MANGLE_INT index ) const {
+        return mply_weight_from_index( ply_, index );
+    }
+    double area( MANGLE_INT index ) const {
+        return mply_area_from_index( ply_, index );
+    }
+
+    /* one point, ra / dec in degrees: same as mply_find_polyindex_radec() */
+    MANGLE_INT find( double ra, double dec ) const {
+        double az = ra * DEG2RAD, el = dec * DEG2RAD;
+        detail::point p;
+        MANGLE_INT ipix = 0;
+
+        mply_vec_from_polar( &p.vec, az, el );
+        if( index_.pixels( ply_ ) )
+            ipix = mply_pix_which_index( ply_, az, el );
+        return find_point( p, ipix );
+    }
+
+    /* one unit vector: same as mply_find_polyindex_xyz() */
+    MANGLE_INT find( MANGLE_VEC const &vec3 ) const {
+        detail::point p;
+        MANGLE_INT ipix = 0;
+
+        p.vec = vec3;
+        if( index_.pixels( ply_ ) )
+            ipix = mply_pix_which_index_vec( ply_, &vec3 );
+        return find_point( p, ipix );
+    }
+
+    /* INDEX (or -1) of each point: same as mply_find_polyindex_radec_batch() */
+    void find( span < const double >ra, span < const double >dec,
+               span < MANGLE_INT > index ) const {
+        double az[MANGLE_BATCH], el[MANGLE_BATCH];
+        double s_el[MANGLE_BATCH], c_el[MANGLE_BATCH];
+        double s_az[MANGLE_BATCH], c_az[MANGLE_BATCH];
+        size_t i, j, nb, n = ra.size(  );
+
+        detail::check_sizes( n, dec.size(  ), "ra and dec" );
+        detail::check_sizes( n, index.size(  ), "ra and index" );
+
+        for( i = 0; i < n; i += nb ) {
+            nb = n - i < MANGLE_BATCH ? n - i : MANGLE_BATCH;
+            for( j = 0; j < nb; j++ ) {
+                az[j] = ra[i + j] * DEG2RAD;
+                el[j] = dec[i + j] * DEG2RAD;
+            }
+            mply_sincos_batch( nb, el, s_el, c_el );
+            mply_sincos_batch( nb, az, s_az, c_az );
+
+            for( j = 0; j < nb; j++ ) {
+                detail::point p;
+                MANGLE_INT ipix = 0;
+
+                p.vec.x[0] = c_el[j] * c_az[j];
+                p.vec.x[1] = c_el[j] * s_az[j];
+                p.vec.x[2] = s_el[j];
+                p.fast = true;
+                if( index_.pixels( ply_ ) ) {
+                    double sin_el = s_el[j];
+                    if( !mply_pix_sin_is_safe( ply_, sin_el ) )
+                        sin_el = sin( el[j] );
+                    ipix = mply_pix_which_index_sin( ply_, az[j], sin_el );
+                }
+                index[i + j] = find_point( p, ipix );
+                if( p.near ) {
+                    mply_vec_from_polar( &p.vec, az[j], el[j] );
+                    p.fast = false;
+                    index[i + j] = find_point( p, ipix );
+                }
+            }
+        }
+    }
+
+    void find( span < const MANGLE_VEC > xyz, span < MANGLE_INT > index ) const {
+        size_t i;
+
+        detail::check_sizes( xyz.size(  ), index.size(  ), "xyz and index" );
+        for( i = 0; i < xyz.size(  ); i++ )
+            index[i] = find( xyz[i] );
+    }
+
+    /* weight of each point (0 outside the mask) */
+    void weights( span < const double >ra, span < const double >dec,
+                  span < double >weight ) const {
+        MANGLE_INT buf[MANGLE_BATCH];
+        size_t i, j, nb, n = ra.size(  );
+
+        detail::check_sizes( n, weight.size(  ), "ra and weight" );
+        for( i = 0; i < n; i += nb ) {
+            nb = n - i < MANGLE_BATCH ? n - i : MANGLE_BATCH;
+            find( span < const double >( ra.data(  ) + i, nb ),
+                  span < const double >( dec.data(  ) + i, nb ), span < MANGLE_INT > ( buf, nb ) );
+            for( j = 0; j < nb; j++ )
+                weight[i + j] = mply_weight_from_index( ply_, buf[j] );
+        }
+    }
+
+    /* for( MANGLE_INT index : mask.lookups( ra, dec ) ) ... */
+    lookup_range < Mask > lookups( span < const double >ra, span < const double >dec ) const {
+        return lookup_range < Mask > ( *this, ra, dec );
+    }
+
+  private:
+    Mask( Mask const & );
+    Mask & operator=( Mask const & );
+
+    MANGLE_INT find_point( detail::point & p, MANGLE_INT ipix ) const {
+        if( caps_type::need_vf ) {
+            p.vf[0] = ( float ) p.vec.x[0];
+            p.vf[1] = ( float ) p.vec.x[1];
+            p.vf[2] = ( float ) p.vec.x[2];
+        }
+        return index_.find( ply_, ipix,
+                            detail::poly_test < caps_type > ( caps_, ply_->hot, p ) );
+    }
+
+    MANGLE_PLY *ply_;
+    bool own_;
+    caps_type caps_;
+    index_type index_;
+};
+
+}                               /* namespace mply */
+
+#endif
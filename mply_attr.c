@@ -0,0 +1,447 @@
+/* per-polygon attribute columns from a binary sidecar file
+ *
+ * Survey properties per polygon (depth, seeing, extinction, ...) usually
+ * live in a separate table keyed by polyid, and get joined to the lookup
+ * output afterwards.  mply_attr_write() turns such a table into a sidecar
+ * (FILE.attr by convention) with one double per polygon for each column,
+ * in polygon file order, so a column is indexed directly by INDEX:
+ *
+ *   header | ncol names | polyid[npoly] | column 0[npoly] | column 1[npoly] ...
+ *
+ * mply_attr_open() maps the sidecar read-only and checks it against the
+ * loaded mask (the polyid column must match polygon for polygon, so it
+ * only fits masks loaded whole, in file order).  mply_attr_column() gives
+ * a column in place.  For lookups, mply_attr_select() packs the chosen
+ * columns side by side, one row per polygon, so a match costs one cache
+ * line of attributes rather than one per column.  The names "weight" and
+ * "area" select those values from the mask itself.
+ *
+ * The table is text: a header line "# polyid NAME NAME ..." and then one
+ * line per polyid.  Polygons missing from the table get NaN; so do points
+ * outside the mask (with 0 for weight and area, as mply_weight_from_index).
+ * The sidecar is in native byte order, like the pixel index.
+ */
+#pragma once
+#ifndef MPLY_ATTR_INCLUDED
+#define MPLY_ATTR_INCLUDED
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <minimal_mangle.c>
+
+#define MPLY_ATTR_MAGIC "MPLYATTR"
+#define MPLY_ATTR_VERSION 1
+#define MPLY_ATTR_NAME 32       /* bytes per column name, with the NUL */
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t ncol;
+    uint64_t npoly;
+} MANGLE_ATTR_HEAD;
+
+typedef struct {
+    void *map;
+    size_t map_len;
+    MANGLE_INT npoly;
+    int ncol;
+    char const *name;           /* ncol names of MPLY_ATTR_NAME bytes */
+    int64_t const *polyid;
+    double const *col;          /* column k is col[k * npoly .. (k + 1) * npoly) */
+    int nsel;                   /* selected columns, packed by mply_attr_select() */
+    double *row;                /* npoly + 1 rows of nsel: the last is for "no polygon" */
+} MANGLE_ATTR;
+
+/* the table sorted by polyid, to look up each polygon */
+typedef struct {
+    int64_t polyid;
+    size_t row;
+} MANGLE_ATTR_KEY;
+
+static int
+mply_attr_key_cmp( const void *a, const void *b )
+{
+    MANGLE_ATTR_KEY const *x = ( MANGLE_ATTR_KEY const * ) a;
+    MANGLE_ATTR_KEY const *y = ( MANGLE_ATTR_KEY const * ) b;
+    return ( x->polyid > y->polyid ) - ( x->polyid < y->polyid );
+}
+
+static int
+mply_attr_reserved( char const *const name )
+{
+    return strcmp( name, "weight" ) == 0 || strcmp( name, "area" ) == 0;
+}
+
+/* parse the "# polyid NAME ..." header into ncol names */
+static char *
+mply_attr_read_names( char *line, int *const ncol, simple_reader * const sr )
+{
+    char *names = NULL, *tok;
+    int n = 0, k;
+
+    tok = strtok( line + 1, " \t" );
+    if( NULL == tok || strcasecmp( tok, "polyid" ) != 0 ) {
+        fprintf( stderr, "MANGLE Error: table header should start with '# polyid': %s\n",
+                 sr_filename( sr ) );
+        exit( EXIT_FAILURE );
+    }
+    while( ( tok = strtok( NULL, " \t" ) ) != NULL ) {
+        if( strlen( tok ) >= MPLY_ATTR_NAME || mply_attr_reserved( tok ) ) {
+            fprintf( stderr, "MANGLE Error: bad column name '%s' in file: %s\n", tok,
+                     sr_filename( sr ) );
+            exit( EXIT_FAILURE );
+        }
+        for( k = 0; k < n; k++ ) {
+            if( strcmp( &names[k * MPLY_ATTR_NAME], tok ) == 0 ) {
+                fprintf( stderr, "MANGLE Error: repeated column '%s' in file: %s\n", tok,
+                         sr_filename( sr ) );
+                exit( EXIT_FAILURE );
+            }
+        }
+        names = ( char * ) check_realloc( names, ( n + 1 ) * MPLY_ATTR_NAME, sizeof( char ) );
+        memset( &names[n * MPLY_ATTR_NAME], 0, MPLY_ATTR_NAME );
+        strcpy( &names[n * MPLY_ATTR_NAME], tok );
+        n += 1;
+    }
+    if( 0 == n ) {
+        fprintf( stderr, "MANGLE Error: no attribute columns in file: %s\n", sr_filename( sr ) );
+        exit( EXIT_FAILURE );
+    }
+
+    *ncol = n;
+    return names;
+}
+
+/* Write the sidecar for ply from a polyid-keyed text table.  Returns the
+ * number of polygons that had no row in the table. */
+MANGLE_INT
+mply_attr_write( MANGLE_PLY const *const ply, char const *const table_filename,
+                 char const *const attr_filename )
+{
+    simple_reader *sr;
+    MANGLE_ATTR_HEAD head;
+    MANGLE_ATTR_KEY *key = NULL;
+    double *value = NULL, *out;
+    char *names = NULL;
+    size_t nrow = 0, nalloc = 0, r;
+    MANGLE_INT i, nmiss = 0;
+    int64_t *polyid;
+    int k, ncol = 0;
+    FILE *fp;
+
+    sr = sr_init( table_filename );
+    while( sr_readline( sr ) ) {
+        char *line = sr_line( sr ), *p, *e;
+
+        if( '#' == line[0] ) {
+            if( NULL == names )
+                names = mply_attr_read_names( line, &ncol, sr );
+            continue;
+        }
+        p = line + strspn( line, " \t" );
+        if( '\0' == *p )
+            continue;
+        if( NULL == names ) {
+            fprintf( stderr, "MANGLE Error: table needs a '# polyid NAME ...' header: %s\n",
+                     sr_filename( sr ) );
+            exit( EXIT_FAILURE );
+        }
+
+        if( nrow == nalloc ) {
+            nalloc = nalloc > 0 ? 2 * nalloc : 1024;
+            key = ( MANGLE_ATTR_KEY * ) check_realloc( key, nalloc, sizeof( MANGLE_ATTR_KEY ) );
+            value = ( double * ) check_realloc( value, nalloc * ncol, sizeof( double ) );
+        }
+        key[nrow].polyid = strtoll( p, &e, 10 );
+        key[nrow].row = nrow;
+        for( k = 0; k < ncol && e != p; k++ ) {
+            p = e;
+            value[nrow * ncol + k] = strtod( p, &e );
+        }
+        if( e == p ) {
+            fprintf( stderr, "MANGLE Error: expected polyid and %d values, line %zu in file: %s\n",
+                     ncol, sr_linenum( sr ), sr_filename( sr ) );
+            exit( EXIT_FAILURE );
+        }
+        nrow += 1;
+    }
+    if( NULL == names ) {
+        fprintf( stderr, "MANGLE Error: no table header in file: %s\n", sr_filename( sr ) );
+        exit( EXIT_FAILURE );
+    }
+
+    if( nrow > 0 )
+        qsort( key, nrow, sizeof( MANGLE_ATTR_KEY ), mply_attr_key_cmp );
+    for( r = 1; r < nrow; r++ ) {
+        if( key[r].polyid == key[r - 1].polyid ) {
+            fprintf( stderr, "MANGLE Error: repeated polyid %lld in file: %s\n",
+                     ( long long ) key[r].polyid, sr_filename( sr ) );
+            exit( EXIT_FAILURE );
+        }
+    }
+    sr = sr_kill( sr );
+
+    /* columns in polygon INDEX order */
+    polyid = ( int64_t * ) check_alloc( ply->npoly > 0 ? ply->npoly : 1, sizeof( int64_t ) );
+    out = ( double * ) check_alloc( ply->npoly > 0 ? ply->npoly * ncol : 1, sizeof( double ) );
+    for( i = 0; i < ply->npoly; i++ ) {
+        MANGLE_ATTR_KEY want, *found;
+
+        want.polyid = polyid[i] = ply->poly[i].polyid;
+        found = nrow > 0 ? ( MANGLE_ATTR_KEY * ) bsearch( &want, key, nrow,
+                                                            sizeof( MANGLE_ATTR_KEY ),
+                                                            mply_attr_key_cmp ) : NULL;
+        if( NULL == found )
+            nmiss += 1;
+        for( k = 0; k < ncol; k++ )
+            out[k * ply->npoly + i] = found ? value[found->row * ncol + k] : NAN;
+    }
+
+    memset( &head, 0, sizeof( MANGLE_ATTR_HEAD ) );
+    memcpy( head.magic, MPLY_ATTR_MAGIC, sizeof( head.magic ) );
+    head.version = MPLY_ATTR_VERSION;
+    head.ncol = ncol;
+    head.npoly = ply->npoly;
+
+    fp = check_fopen( attr_filename, "wb" );
+    if( fwrite( &head, sizeof( head ), 1, fp ) != 1 ||
+        fwrite( names, MPLY_ATTR_NAME, ncol, fp ) != ( size_t ) ncol ||
+        fwrite( polyid, sizeof( int64_t ), ply->npoly, fp ) != ( size_t ) ply->npoly ||
+        fwrite( out, sizeof( double ), ply->npoly * ncol, fp ) != ( size_t ) ply->npoly * ncol
+        || fclose( fp ) != 0 ) {
+        fprintf( stderr, "MANGLE Error: cannot write attribute file: %s\n", attr_filename );
+        exit( EXIT_FAILURE );
+    }
+
+    CHECK_FREE( key );
+    CHECK_FREE( value );
+    CHECK_FREE( names );
+    CHECK_FREE( polyid );
+    CHECK_FREE( out );
+
+    return nmiss;
+}
+
+/* map the sidecar and check that it belongs to ply */
+void
+mply_attr_open( MANGLE_ATTR * const attr, MANGLE_PLY const *const ply,
+                char const *const filename )
+{
+    MANGLE_ATTR_HEAD const *head;
+    struct stat st;
+    size_t need;
+    char const *base;
+    MANGLE_INT i;
+    int fd;
+
+    memset( attr, 0, sizeof( MANGLE_ATTR ) );
+    fd = open( filename, O_RDONLY );
+    if( fd < 0 || fstat( fd, &st ) != 0 ) {
+        fprintf( stderr, "MANGLE Error: cannot open attribute file: %s\n", filename );
+        exit( EXIT_FAILURE );
+    }
+    attr->map_len = ( size_t ) st.st_size;
+    if( attr->map_len >= sizeof( MANGLE_ATTR_HEAD ) )
+        attr->map = mmap( NULL, attr->map_len, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if( NULL == attr->map || MAP_FAILED == attr->map ) {
+        fprintf( stderr, "MANGLE Error: cannot map attribute file: %s\n", filename );
+        exit( EXIT_FAILURE );
+    }
+
+    base = ( char const * ) attr->map;
+    head = ( MANGLE_ATTR_HEAD const * ) base;
+    if( memcmp( head->magic, MPLY_ATTR_MAGIC, sizeof( head->magic ) ) != 0 ||
+        head->version != MPLY_ATTR_VERSION ) {
+        fprintf( stderr, "MANGLE Error: not a polygon attribute file: %s\n", filename );
+        exit( EXIT_FAILURE );
+    }
+    need = sizeof( MANGLE_ATTR_HEAD ) + ( size_t ) head->ncol * MPLY_ATTR_NAME
+        + ( size_t ) head->npoly * ( 1 + head->ncol ) * sizeof( double );
+    if( attr->map_len != need ) {
+        fprintf( stderr, "MANGLE Error: attribute file has the wrong size: %s\n", filename );
+        exit( EXIT_FAILURE );
+    }
+    if( head->npoly != ( uint64_t ) ply->npoly ) {
+        fprintf( stderr, "MANGLE Error: attribute file has %zu polygons, mask has %zd: %s\n",
+                 ( size_t ) head->npoly, ( ssize_t ) ply->npoly, filename );
+        exit( EXIT_FAILURE );
+    }
+
+    attr->npoly = ply->npoly;
+    attr->ncol = head->ncol;
+    attr->name = base + sizeof( MANGLE_ATTR_HEAD );
+    attr->polyid = ( int64_t const * ) ( attr->name + attr->ncol * MPLY_ATTR_NAME );
+    attr->col = ( double const * ) ( attr->polyid + attr->npoly );
+
+    for( i = 0; i < ply->npoly; i++ ) {
+        if( attr->polyid[i] != ply->poly[i].polyid ) {
+            fprintf( stderr,
+                     "MANGLE Error: attribute file does not match the mask at INDEX %zd: %s\n",
+                     ( ssize_t ) i, filename );
+            exit( EXIT_FAILURE );
+        }
+    }
+}
+
+void
+mply_attr_close( MANGLE_ATTR * const attr )
+{
+    if( NULL != attr->map )
+        munmap( attr->map, attr->map_len );
+    CHECK_FREE( attr->row );
+    memset( attr, 0, sizeof( MANGLE_ATTR ) );
+}
+
+/* column number of name, or -1 */
+int
+mply_attr_find( MANGLE_ATTR const *const attr, char const *const name )
+{
+    int k;
+    for( k = 0; k < attr->ncol; k++ ) {
+        if( strncmp( &attr->name[k * MPLY_ATTR_NAME], name, MPLY_ATTR_NAME ) == 0 )
+            return k;
+    }
+    return -1;
+}
+
+/* a column in place, indexed by INDEX (NULL if there is no such column) */
+double const *
+mply_attr_column( MANGLE_ATTR const *const attr, char const *const name )
+{
+    int k = mply_attr_find( attr, name );
+    return k < 0 ? NULL : &( attr->col[( size_t ) k * attr->npoly] );
+}
+
+/* Pack the columns named in the comma separated list (NULL or "" for all
+ * of them) for mply_attr_row().  Returns the number selected. */
+int
+mply_attr_select( MANGLE_ATTR * const attr, MANGLE_PLY const *const ply,
+                  char const *const list )
+{
+    char const *s;
+    int nsel, j;
+    size_t npoly = attr->npoly;
+    MANGLE_INT i;
+
+    CHECK_FREE( attr->row );
+    attr->nsel = 0;
+
+    if( NULL == list || '\0' == list[0] ) {
+        attr->nsel = attr->ncol;
+        attr->row = ( double * ) check_alloc( ( npoly + 1 ) * attr->ncol, sizeof( double ) );
+        for( j = 0; j < attr->ncol; j++ ) {
+            for( i = 0; i < attr->npoly; i++ )
+                attr->row[i * attr->ncol + j] = attr->col[j * npoly + i];
+            attr->row[npoly * attr->ncol + j] = NAN;
+        }
+        return attr->nsel;
+    }
+
+    for( s = list, nsel = 1; '\0' != *s; s++ )
+        nsel += ( ',' == *s );
+    attr->row = ( double * ) check_alloc( ( npoly + 1 ) * nsel, sizeof( double ) );
+    attr->nsel = nsel;
+
+    for( j = 0, s = list; j < nsel; j++ ) {
+        size_t len = strcspn( s, "," );
+        char name[MPLY_ATTR_NAME];
+        double *r = &( attr->row[j] );
+        int k = -1;
+
+        if( len >= MPLY_ATTR_NAME ) {
+            fprintf( stderr, "MANGLE Error: no attribute column '%.*s'\n", ( int ) len, s );
+            exit( EXIT_FAILURE );
+        }
+        memcpy( name, s, len );
+        name[len] = '\0';
+        s += len + ( ',' == s[len] );
+
+        if( strcmp( name, "weight" ) == 0 ) {
+            for( i = 0; i < attr->npoly; i++ )
+                r[i * nsel] = ply->poly[i].weight;
+            r[npoly * nsel] = 0.0;
+        } else if( strcmp( name, "area" ) == 0 ) {
+            for( i = 0; i < attr->npoly; i++ )
+                r[i * nsel] = ply->poly[i].area;
+            r[npoly * nsel] = 0.0;
+        } else if( ( k = mply_attr_find( attr, name ) ) >= 0 ) {
+            for( i = 0; i < attr->npoly; i++ )
+                r[i * nsel] = attr->col[k * npoly + i];
+            r[npoly * nsel] = NAN;
+        } else {
+            fprintf( stderr, "MANGLE Error: no attribute column '%s'\n", name );
+            exit( EXIT_FAILURE );
+        }
+    }
+
+    return nsel;
+}
+
+/* the nsel selected values for a lookup result (index -1 for no polygon) */
+INLINE double const *
+mply_attr_row( MANGLE_ATTR const *const attr, const MANGLE_INT index )
+{
+    size_t i = index < 0 ? ( size_t ) attr->npoly : ( size_t ) index;
+    return &( attr->row[i * attr->nsel] );
+}
+
+/* fill out[n * nsel] with the selected values for n lookup results */
+void
+mply_attr_from_index_batch( MANGLE_ATTR const *const attr, const size_t n,
+                            MANGLE_INT const *const index, double *const out )
+{
+    size_t i;
+    int j;
+
+    for( i = 0; i < n; i++ ) {
+        double const *r = mply_attr_row( attr, index[i] );
+        for( j = 0; j < attr->nsel; j++ )
+            out[i * attr->nsel + j] = r[j];
+    }
+}
+
+/* For the tools: "FILE" or "FILE:NAME,NAME,..." (e.g. from $MANGLE_ATTR).
+ * Returns FALSE (no attributes) for NULL or "". */
+int
+mply_attr_env( MANGLE_ATTR * const attr, MANGLE_PLY const *const ply, char const *const s )
+{
+    char const *colon;
+    char *filename;
+    size_t len;
+
+    memset( attr, 0, sizeof( MANGLE_ATTR ) );
+    if( NULL == s || '\0' == s[0] )
+        return FALSE;
+
+    colon = strrchr( s, ':' );
+    len = NULL != colon ? ( size_t ) ( colon - s ) : strlen( s );
+    filename = ( char * ) check_alloc( len + 1, sizeof( char ) );
+    memcpy( filename, s, len );
+
+    mply_attr_open( attr, ply, filename );
+    mply_attr_select( attr, ply, NULL != colon ? colon + 1 : NULL );
+
+    CHECK_FREE( filename );
+    return TRUE;
+}
+
+/* append the selected values for index, each after a space */
+static inline char *
+mply_attr_write_row( MANGLE_ATTR const *const attr, const MANGLE_INT index, char *p )
+{
+    double const *r = mply_attr_row( attr, index );
+    int j;
+    for( j = 0; j < attr->nsel; j++ )
+        p = mply_write_double( p, r[j] );
+    return p;
+}
+
+#endif
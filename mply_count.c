@@ -0,0 +1,182 @@
+/* per-polygon point occupancy counts
+ *
+ * Stream points through mply_count_radec_batch() and get the number of
+ * points (and sum of point weights) that land in each polygon.  Each thread
+ * fills its own histogram slot, so there is no locking on the hot path; the
+ * slots are summed by mply_count_merge() once the stream is finished.
+ *
+ * Threads are only used when compiled with OpenMP (e.g. gcc -fopenmp),
+ * otherwise everything runs in slot 0.
+ */
+#pragma once
+#ifndef MPLY_COUNT_INCLUDED
+#define MPLY_COUNT_INCLUDED
+
+#include <minimal_mangle.c>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+typedef struct {
+    MANGLE_INT npoly;
+    int nslot;                  /* number of per-thread histograms */
+    size_t stride;              /* npoly + 1: last bin counts points outside the mask */
+    size_t *count;              /* nslot x stride, slot 0 holds the merged result */
+    double *wcount;             /* same layout, sum of point weights */
+    size_t npix;
+    size_t *pix_count;          /* per-pixel sum of polygon counts, set by merge */
+} MANGLE_COUNT;
+
+void
+mply_count_alloc( MANGLE_COUNT * const cnt, MANGLE_PLY const *const ply )
+{
+    cnt->npoly = ply->npoly;
+    cnt->stride = ( size_t ) ply->npoly + 1;
+#ifdef _OPENMP
+    cnt->nslot = omp_get_max_threads(  );
+#else
+    cnt->nslot = 1;
+#endif
+    cnt->count = ( size_t * ) check_alloc( cnt->nslot * cnt->stride, sizeof( size_t ) );
+    cnt->wcount = ( double * ) check_alloc( cnt->nslot * cnt->stride, sizeof( double ) );
+    cnt->npix = mply_pix_count( ply->pix_res );
+    cnt->pix_count = NULL;
+    if( cnt->npix > 0 )
+        cnt->pix_count = ( size_t * ) check_alloc( cnt->npix, sizeof( size_t ) );
+}
+
+void
+mply_count_clean( MANGLE_COUNT * const cnt )
+{
+    CHECK_FREE( cnt->count );
+    CHECK_FREE( cnt->wcount );
+    CHECK_FREE( cnt->pix_count );
+    cnt->npoly = 0;
+    cnt->nslot = 0;
+    cnt->npix = 0;
+}
+
+MANGLE_COUNT *
+mply_count_init( MANGLE_PLY const *const ply )
+{
+    MANGLE_COUNT *cnt;
+    cnt = ( MANGLE_COUNT * ) check_alloc( 1, sizeof( MANGLE_COUNT ) );
+    mply_count_alloc( cnt, ply );
+    return cnt;
+}
+
+MANGLE_COUNT *
+mply_count_kill( MANGLE_COUNT * cnt )
+{
+    mply_count_clean( cnt );
+    CHECK_FREE( cnt );
+    return NULL;
+}
+
+/* add the INDEX results for n points to a histogram slot (weights may be NULL) */
+INLINE void
+mply_count_add_index( MANGLE_COUNT * const cnt, const int slot, const size_t n,
+                      MANGLE_INT const *const index, double const *const weight )
+{
+    size_t i, bin;
+    size_t *count = &( cnt->count[slot * cnt->stride] );
+    double *wcount = &( cnt->wcount[slot * cnt->stride] );
+
+    for( i = 0; i < n; i++ ) {
+        bin = index[i] < 0 ? ( size_t ) cnt->npoly : ( size_t ) index[i];
+        count[bin] += 1;
+        wcount[bin] += weight != NULL ? weight[i] : 1.0;
+    }
+}
+
+/* look up and count n points (weights may be NULL, meaning 1.0 each) */
+void
+mply_count_radec_batch( MANGLE_COUNT * const cnt, MANGLE_PLY const *const ply,
+                        const size_t n, double const *const ra, double const *const dec,
+                        double const *const weight )
+{
+    if( cnt->npoly != ply->npoly ) {
+        fprintf( stderr, "MANGLE Error: MANGLE_COUNT does not match MANGLE_PLY (%zd != %zd)\n",
+                 ( ssize_t ) cnt->npoly, ( ssize_t ) ply->npoly );
+        exit( EXIT_FAILURE );
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads( cnt->nslot )
+#endif
+    {
+        size_t i, nb;
+        int slot = 0;
+        MANGLE_INT index[MANGLE_BATCH];
+
+#ifdef _OPENMP
+        slot = omp_get_thread_num(  );
+#pragma omp for schedule( static )
+#endif
+        for( i = 0; i < n; i += MANGLE_BATCH ) {
+            nb = n - i < MANGLE_BATCH ? n - i : MANGLE_BATCH;
+            mply_find_polyindex_radec_batch( ply, nb, &ra[i], &dec[i], index );
+            mply_count_add_index( cnt, slot, nb, index, weight != NULL ? &weight[i] : NULL );
+        }
+    }
+}
+
+/* sum all slots into slot 0, and fill in the per-pixel counts */
+void
+mply_count_merge( MANGLE_COUNT * const cnt, MANGLE_PLY const *const ply )
+{
+    size_t i;
+    int s;
+
+    for( s = 1; s < cnt->nslot; s++ ) {
+        size_t *count = &( cnt->count[s * cnt->stride] );
+        double *wcount = &( cnt->wcount[s * cnt->stride] );
+        for( i = 0; i < cnt->stride; i++ ) {
+            cnt->count[i] += count[i];
+            cnt->wcount[i] += wcount[i];
+            count[i] = 0;
+            wcount[i] = 0.0;
+        }
+    }
+
+    if( cnt->npix > 0 ) {
+        MANGLE_INT ipoly;
+        for( i = 0; i < cnt->npix; i++ )
+            cnt->pix_count[i] = 0;
+        for( ipoly = 0; ipoly < ply->npoly; ipoly++ ) {
+            MANGLE_INT ipix = mply_pix_index_from_id( ply, ply->poly[ipoly].pixel );
+            cnt->pix_count[ipix] += cnt->count[ipoly];
+        }
+    }
+}
+
+/* these assume mply_count_merge() has been called */
+INLINE size_t
+mply_count_from_index( MANGLE_COUNT const *const cnt, const MANGLE_INT index )
+{
+    if( index < 0 )
+        return cnt->count[cnt->npoly];
+    return cnt->count[index];
+}
+
+INLINE double
+mply_count_weighted_from_index( MANGLE_COUNT const *const cnt, const MANGLE_INT index )
+{
+    if( index < 0 )
+        return cnt->wcount[cnt->npoly];
+    return cnt->wcount[index];
+}
+
+INLINE MANGLE_INT
+mply_count_nempty( MANGLE_COUNT const *const cnt )
+{
+    MANGLE_INT i, nempty = 0;
+    for( i = 0; i < cnt->npoly; i++ ) {
+        if( 0 == cnt->count[i] )
+            nempty += 1;
+    }
+    return nempty;
+}
+
+#endif
@@ -0,0 +1,298 @@
+/* fast double to shortest round-trip decimal text
+ *
+ * mply_dtoa() writes a short digit string that reads back (with strtod)
+ * to exactly the same double, several times faster than printf("%.17g").
+ * This is Grisu2 (F. Loitsch, "Printing Floating-Point Numbers Quickly and
+ * Accurately with Integers", PLDI 2010), laid out after Milo Yip's public
+ * domain implementation.  Grisu2 output always round-trips; in rare cases
+ * it is one digit longer than the shortest possible.
+ *
+ * The output looks like printf("%g") with enough digits: plain notation
+ * for values in [1e-5, 1e17), otherwise "d.ddde-XX".  Infinities and NaN
+ * are passed to snprintf().
+ */
+#pragma once
+#ifndef MPLY_DTOA_INCLUDED
+#define MPLY_DTOA_INCLUDED
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#define MPLY_DTOA_SIZE 32       /* enough for any output, with the NUL */
+
+typedef struct {
+    uint64_t f;
+    int e;
+} MPLY_DIYFP;
+
+/* normalized 10^k for k = -348, -340, ..., 340 */
+static const uint64_t mply_dtoa_pow10_f[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+
+static const int16_t mply_dtoa_pow10_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const uint32_t mply_dtoa_pow10_u32[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+#define MPLY_DP_HIDDEN ( ( uint64_t ) 1 << 52 )
+#define MPLY_DP_FRAC ( MPLY_DP_HIDDEN - 1 )
+
+static inline MPLY_DIYFP
+mply_diyfp( const uint64_t f, const int e )
+{
+    MPLY_DIYFP r;
+    r.f = f;
+    r.e = e;
+    return r;
+}
+
+/* 64 x 64 -> upper 64 bits, rounded */
+static inline MPLY_DIYFP
+mply_diyfp_mul( const MPLY_DIYFP x, const MPLY_DIYFP y )
+{
+    const uint64_t m32 = 0xFFFFFFFFu;
+    uint64_t a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = ( bd >> 32 ) + ( ad & m32 ) + ( bc & m32 );
+    tmp += ( uint64_t ) 1 << 31;
+    return mply_diyfp( ac + ( ad >> 32 ) + ( bc >> 32 ) + ( tmp >> 32 ), x.e + y.e + 64 );
+}
+
+static inline MPLY_DIYFP
+mply_diyfp_normalize( MPLY_DIYFP x )
+{
+    while( !( x.f & ( ( uint64_t ) 1 << 63 ) ) ) {
+        x.f <<= 1;
+        x.e -= 1;
+    }
+    return x;
+}
+
+static inline void
+mply_dtoa_round( char *const buf, const int len, const uint64_t delta, uint64_t rest,
+                 const uint64_t ten_kappa, const uint64_t wp_w )
+{
+    while( rest < wp_w && delta - rest >= ten_kappa &&
+           ( rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w ) ) {
+        buf[len - 1] -= 1;
+        rest += ten_kappa;
+    }
+}
+
+static inline int
+mply_dtoa_ndigit( const uint32_t n )
+{
+    int k = 1;
+    while( k < 10 && n >= mply_dtoa_pow10_u32[k] )
+        k += 1;
+    return k;
+}
+
+/* digits of w, which lies within delta below the upper boundary mp;
+ * adds to the decimal exponent K so that w ~ digits x 10^K */
+static void
+mply_dtoa_digits( const MPLY_DIYFP w, const MPLY_DIYFP mp, uint64_t delta, char *const buf,
+                  int *const len, int *const K )
+{
+    const MPLY_DIYFP one = mply_diyfp( ( uint64_t ) 1 << -mp.e, mp.e );
+    const uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = ( uint32_t ) ( mp.f >> -one.e );
+    uint64_t p2 = mp.f & ( one.f - 1 );
+    int kappa = mply_dtoa_ndigit( p1 );
+
+    *len = 0;
+    while( kappa > 0 ) {
+        uint32_t d = p1 / mply_dtoa_pow10_u32[kappa - 1];
+        uint64_t tmp;
+        p1 %= mply_dtoa_pow10_u32[kappa - 1];
+        if( d || *len )
+            buf[( *len )++] = ( char ) ( '0' + d );
+        kappa -= 1;
+        tmp = ( ( uint64_t ) p1 << -one.e ) + p2;
+        if( tmp <= delta ) {
+            *K += kappa;
+            mply_dtoa_round( buf, *len, delta, tmp,
+                             ( uint64_t ) mply_dtoa_pow10_u32[kappa] << -one.e, wp_w );
+            return;
+        }
+    }
+
+    for( ;; ) {
+        char d;
+        p2 *= 10;
+        delta *= 10;
+        d = ( char ) ( p2 >> -one.e );
+        if( d || *len )
+            buf[( *len )++] = ( char ) ( '0' + d );
+        p2 &= one.f - 1;
+        kappa -= 1;
+        if( p2 < delta ) {
+            *K += kappa;
+            mply_dtoa_round( buf, *len, delta, p2, one.f,
+                             -kappa < 10 ? wp_w * mply_dtoa_pow10_u32[-kappa] : 0 );
+            return;
+        }
+    }
+}
+
+/* digits of v > 0 (finite), with v = digits x 10^K */
+static void
+mply_dtoa_grisu2( const double v, char *const buf, int *const len, int *const K )
+{
+    uint64_t u, f;
+    int e, k, idx;
+    double dk;
+    MPLY_DIYFP w, wp, wm, c;
+
+    memcpy( &u, &v, sizeof( double ) );
+    e = ( int ) ( ( u >> 52 ) & 0x7FF );
+    f = u & MPLY_DP_FRAC;
+    if( e != 0 ) {
+        f += MPLY_DP_HIDDEN;
+        e -= 1075;
+    } else {
+        e = 1 - 1075;
+    }
+
+    /* boundaries: halfway to the neighbouring doubles */
+    wp = mply_diyfp( ( f << 1 ) + 1, e - 1 );
+    while( !( wp.f & ( MPLY_DP_HIDDEN << 1 ) ) ) {
+        wp.f <<= 1;
+        wp.e -= 1;
+    }
+    wp.f <<= 64 - 52 - 2;
+    wp.e -= 64 - 52 - 2;
+    if( f == MPLY_DP_HIDDEN )
+        wm = mply_diyfp( ( f << 2 ) - 1, e - 2 );
+    else
+        wm = mply_diyfp( ( f << 1 ) - 1, e - 1 );
+    wm.f <<= wm.e - wp.e;
+    wm.e = wp.e;
+
+    /* a cached power of ten that brings the binary exponent into [-60, -32] */
+    dk = ( -61 - wp.e ) * 0.30102999566398114 + 347;
+    k = ( int ) dk;
+    if( dk - k > 0.0 )
+        k += 1;
+    idx = ( k >> 3 ) + 1;
+    *K = -( -348 + idx * 8 );
+    c = mply_diyfp( mply_dtoa_pow10_f[idx], mply_dtoa_pow10_e[idx] );
+
+    w = mply_diyfp_mul( mply_diyfp_normalize( mply_diyfp( f, e ) ), c );
+    wp = mply_diyfp_mul( wp, c );
+    wm = mply_diyfp_mul( wm, c );
+    wm.f += 1;
+    wp.f -= 1;
+    mply_dtoa_digits( w, wp, wp.f - wm.f, buf, len, K );
+}
+
+/* Write v into buf (at least MPLY_DTOA_SIZE bytes), NUL terminated.
+ * Returns the length, not counting the NUL. */
+static int
+mply_dtoa( const double v, char *const buf )
+{
+    char digits[20];
+    char *p = buf;
+    int len, K, kk, i;
+
+    if( !isfinite( v ) )
+        return snprintf( buf, MPLY_DTOA_SIZE, "%g", v );
+    if( signbit( v ) )
+        *p++ = '-';
+    if( 0.0 == v ) {
+        *p++ = '0';
+        *p = '\0';
+        return ( int ) ( p - buf );
+    }
+
+    mply_dtoa_grisu2( fabs( v ), digits, &len, &K );
+    kk = len + K;               /* 10^(kk-1) <= |v| < 10^kk */
+
+    if( K >= 0 && kk <= 17 ) {
+        /* 1234e3 -> 1234000 */
+        memcpy( p, digits, len );
+        p += len;
+        for( i = 0; i < K; i++ )
+            *p++ = '0';
+    } else if( kk > 0 && kk <= 17 ) {
+        /* 1234e-2 -> 12.34 */
+        memcpy( p, digits, kk );
+        p += kk;
+        *p++ = '.';
+        memcpy( p, &digits[kk], len - kk );
+        p += len - kk;
+    } else if( kk > -5 && kk <= 0 ) {
+        /* 1234e-6 -> 0.001234 */
+        *p++ = '0';
+        *p++ = '.';
+        for( i = kk; i < 0; i++ )
+            *p++ = '0';
+        memcpy( p, digits, len );
+        p += len;
+    } else {
+        /* 1234e-30 -> 1.234e-27, with at least two exponent digits like printf */
+        int x = kk - 1;
+        *p++ = digits[0];
+        if( len > 1 ) {
+            *p++ = '.';
+            memcpy( p, &digits[1], len - 1 );
+            p += len - 1;
+        }
+        *p++ = 'e';
+        *p++ = x < 0 ? '-' : '+';
+        x = x < 0 ? -x : x;
+        if( x >= 100 ) {
+            *p++ = ( char ) ( '0' + x / 100 );
+            x %= 100;
+        }
+        *p++ = ( char ) ( '0' + x / 10 );
+        *p++ = ( char ) ( '0' + x % 10 );
+    }
+    *p = '\0';
+
+    return ( int ) ( p - buf );
+}
+
+#endif
@@ -0,0 +1,333 @@
+/* distance from a point to the edge of the mask around it
+ *
+ * The "edge" is the boundary of the region of equal weight that holds the
+ * point: edges shared between neighbouring polygons of the same weight are
+ * internal and do not count.  Points outside the mask get -1.
+ *
+ * Each polygon boundary is made of arcs of its cap circles.  The nearest
+ * point of an arc is either the nearest point of the whole circle (if that
+ * is on the polygon) or one of the arc endpoints, so it is found exactly.
+ * Whether an arc is internal is decided by looking just across it, at its
+ * nearest point, with the usual pixel lookup.  When it is internal, the
+ * polygon across is searched in turn, so the walk only visits neighbours
+ * whose shared edge is closer than the best edge found so far.
+ *
+ * Distances are angles in radians.  A search radius (max_dist) stops the
+ * walk early: the result is then min(distance, max_dist), which is all a
+ * buffered trim needs.
+ */
+#pragma once
+#ifndef MPLY_EDGE_INCLUDED
+#define MPLY_EDGE_INCLUDED
+
+#include <minimal_mangle.c>
+
+#define MPLY_EDGE_EPS 1.0e-12   /* slack for points on another cap circle */
+#define MPLY_EDGE_STEP 1.0e-8   /* how far across an edge to look (radians) */
+#define MPLY_EDGE_NSLIDE 24     /* slides along an arc, up to 2^23 steps */
+
+INLINE double
+mply_edge_dot( double const *const a, double const *const b )
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+INLINE void
+mply_edge_normalize( double *const a )
+{
+    double norm = sqrt( mply_edge_dot( a, a ) );
+    a[0] /= norm;
+    a[1] /= norm;
+    a[2] /= norm;
+}
+
+/* angle between two unit vectors, accurate at small separations */
+INLINE double
+mply_edge_angle( double const *const a, double const *const b )
+{
+    double c[3];
+    c[0] = a[1] * b[2] - a[2] * b[1];
+    c[1] = a[2] * b[0] - a[0] * b[2];
+    c[2] = a[0] * b[1] - a[1] * b[0];
+    return atan2( sqrt( mply_edge_dot( c, c ) ), mply_edge_dot( a, b ) );
+}
+
+/* within all caps but cap "skip", allowing points that sit on a circle */
+INLINE int
+mply_edge_on_arc( MANGLE_CAP const *const c, const MANGLE_INT ncap, const MANGLE_INT skip,
+                  double const *const x )
+{
+    MANGLE_INT k;
+    for( k = 0; k < ncap; k++ ) {
+        double cd;
+        if( k == skip )
+            continue;
+        cd = 1.0 - mply_edge_dot( c[k].x, x );
+        if( c[k].m < 0.0 ) {
+            if( cd < -c[k].m - MPLY_EDGE_EPS )
+                return FALSE;
+        } else {
+            if( cd > c[k].m + MPLY_EDGE_EPS )
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* does cap k have a boundary circle (not empty, not the whole sphere)? */
+INLINE int
+mply_edge_has_circle( MANGLE_CAP const *const c )
+{
+    return c->m != 0.0 && fabs( c->m ) < 2.0;
+}
+
+/* Nearest point to p on the part of cap i's circle that bounds the
+ * polygon.  Returns the distance (or a negative value when no part of the
+ * circle is on the polygon), with the point in x and, when x is an arc
+ * endpoint, the cap that ends the arc in *jend (else -1). */
+static double
+mply_edge_arc_nearest( MANGLE_CAP const *const c, const MANGLE_INT ncap, const MANGLE_INT i,
+                       double const *const p, double *const x, MANGLE_INT * const jend )
+{
+    double const *a = c[i].x;
+    double h, r, ap, u[3], norm, best = -1.0;
+    MANGLE_INT j, k;
+
+    h = 1.0 - fabs( c[i].m );
+    r = sqrt( 1.0 - h * h );
+    *jend = -1;
+
+    /* nearest point of the whole circle */
+    ap = mply_edge_dot( a, p );
+    for( k = 0; k < 3; k++ )
+        u[k] = p[k] - ap * a[k];
+    norm = sqrt( mply_edge_dot( u, u ) );
+    if( norm > MPLY_EDGE_EPS ) {
+        double q[3];
+        for( k = 0; k < 3; k++ )
+            q[k] = h * a[k] + r * u[k] / norm;
+        if( mply_edge_on_arc( c, ncap, i, q ) ) {
+            for( k = 0; k < 3; k++ )
+                x[k] = q[k];
+            return mply_edge_angle( p, q );
+        }
+    }
+
+    /* otherwise the nearest point is where the arc ends on another circle */
+    for( j = 0; j < ncap; j++ ) {
+        double const *b = c[j].x;
+        double hj, ab, det, ca, cb, x0[3], n[3], t2;
+        int s;
+
+        if( j == i || !mply_edge_has_circle( &c[j] ) )
+            continue;
+        hj = 1.0 - fabs( c[j].m );
+        ab = mply_edge_dot( a, b );
+        det = 1.0 - ab * ab;
+        if( det < MPLY_EDGE_EPS )
+            continue;           /* parallel planes: no crossing */
+
+        /* x = ca a + cb b + t (a x b), with a.x = h and b.x = hj */
+        ca = ( h - hj * ab ) / det;
+        cb = ( hj - h * ab ) / det;
+        n[0] = a[1] * b[2] - a[2] * b[1];
+        n[1] = a[2] * b[0] - a[0] * b[2];
+        n[2] = a[0] * b[1] - a[1] * b[0];
+        for( k = 0; k < 3; k++ )
+            x0[k] = ca * a[k] + cb * b[k];
+        t2 = ( 1.0 - mply_edge_dot( x0, x0 ) ) / det;
+        if( t2 < 0.0 )
+            continue;
+
+        for( s = -1; s <= 1; s += 2 ) {
+            double v[3], d;
+            for( k = 0; k < 3; k++ )
+                v[k] = x0[k] + s * sqrt( t2 ) * n[k];
+            mply_edge_normalize( v );
+            if( !mply_edge_on_arc( c, ncap, i, v ) )
+                continue;
+            d = mply_edge_angle( p, v );
+            if( best < 0.0 || d < best ) {
+                best = d;
+                *jend = j;
+                for( k = 0; k < 3; k++ )
+                    x[k] = v[k];
+            }
+        }
+    }
+
+    return best;
+}
+
+/* x rotated by angle t about the cap axis a (so it stays on the circle) */
+INLINE void
+mply_edge_rotate( double const *const a, double const *const x, const double t,
+                  double *const v )
+{
+    double ax = mply_edge_dot( a, x ), ct = cos( t ), st = sin( t );
+    v[0] = x[0] * ct + ( a[1] * x[2] - a[2] * x[1] ) * st + a[0] * ax * ( 1.0 - ct );
+    v[1] = x[1] * ct + ( a[2] * x[0] - a[0] * x[2] ) * st + a[1] * ax * ( 1.0 - ct );
+    v[2] = x[2] * ct + ( a[0] * x[1] - a[1] * x[0] ) * st + a[2] * ax * ( 1.0 - ct );
+}
+
+/* A point just across cap i's circle from the polygon, near x: outside cap
+ * i but inside every other cap, so the lookup there finds the polygon
+ * across this arc.  Near a corner a step straight out of cap i can also
+ * leave the cap that ends the arc (and land diagonally across), so the
+ * probe slides along the arc, away from x by doubling angles, until it is
+ * clear.  An arc endpoint (jend >= 0) always needs the slide.  Returns
+ * FALSE if no such point was found (an arc too short to probe). */
+static int
+mply_edge_across( MANGLE_CAP const *const c, const MANGLE_INT ncap, const MANGLE_INT i,
+                  const MANGLE_INT jend, double const *const x, MANGLE_VEC * const out )
+{
+    double const *a = c[i].x;
+    double ax, t[3], base[3], slide = 0.0;
+    MANGLE_INT k, n;
+    int s;
+
+    for( n = jend >= 0 ? 1 : 0; n <= MPLY_EDGE_NSLIDE; n++ ) {
+        if( n > 0 )
+            slide = n == 1 ? MPLY_EDGE_STEP : 2.0 * slide;
+
+        for( s = -1; s <= 1; s += 2 ) {
+            if( n == 0 && s > 0 )
+                break;          /* no slide: one side only */
+            mply_edge_rotate( a, x, s * slide, base );
+
+            /* out of cap i, along the tangent direction normal to its circle */
+            ax = mply_edge_dot( a, base );
+            for( k = 0; k < 3; k++ )
+                t[k] = a[k] - ax * base[k];
+            mply_edge_normalize( t );
+            if( c[i].m > 0.0 ) {
+                for( k = 0; k < 3; k++ )
+                    t[k] = -t[k];
+            }
+            for( k = 0; k < 3; k++ )
+                out->x[k] = base[k] + MPLY_EDGE_STEP * t[k];
+            mply_edge_normalize( out->x );
+
+            if( mply_within_cap( &c[i], out ) )
+                continue;
+            for( k = 0; k < ncap; k++ ) {
+                if( k != i && !mply_within_cap( &c[k], out ) )
+                    break;
+            }
+            if( k == ncap )
+                return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Distance from vec3 to the edge around polygon INDEX (which should hold
+ * vec3), no further than max_dist.  Returns -1 if index < 0. */
+double
+mply_edge_distance_index( MANGLE_PLY const *const ply, const MANGLE_INT index,
+                          MANGLE_VEC const *const vec3, const double max_dist )
+{
+    MANGLE_INT sbuf[64], *seen = sbuf, nseen = 0, nalloc = 64, k;
+    double w, best = max_dist;
+
+    if( index < 0 )
+        return -1.0;
+
+    w = ply->poly[index].weight;
+    seen[nseen++] = index;
+
+    /* breadth-first over equal weight neighbours: seen[] is also the queue */
+    for( k = 0; k < nseen; k++ ) {
+        MANGLE_HOT const *h = &( ply->hot[seen[k]] );
+        MANGLE_CAP const *c = &( ply->cap[h->icap] );
+        MANGLE_INT i;
+
+        for( i = 0; i < h->ncap; i++ ) {
+            MANGLE_INT jend, across, s;
+            MANGLE_VEC out;
+            double x[3], d;
+
+            if( !mply_edge_has_circle( &c[i] ) )
+                continue;
+            d = mply_edge_arc_nearest( c, h->ncap, i, vec3->x, x, &jend );
+            if( d < 0.0 || d >= best )
+                continue;
+
+            /* an arc that cannot be probed counts as an edge */
+            if( !mply_edge_across( c, h->ncap, i, jend, x, &out ) ) {
+                best = d;
+                continue;
+            }
+            across = mply_find_polyindex_xyz( ply, &out );
+            if( across < 0 || ply->poly[across].weight != w ) {
+                best = d;
+                continue;
+            }
+
+            /* internal edge: the neighbour's own edges may be closer */
+            for( s = 0; s < nseen && seen[s] != across; s++ );
+            if( s < nseen )
+                continue;
+            if( nseen == nalloc ) {
+                MANGLE_INT *tmp = ( MANGLE_INT * ) check_alloc( 2 * nalloc, sizeof( MANGLE_INT ) );
+                memcpy( tmp, seen, nseen * sizeof( MANGLE_INT ) );
+                if( seen != sbuf )
+                    CHECK_FREE( seen );
+                seen = tmp;
+                nalloc *= 2;
+            }
+            seen[nseen++] = across;
+        }
+    }
+
+    if( seen != sbuf )
+        CHECK_FREE( seen );
+    return best;
+}
+
+/* distance (radians) from a point to the edge of the mask around it, or -1
+ * outside the mask */
+double
+mply_edge_distance_polar( MANGLE_PLY const *const ply, const double az, const double el )
+{
+    MANGLE_VEC vec3;
+    mply_vec_from_polar( &vec3, az, el );
+    return mply_edge_distance_index( ply, mply_find_polyindex_polar( ply, az, el ), &vec3, PI );
+}
+
+double
+mply_edge_distance( MANGLE_PLY const *const ply, const double ra, const double dec )
+{
+    /* ra, dec in degrees; the result is still in radians */
+    return mply_edge_distance_polar( ply, ra * DEG2RAD, dec * DEG2RAD );
+}
+
+/* Batch version for n points (degrees).  If index is not NULL it must hold
+ * the INDEX of each point, e.g. from mply_find_polyindex_radec_batch(), and
+ * the lookup is not repeated.  Distances are capped at max_dist. */
+void
+mply_edge_distance_radec_batch( MANGLE_PLY const *const ply, const size_t n,
+                                double const *const ra, double const *const dec,
+                                MANGLE_INT const *const index, const double max_dist,
+                                double *const dist )
+{
+    size_t i;
+
+    for( i = 0; i < n; i++ ) {
+        MANGLE_VEC vec3;
+        MANGLE_INT ii;
+
+        if( NULL != index )
+            ii = index[i];
+        else
+            ii = mply_find_polyindex_radec( ply, ra[i], dec[i] );
+        if( ii < 0 ) {
+            dist[i] = -1.0;     /* outside (or a row a shard filter dropped) */
+            continue;
+        }
+        mply_vec_from_radec( &vec3, ra[i], dec[i] );
+        dist[i] = mply_edge_distance_index( ply, ii, &vec3, max_dist );
+    }
+}
+
+#endif
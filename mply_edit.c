@@ -0,0 +1,342 @@
+/* edit a loaded mask in place
+ *
+ * Add polygons, remove them or change their weight on a live MANGLE_PLY,
+ * without writing it out and reading it back.  Each edit costs about the
+ * size of the edit (plus amortized array growth), and the mask answers
+ * queries correctly between edits:
+ *
+ *   mply_edit_init()      start editing ply
+ *   mply_edit_add()       append a polygon, returns its INDEX
+ *   mply_edit_remove()    tombstone the polygon at INDEX
+ *   mply_edit_weight()    change the weight at INDEX
+ *   mply_edit_compact()   drop tombstones once there are enough of them
+ *
+ * A removed polygon keeps its INDEX until compaction.  It is unlinked from
+ * its pixel list and its caps are replaced by a single empty cap, so it
+ * never matches (and a scan of an unpixelized mask skips it quickly).
+ *
+ * Lookups return the FIRST polygon containing the point.  An added polygon
+ * can go last, as if it were appended to the polygon file, or (pixelized
+ * masks only) first in its pixel, so it takes precedence over the polygons
+ * already there: a weight 0 polygon added first is a hole.
+ *
+ * Compaction rewrites the mask with mply_keep_index(), so INDEX values
+ * change.  On pixelized masks the polygons end up in pixel order, with
+ * each pixel in lookup order, so a mask written out afterwards gives the
+ * same answers when read back.  Compact (force = TRUE) before writing:
+ * tombstones are otherwise written as empty weight 0 polygons.
+ *
+ * Arrays that grow are reallocated the usual way, so placement done by
+ * mply_mem_place() is lost for them; call it again after a batch of edits.
+ * Placement trims the hot array to npoly entries: the editor notices it
+ * has moved and regrows it on the next add.
+ * Copies of the mask made elsewhere (e.g. the flat or soa layouts of
+ * minimal_mangle.hpp) have to be rebuilt after edits.  Edits must not run
+ * concurrently with queries.
+ */
+#pragma once
+#ifndef MPLY_EDIT_INCLUDED
+#define MPLY_EDIT_INCLUDED
+
+#include <string.h>
+
+#include <minimal_mangle.c>
+#include <mply_rewrite.c>
+
+/* compact when at least this fraction of the polygons are tombstones */
+#ifndef MPLY_EDIT_COMPACT
+#define MPLY_EDIT_COMPACT 0.25
+#endif
+
+enum {
+    MPLY_EDIT_LAST = 0,         /* lowest precedence, like the end of the file */
+    MPLY_EDIT_FIRST = 1         /* ahead of the polygons already in its pixel */
+};
+
+typedef struct {
+    MANGLE_PLY *ply;
+    MANGLE_INT npoly_alloc;     /* room in ply->poly and ply->hot */
+    MANGLE_HOT *hot;            /* ply->hot as last grown */
+    MANGLE_INT ndead;           /* tombstones since the last compaction */
+    MANGLE_INT null_cap;        /* offset of the empty cap in ply->cap */
+    MANGLE_CAP *cap;            /* ply->cap and ply->ncap_alloc as last linked */
+    MANGLE_INT ncap_alloc;
+#ifdef MANGLE_FLOAT_CAPS
+    MANGLE_CAPF *capf;
+#endif
+} MANGLE_EDIT;
+
+/* relink cap views after the cap array moved, and keep the float copy as
+ * large as the cap array so appends only have to convert the new caps */
+static void
+mply_edit_link( MANGLE_EDIT * const ed )
+{
+    MANGLE_PLY *ply = ed->ply;
+
+    mply_cap_link( ply );
+#ifdef MANGLE_FLOAT_CAPS
+    ply->capf = ( MANGLE_CAPF * ) check_realloc( ply->capf, ply->ncap_alloc,
+                                                 sizeof( MANGLE_CAPF ) );
+    ed->capf = ply->capf;
+#endif
+    ed->cap = ply->cap;
+    ed->ncap_alloc = ply->ncap_alloc;
+}
+
+/* has the cap storage changed since mply_edit_link()?  Also notices a hot
+ * array moved by someone else (mply_mem_place()), whose room is then only
+ * npoly. */
+INLINE int
+mply_edit_moved( MANGLE_EDIT * const ed )
+{
+    MANGLE_PLY const *ply = ed->ply;
+
+    if( ply->hot != ed->hot ) {
+        ed->hot = ply->hot;
+        ed->npoly_alloc = ply->npoly;
+    }
+#ifdef MANGLE_FLOAT_CAPS
+    if( ply->capf != ed->capf )
+        return TRUE;
+#endif
+    return ply->cap != ed->cap || ply->ncap_alloc != ed->ncap_alloc;
+}
+
+/* the empty cap: 1 - 0.v = 1 is never < m = 0, so nothing is inside it */
+static void
+mply_edit_null_cap( MANGLE_EDIT * const ed )
+{
+    MANGLE_PLY *ply = ed->ply;
+    MANGLE_CAP *c;
+
+    ed->null_cap = mply_cap_reserve( ply, 1 );
+    c = &( ply->cap[ed->null_cap] );
+    c->x[0] = c->x[1] = c->x[2] = 0.0;
+    c->m = 0.0;
+    mply_edit_link( ed );
+}
+
+void
+mply_edit_init( MANGLE_EDIT * const ed, MANGLE_PLY * const ply )
+{
+    ed->ply = ply;
+    ed->npoly_alloc = ply->npoly;
+    ed->hot = ply->hot;
+    ed->ndead = 0;
+    mply_edit_null_cap( ed );
+}
+
+INLINE int
+mply_edit_is_dead( MANGLE_EDIT const *const ed, const MANGLE_INT index )
+{
+    return ed->ply->hot[index].icap == ed->null_cap;
+}
+
+static void
+mply_edit_check_index( MANGLE_EDIT const *const ed, const MANGLE_INT index )
+{
+    if( index < 0 || index >= ed->ply->npoly || mply_edit_is_dead( ed, index ) ) {
+        fprintf( stderr, "MANGLE Error: cannot edit POLY index: %zd\n", ( ssize_t ) index );
+        exit( EXIT_FAILURE );
+    }
+}
+
+/* room for one more polygon: the pixel lists point into the MANGLE_POLY
+ * array, so they are rebased when it moves */
+static void
+mply_edit_grow( MANGLE_EDIT * const ed )
+{
+    MANGLE_PLY *ply = ed->ply;
+    MANGLE_POLY *poly;
+    MANGLE_INT nalloc;
+    size_t k, npix;
+
+    mply_edit_moved( ed );
+    if( ply->npoly < ed->npoly_alloc )
+        return;
+    if( ply->npoly == MANGLE_INT_MAX ) {
+        fprintf( stderr, "MANGLE Error: too many polygons, see MANGLE_INT64\n" );
+        exit( EXIT_FAILURE );
+    }
+
+    nalloc = ed->npoly_alloc > 32 ? ed->npoly_alloc : 32;
+    nalloc = nalloc > MANGLE_INT_MAX / 2 ? MANGLE_INT_MAX : 2 * nalloc;
+
+    poly = ( MANGLE_POLY * ) check_alloc( nalloc, sizeof( MANGLE_POLY ) );
+    if( ply->npoly > 0 )
+        memcpy( poly, ply->poly, ply->npoly * sizeof( MANGLE_POLY ) );
+    npix = mply_pix_count( ply->pix_res );
+    for( k = 0; k < npix; k++ ) {
+        DATA_LIST *dl = &( ply->pix[k] );
+        while( dl != NULL && dl->data != NULL ) {
+            dl->data = ( void * ) ( poly + ( ( MANGLE_POLY * ) dl->data - ply->poly ) );
+            dl = ( DATA_LIST * ) dl->next;
+        }
+    }
+    CHECK_FREE( ply->poly );
+    ply->poly = poly;
+
+    ply->hot = ( MANGLE_HOT * ) check_realloc( ply->hot, nalloc, sizeof( MANGLE_HOT ) );
+    ed->hot = ply->hot;
+    ed->npoly_alloc = nalloc;
+}
+
+/* put p at the head of pixel list ipix */
+static void
+mply_edit_pix_first( MANGLE_PLY const *const ply, const MANGLE_INT ipix,
+                     MANGLE_POLY const *const p )
+{
+    DATA_LIST *head = &( ply->pix[ipix] );
+
+    if( head->data != NULL ) {
+        DATA_LIST *dl = ( DATA_LIST * ) check_alloc( 1, sizeof( DATA_LIST ) );
+        *dl = *head;
+        head->next = ( void * ) dl;
+    }
+    head->data = ( void * ) p;
+}
+
+/* take p out of its pixel list */
+static void
+mply_edit_pix_remove( MANGLE_PLY const *const ply, MANGLE_POLY const *const p )
+{
+    DATA_LIST *dl, *prev = NULL;
+
+    dl = &( ply->pix[mply_pix_index_from_id( ply, p->pixel )] );
+    while( dl != NULL && dl->data != ( void * ) p ) {
+        prev = dl;
+        dl = ( DATA_LIST * ) dl->next;
+    }
+    if( NULL == dl ) {
+        fprintf( stderr, "MANGLE Error: polygon missing from its pixel list (polyid=%zd)\n",
+                 ( ssize_t ) p->polyid );
+        exit( EXIT_FAILURE );
+    }
+
+    if( NULL != prev ) {
+        prev->next = dl->next;
+        CHECK_FREE( dl );
+    } else if( NULL != dl->next ) {
+        /* the head lives in the pixel array: pull the second entry into it */
+        DATA_LIST *next = ( DATA_LIST * ) dl->next;
+        *dl = *next;
+        CHECK_FREE( next );
+    } else {
+        dl->data = NULL;
+    }
+}
+
+/* Append a polygon (caps are copied) and return its INDEX.  where is
+ * MPLY_EDIT_LAST or MPLY_EDIT_FIRST (see above). */
+MANGLE_INT
+mply_edit_add( MANGLE_EDIT * const ed, const MANGLE_INT polyid, const MANGLE_INT ncap,
+               MANGLE_CAP const *const cap, const double weight, const MANGLE_INT pixel,
+               const double area, const int where )
+{
+    MANGLE_PLY *ply = ed->ply;
+    MANGLE_POLY *p;
+    MANGLE_INT index, ipix = -1;
+
+    if( ncap < 1 ) {
+        fprintf( stderr, "MANGLE Error: cannot add a polygon without caps (polyid=%zd)\n",
+                 ( ssize_t ) polyid );
+        exit( EXIT_FAILURE );
+    }
+    if( ply->pix_res > 0 ) {
+        ipix = mply_pix_index_from_id( ply, pixel );
+    } else if( MPLY_EDIT_FIRST == where ) {
+        fprintf( stderr, "MANGLE Error: MPLY_EDIT_FIRST needs a pixelized mask\n" );
+        exit( EXIT_FAILURE );
+    }
+
+    mply_edit_grow( ed );
+    index = ply->npoly++;
+
+    p = mply_poly_alloc( ply, index, polyid, ncap, weight, pixel, area );
+    memcpy( p->cap, cap, ncap * sizeof( MANGLE_CAP ) );
+    if( mply_edit_moved( ed ) ) {
+        mply_edit_link( ed );
+    } else {
+#ifdef MANGLE_FLOAT_CAPS
+        MANGLE_INT i, icap = ply->hot[index].icap;
+        for( i = 0; i < ncap; i++ )
+            mply_capf_from_cap( &( ply->capf[icap + i] ), &( ply->cap[icap + i] ) );
+#endif
+    }
+
+    if( ply->pix_res > 0 ) {
+        if( MPLY_EDIT_FIRST == where )
+            mply_edit_pix_first( ply, ipix, p );
+        else
+            mply_pix_addpoly( ply, p );
+    }
+
+    return index;
+}
+
+void
+mply_edit_remove( MANGLE_EDIT * const ed, const MANGLE_INT index )
+{
+    MANGLE_PLY *ply = ed->ply;
+    MANGLE_POLY *p;
+
+    mply_edit_check_index( ed, index );
+    p = &( ply->poly[index] );
+    if( ply->pix_res > 0 )
+        mply_edit_pix_remove( ply, p );
+
+    ply->hot[index].icap = ed->null_cap;
+    ply->hot[index].ncap = 1;
+    p->cap = &( ply->cap[ed->null_cap] );
+    p->ncap = 1;
+    p->weight = 0.0;
+    p->area = 0.0;
+    ed->ndead += 1;
+}
+
+void
+mply_edit_weight( MANGLE_EDIT * const ed, const MANGLE_INT index, const double weight )
+{
+    mply_edit_check_index( ed, index );
+    ed->ply->poly[index].weight = weight;
+}
+
+/* Drop the tombstones if there are at least MPLY_EDIT_COMPACT of them (or
+ * any at all, with force).  Returns TRUE if INDEX values changed. */
+int
+mply_edit_compact( MANGLE_EDIT * const ed, const int force )
+{
+    MANGLE_PLY *ply = ed->ply;
+    MANGLE_INT i, n = 0, *index;
+
+    if( 0 == ed->ndead )
+        return FALSE;
+    if( !force && ed->ndead < MPLY_EDIT_COMPACT * ply->npoly )
+        return FALSE;
+
+    index = ( MANGLE_INT * ) check_alloc( ply->npoly, sizeof( MANGLE_INT ) );
+    if( ply->pix_res > 0 ) {
+        /* lookup order within each pixel; tombstones are not in the lists */
+        size_t k, npix = mply_pix_count( ply->pix_res );
+        for( k = 0; k < npix; k++ ) {
+            DATA_LIST *dl = &( ply->pix[k] );
+            while( dl != NULL && dl->data != NULL ) {
+                index[n++] = ( MANGLE_INT ) ( ( MANGLE_POLY * ) dl->data - ply->poly );
+                dl = ( DATA_LIST * ) dl->next;
+            }
+        }
+    } else {
+        for( i = 0; i < ply->npoly; i++ ) {
+            if( !mply_edit_is_dead( ed, i ) )
+                index[n++] = i;
+        }
+    }
+
+    mply_keep_index( ply, index, n );
+    CHECK_FREE( index );
+
+    mply_edit_init( ed, ply );
+    return TRUE;
+}
+
+#endif
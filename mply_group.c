@@ -0,0 +1,242 @@
+/* batch lookups with several queries in flight
+ *
+ * On a mask much larger than the cache, a pixelized lookup is a chain of
+ * dependent misses: the pixel list head, the polygon's hot entry, its
+ * caps, then the next list entry and so on.  One query at a time, the
+ * core mostly waits.  The functions here keep up to `group` queries in
+ * flight, each as a small state machine.  Every step prefetches what the
+ * query needs next and moves on to the next query, so by the time it comes
+ * back round the data has (ideally) arrived.  This is the "asynchronous
+ * memory access chaining" pattern.
+ *
+ * The answers are the same as from the _batch functions (same unit
+ * vectors and pixel choice, and points close to a cap edge are looked up
+ * again one at a time), so the same as from the single point functions.
+ * Good group sizes are around 4 - 16: enough
+ * to cover memory latency, but not so many that prefetched lines are
+ * evicted before they are used.  group = 0 means MANGLE_GROUP.  For masks
+ * that fit in cache, or without a pixel index (a linear scan, which the
+ * hardware prefetches well), there is nothing to gain; unpixelized masks
+ * go straight to the _batch functions.  examples/mply_bench compares them.
+ */
+#pragma once
+#ifndef MPLY_GROUP_INCLUDED
+#define MPLY_GROUP_INCLUDED
+
+#include <minimal_mangle.c>
+
+#ifndef MANGLE_GROUP
+#define MANGLE_GROUP 8
+#endif
+#define MPLY_GROUP_MAX 64
+
+#if defined( __GNUC__ )
+#define MPLY_PREFETCH( p ) __builtin_prefetch( p )
+#else
+#define MPLY_PREFETCH( p ) ( ( void ) 0 )
+#endif
+
+/* Each link of the chain is its own stage: the caps are found through
+ * the polygon's hot entry, which is itself a miss on a big mask. */
+enum {
+    MPLY_GROUP_ENTRY,           /* list entry (pixel head or overflow) prefetched */
+    MPLY_GROUP_HOT,             /* hot entry and next list entry prefetched */
+    MPLY_GROUP_CAPS             /* caps prefetched */
+};
+
+typedef struct {
+    size_t q;                   /* query, within the current chunk */
+    int state;
+    MANGLE_INT index;
+    DATA_LIST const *dl;
+} MANGLE_GROUP_SLOT;
+
+/* prefetch the caps of polygon index (first and last cache line) */
+INLINE void
+mply_group_prefetch_caps( MANGLE_PLY const *const ply, const MANGLE_INT index )
+{
+    MANGLE_HOT const *h = &( ply->hot[index] );
+#ifdef MANGLE_FLOAT_CAPS
+    if( NULL != ply->capf ) {
+        MPLY_PREFETCH( &( ply->capf[h->icap] ) );
+        if( h->ncap > 1 )
+            MPLY_PREFETCH( &( ply->capf[h->icap + h->ncap - 1] ) );
+        return;
+    }
+#endif
+    MPLY_PREFETCH( &( ply->cap[h->icap] ) );
+    if( h->ncap > 1 )
+        MPLY_PREFETCH( &( ply->cap[h->icap + h->ncap - 1] ) );
+}
+
+/* One step of the query in slot s.  Returns TRUE when it is finished,
+ * with the result in s->index (MPLY_NEAR to look it up again). */
+INLINE int
+mply_group_step( MANGLE_PLY const *const ply, MANGLE_GROUP_SLOT * const s,
+                 MANGLE_VEC const *const vec3 )
+{
+    switch ( s->state ) {
+    case MPLY_GROUP_ENTRY:
+        if( NULL == s->dl || NULL == s->dl->data ) {
+            s->index = -1;
+            return TRUE;
+        }
+        s->index = ( MANGLE_INT ) ( ( MANGLE_POLY const * ) s->dl->data - ply->poly );
+        s->dl = ( DATA_LIST const * ) s->dl->next;
+        MPLY_PREFETCH( &( ply->hot[s->index] ) );
+        if( NULL != s->dl )
+            MPLY_PREFETCH( s->dl );
+        s->state = MPLY_GROUP_HOT;
+        return FALSE;
+    case MPLY_GROUP_HOT:
+        mply_group_prefetch_caps( ply, s->index );
+        s->state = MPLY_GROUP_CAPS;
+        return FALSE;
+    default:
+        switch ( mply_within_index_fast( ply, s->index, vec3 ) ) {
+        case TRUE:
+            return TRUE;
+        case MPLY_NEAR:
+            s->index = MPLY_NEAR;
+            return TRUE;
+        }
+        s->state = MPLY_GROUP_ENTRY;
+        return FALSE;
+    }
+}
+
+/* Look up nb points (unit vectors vec3, pixel INDEX ipix) with up to group
+ * of them in flight.  Points too close to a cap edge to call with a fast
+ * vector get MPLY_NEAR, for the caller to redo. */
+static void
+mply_group_run( MANGLE_PLY const *const ply, const size_t nb, MANGLE_VEC const *const vec3,
+                MANGLE_INT const *const ipix, MANGLE_INT * const index, int group )
+{
+    MANGLE_GROUP_SLOT slot[MPLY_GROUP_MAX];
+    size_t next = 0;
+    int k, active = 0;
+
+    if( group < 1 )
+        group = MANGLE_GROUP;
+    if( group > MPLY_GROUP_MAX )
+        group = MPLY_GROUP_MAX;
+
+    for( k = 0; k < group && next < nb; k++, next++ ) {
+        slot[k].q = next;
+        slot[k].state = MPLY_GROUP_ENTRY;
+        slot[k].dl = &( ply->pix[ipix[next]] );
+        MPLY_PREFETCH( slot[k].dl );
+        active += 1;
+    }
+
+    /* round robin; a finished slot takes the next query */
+    while( active > 0 ) {
+        for( k = 0; k < active; k++ ) {
+            MANGLE_GROUP_SLOT *s = &slot[k];
+
+            if( !mply_group_step( ply, s, &vec3[s->q] ) )
+                continue;
+            index[s->q] = s->index;
+            if( next < nb ) {
+                s->q = next++;
+                s->state = MPLY_GROUP_ENTRY;
+                s->dl = &( ply->pix[ipix[s->q]] );
+                MPLY_PREFETCH( s->dl );
+            } else {
+                /* keep the active slots packed at the front */
+                slot[k--] = slot[--active];
+            }
+        }
+    }
+}
+
+/* same as mply_find_polyindex_polar_batch(), with up to group queries in
+ * flight (group = 0 for MANGLE_GROUP) */
+void
+mply_find_polyindex_polar_group( MANGLE_PLY const *const ply, const size_t n,
+                                 double const *const az, double const *const el,
+                                 MANGLE_INT * const index, const int group )
+{
+    size_t i, j, nb;
+    double s_el[MANGLE_BATCH], c_el[MANGLE_BATCH];
+    double s_az[MANGLE_BATCH], c_az[MANGLE_BATCH];
+    MANGLE_VEC vec3[MANGLE_BATCH];
+    MANGLE_INT ipix[MANGLE_BATCH];
+
+    if( ply->pix_res < 1 ) {
+        mply_find_polyindex_polar_batch( ply, n, az, el, index );
+        return;
+    }
+
+    for( i = 0; i < n; i += nb ) {
+        nb = n - i < MANGLE_BATCH ? n - i : MANGLE_BATCH;
+
+        mply_sincos_batch( nb, &el[i], s_el, c_el );
+        mply_sincos_batch( nb, &az[i], s_az, c_az );
+
+        for( j = 0; j < nb; j++ ) {
+            double sin_el = s_el[j];
+
+            vec3[j].x[0] = c_el[j] * c_az[j];
+            vec3[j].x[1] = c_el[j] * s_az[j];
+            vec3[j].x[2] = s_el[j];
+
+            if( !mply_pix_sin_is_safe( ply, sin_el ) )
+                sin_el = sin( el[i + j] );
+            ipix[j] = mply_pix_which_index_sin( ply, az[i + j], sin_el );
+        }
+        mply_group_run( ply, nb, vec3, ipix, &index[i], group );
+
+        for( j = 0; j < nb; j++ ) {
+            if( MPLY_NEAR == index[i + j] )
+                index[i + j] = mply_find_polyindex_polar( ply, az[i + j], el[i + j] );
+        }
+    }
+}
+
+void
+mply_find_polyindex_radec_group( MANGLE_PLY const *const ply, const size_t n,
+                                 double const *const ra, double const *const dec,
+                                 MANGLE_INT * const index, const int group )
+{
+    size_t i, j, nb;
+    double az[MANGLE_BATCH], el[MANGLE_BATCH];
+
+    for( i = 0; i < n; i += nb ) {
+        nb = n - i < MANGLE_BATCH ? n - i : MANGLE_BATCH;
+        for( j = 0; j < nb; j++ ) {
+            az[j] = ra[i + j] * DEG2RAD;
+            el[j] = dec[i + j] * DEG2RAD;
+        }
+        mply_find_polyindex_polar_group( ply, nb, az, el, &index[i], group );
+    }
+}
+
+void
+mply_find_polyindex_xyz_group( MANGLE_PLY const *const ply, const size_t n,
+                               MANGLE_VEC const *const vec3, MANGLE_INT * const index,
+                               const int group )
+{
+    MANGLE_INT ipix[MANGLE_BATCH];
+    size_t i, j, nb;
+
+    if( ply->pix_res < 1 ) {
+        mply_find_polyindex_xyz_batch( ply, n, vec3, index );
+        return;
+    }
+
+    for( i = 0; i < n; i += nb ) {
+        nb = n - i < MANGLE_BATCH ? n - i : MANGLE_BATCH;
+        for( j = 0; j < nb; j++ )
+            ipix[j] = mply_pix_which_index_vec( ply, &vec3[i + j] );
+        mply_group_run( ply, nb, &vec3[i], ipix, &index[i], group );
+
+        /* the vectors are the caller's, so this is only the exact test */
+        for( j = 0; j < nb; j++ ) {
+            if( MPLY_NEAR == index[i + j] )
+                index[i + j] = mply_find_polyindex_in_pix( ply, ipix[j], &vec3[i + j] );
+        }
+    }
+}
+
+#endif
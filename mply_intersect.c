@@ -0,0 +1,444 @@
+/* intersect two masks into one
+ *
+ * Stacking a footprint mask with a completeness (or veto) mask usually
+ * means two lookups per point.  A polygon is an intersection of caps, so
+ * the intersection of polygons a and b is just their caps together, and
+ * mply_intersect() builds a single mask with a polygon for every pair that
+ * overlaps.  One lookup in it then gives the same answer as both:
+ *
+ *   - candidate pairs come from the pixel index (or a region query when
+ *     only one mask is pixelized), and are kept only if their caps have a
+ *     common interior (mply_caps_intersect(), see mply_region.c)
+ *   - caps that do not change the result are dropped (mply_caps_prune())
+ *   - the weight is the product or the minimum of the two weights, and the
+ *     area is computed from the caps (mply_caps_area())
+ *   - pairs are written in (INDEX a, INDEX b) order, so the first match in
+ *     the result is the pair of first matches in the inputs; weight 0
+ *     polygons are kept, as they hide the ones after them
+ *   - the result is pixelized at the finer of the two resolutions
+ *
+ * polyids are numbered 0 .. N-1; the pairs of INDEX values can be returned
+ * to map them back.  Masks are expected as read (lookup order is INDEX
+ * order within each pixel).
+ */
+#pragma once
+#ifndef MPLY_INTERSECT_INCLUDED
+#define MPLY_INTERSECT_INCLUDED
+
+#include <minimal_mangle.c>
+#include <mply_region.c>
+#include <mply_load.c>
+
+enum {
+    MPLY_INTERSECT_PRODUCT = 0,
+    MPLY_INTERSECT_MIN = 1
+};
+
+/* Drop caps that do not change the intersection of caps[0..n): cap k is
+ * redundant when the other caps have no common interior with its outside.
+ * Returns the new count (caps with no common interior are left as they
+ * are). */
+MANGLE_INT
+mply_caps_prune( MANGLE_CAP * const caps, MANGLE_INT n )
+{
+    MANGLE_CAP tbuf[64], *tmp;
+    MANGLE_INT k;
+
+    if( !mply_caps_intersect( caps, n, NULL, 0 ) )
+        return n;
+
+    tmp = n <= 64 ? tbuf : ( MANGLE_CAP * ) check_alloc( n, sizeof( MANGLE_CAP ) );
+    for( k = n - 1; k >= 0; k-- ) {
+        MANGLE_CAP out = caps[k];
+
+        out.m = -out.m;
+        memcpy( tmp, caps, k * sizeof( MANGLE_CAP ) );
+        memcpy( &tmp[k], &caps[k + 1], ( n - k - 1 ) * sizeof( MANGLE_CAP ) );
+        if( !mply_caps_intersect( tmp, n - 1, &out, 1 ) ) {
+            memmove( &caps[k], &caps[k + 1], ( n - k - 1 ) * sizeof( MANGLE_CAP ) );
+            n -= 1;
+        }
+    }
+    if( tmp != tbuf )
+        CHECK_FREE( tmp );
+
+    return n;
+}
+
+/* boundary circle of a cap: v(t) = h c + r (cos(t) u + sin(t) w) */
+typedef struct {
+    double h, r;
+    MANGLE_VEC u, w;
+} MANGLE_CIRCLE;
+
+static int
+mply_circle( MANGLE_CAP const *const c, MANGLE_CIRCLE * const cc )
+{
+    double e[3] = { 0.0, 0.0, 0.0 }, norm;
+    int k, kmin = 0;
+
+    cc->h = 1.0 - fabs( c->m );
+    if( cc->h <= -1.0 || cc->h >= 1.0 )
+        return FALSE;
+    cc->r = sqrt( 1.0 - cc->h * cc->h );
+
+    for( k = 1; k < 3; k++ ) {
+        if( fabs( c->x[k] ) < fabs( c->x[kmin] ) )
+            kmin = k;
+    }
+    e[kmin] = 1.0;
+    for( k = 0; k < 3; k++ )
+        cc->u.x[k] = e[k] - c->x[kmin] * c->x[k];
+    norm = sqrt( cc->u.x[0] * cc->u.x[0] + cc->u.x[1] * cc->u.x[1] + cc->u.x[2] * cc->u.x[2] );
+    for( k = 0; k < 3; k++ )
+        cc->u.x[k] /= norm;
+    cc->w.x[0] = c->x[1] * cc->u.x[2] - c->x[2] * cc->u.x[1];
+    cc->w.x[1] = c->x[2] * cc->u.x[0] - c->x[0] * cc->u.x[2];
+    cc->w.x[2] = c->x[0] * cc->u.x[1] - c->x[1] * cc->u.x[0];
+    return TRUE;
+}
+
+static inline void
+mply_circle_point( MANGLE_CAP const *const c, MANGLE_CIRCLE const *const cc, const double t,
+                   MANGLE_VEC * const v, MANGLE_VEC * const dv )
+{
+    double ct = cos( t ), st = sin( t );
+    int k;
+    for( k = 0; k < 3; k++ ) {
+        v->x[k] = cc->h * c->x[k] + cc->r * ( ct * cc->u.x[k] + st * cc->w.x[k] );
+        if( NULL != dv )
+            dv->x[k] = cc->r * ( -st * cc->u.x[k] + ct * cc->w.x[k] );
+    }
+}
+
+/* The arcs of the boundary of cap i that lie inside all the other caps, as
+ * pairs of parameters (t0, t1) with t0 < t1 (t1 may pass 2 PI).  arc has
+ * room for 2 n pairs.  Returns the number of arcs. */
+static MANGLE_INT
+mply_caps_arcs( MANGLE_CAP const *const caps, const MANGLE_INT n, const MANGLE_INT i,
+                MANGLE_CIRCLE const *const cc, double *const arc, double *const t )
+{
+    MANGLE_CAP const *ci = &caps[i];
+    MANGLE_INT j, k, nt = 0, narc = 0;
+
+    for( j = 0; j < n; j++ ) {
+        MANGLE_CAP const *cj = &caps[j];
+        double A, P, Q, B, hj, dj, c;
+
+        if( j == i )
+            continue;
+        hj = 1.0 - fabs( cj->m );
+        dj = cj->m >= 0.0 ? 1.0 : -1.0;
+        A = cc->h * ( cj->x[0] * ci->x[0] + cj->x[1] * ci->x[1] + cj->x[2] * ci->x[2] );
+        P = cc->r * ( cj->x[0] * cc->u.x[0] + cj->x[1] * cc->u.x[1] + cj->x[2] * cc->u.x[2] );
+        Q = cc->r * ( cj->x[0] * cc->w.x[0] + cj->x[1] * cc->w.x[1] + cj->x[2] * cc->w.x[2] );
+        B = sqrt( P * P + Q * Q );
+
+        if( B < MPLY_REGION_EPS ) {
+            /* parallel circles: all of circle i is on one side of cap j */
+            if( dj * ( A - hj ) <= 0.0 )
+                return 0;
+            continue;
+        }
+        c = ( hj - A ) / B;
+        if( ( dj > 0.0 && c >= 1.0 ) || ( dj < 0.0 && c <= -1.0 ) )
+            return 0;
+        if( ( dj > 0.0 && c < -1.0 ) || ( dj < 0.0 && c > 1.0 ) )
+            continue;
+        t[nt++] = fmod( atan2( Q, P ) - acos( c ) + 4.0 * PI, 2.0 * PI );
+        t[nt++] = fmod( atan2( Q, P ) + acos( c ) + 4.0 * PI, 2.0 * PI );
+    }
+
+    if( 0 == nt ) {
+        arc[0] = 0.0;
+        arc[1] = 2.0 * PI;
+        return 1;
+    }
+    qsort( t, nt, sizeof( double ), mply_double_cmp );
+    for( k = 0; k < nt; k++ ) {
+        double t0 = t[k], t1 = k + 1 < nt ? t[k + 1] : t[0] + 2.0 * PI;
+        MANGLE_VEC v;
+        int inside = TRUE;
+
+        if( t1 - t0 <= 0.0 )
+            continue;
+        mply_circle_point( ci, cc, 0.5 * ( t0 + t1 ), &v, NULL );
+        for( j = 0; j < n && inside; j++ ) {
+            if( j != i )
+                inside = mply_within_cap( &caps[j], &v );
+        }
+        if( inside ) {
+            arc[2 * narc] = t0;
+            arc[2 * narc + 1] = t1;
+            narc += 1;
+        }
+    }
+    return narc;
+}
+
+/* angular distance from s to the boundary circle of cap c */
+static inline double
+mply_circle_dist( MANGLE_CAP const *const c, MANGLE_VEC const *const s )
+{
+    double d = c->x[0] * s->x[0] + c->x[1] * s->x[1] + c->x[2] * s->x[2];
+    d = d > 1.0 ? 1.0 : ( d < -1.0 ? -1.0 : d );
+    return fabs( acos( d ) - acos( 1.0 - fabs( c->m ) ) );
+}
+
+/* Sum of (1 - z) dphi over the boundary arcs, in a frame whose south pole
+ * s keeps away from them (plus 4 PI if s is inside the caps).  Each arc is
+ * smooth, so Gauss-Legendre quadrature gives it to near double precision. */
+static double
+mply_caps_area_arcs( MANGLE_CAP const *const caps, const MANGLE_INT n,
+                     MANGLE_CIRCLE const *const cc, MANGLE_INT const *const narc,
+                     double const *const arc )
+{
+    static const double gx[4] = { 0.1834346424956498, 0.5255324099163290,
+        0.7966664774136267, 0.9602898564975363
+    };
+    static const double gw[4] = { 0.3626837833783620, 0.3137066458778873,
+        0.2223810344533745, 0.1012285362903763
+    };
+    MANGLE_VEC s = { {0.0, 0.0, -1.0} }, e1, e2, e3;
+    MANGLE_CAP pole;
+    MANGLE_CIRCLE frame;
+    double area = 0.0, best = -1.0;
+    MANGLE_INT i, k;
+    int c, q;
+
+    /* the antipode of a boundary point, or an axis, whichever is furthest
+     * from every boundary circle */
+    for( c = 0; c < 7; c++ ) {
+        MANGLE_VEC v = { {0.0, 0.0, 0.0} };
+        double dmin = 4.0;
+
+        if( 0 == c ) {
+            i = 0;
+            while( 0 == narc[i] )
+                i++;
+            mply_circle_point( &caps[i], &cc[i], 0.5 * ( arc[2 * n * i] + arc[2 * n * i + 1] ),
+                               &v, NULL );
+            for( k = 0; k < 3; k++ )
+                v.x[k] = -v.x[k];
+        } else {
+            v.x[( c - 1 ) / 2] = c % 2 ? 1.0 : -1.0;
+        }
+        for( i = 0; i < n; i++ ) {
+            if( narc[i] > 0 && mply_circle_dist( &caps[i], &v ) < dmin )
+                dmin = mply_circle_dist( &caps[i], &v );
+        }
+        if( dmin > best ) {
+            best = dmin;
+            s = v;
+        }
+    }
+
+    /* e3 = -s is the north pole of the frame */
+    pole.x[0] = e3.x[0] = -s.x[0];
+    pole.x[1] = e3.x[1] = -s.x[1];
+    pole.x[2] = e3.x[2] = -s.x[2];
+    pole.m = 1.0;
+    mply_circle( &pole, &frame );
+    e1 = frame.u;
+    e2 = frame.w;
+
+    for( i = 0; i < n; i++ ) {
+        double sign = caps[i].m >= 0.0 ? 1.0 : -1.0;
+        for( k = 0; k < narc[i]; k++ ) {
+            double t0 = arc[2 * n * i + 2 * k], t1 = arc[2 * n * i + 2 * k + 1];
+            int j, nseg = ( int ) ceil( ( t1 - t0 ) / 0.25 );
+            double h = ( t1 - t0 ) / nseg, sum = 0.0;
+
+            for( j = 0; j < nseg; j++ ) {
+                double mid = t0 + ( j + 0.5 ) * h;
+                for( q = 0; q < 8; q++ ) {
+                    double tq = mid + 0.5 * h * ( q < 4 ? -gx[q] : gx[q - 4] );
+                    double x, y, z, dx, dy;
+                    MANGLE_VEC v, dv;
+
+                    mply_circle_point( &caps[i], &cc[i], tq, &v, &dv );
+                    x = v.x[0] * e1.x[0] + v.x[1] * e1.x[1] + v.x[2] * e1.x[2];
+                    y = v.x[0] * e2.x[0] + v.x[1] * e2.x[1] + v.x[2] * e2.x[2];
+                    z = v.x[0] * e3.x[0] + v.x[1] * e3.x[1] + v.x[2] * e3.x[2];
+                    dx = dv.x[0] * e1.x[0] + dv.x[1] * e1.x[1] + dv.x[2] * e1.x[2];
+                    dy = dv.x[0] * e2.x[0] + dv.x[1] * e2.x[1] + dv.x[2] * e2.x[2];
+                    /* (1 - z) dphi = (x dy - y dx) / (1 + z) */
+                    sum += gw[q % 4] * ( x * dy - y * dx ) / ( 1.0 + z );
+                }
+            }
+            /* caps with m < 0 have the region outside: walk them backwards */
+            area += sign * 0.5 * h * sum;
+        }
+    }
+    if( mply_within_caps( caps, n, &s ) )
+        area += 4.0 * PI;
+
+    return area;
+}
+
+/* Area (steradians) of the intersection of caps[0..n), which should have
+ * been pruned (see mply_caps_prune()).  By Stokes' theorem this is an
+ * integral around the boundary, so it needs no triangulation. */
+double
+mply_caps_area( MANGLE_CAP const *const caps, const MANGLE_INT n )
+{
+    MANGLE_CIRCLE *cc;
+    MANGLE_INT i, *narc, nboundary = 0;
+    double *arc, *t, area;
+
+    if( n < 1 )
+        return 4.0 * PI;
+
+    cc = ( MANGLE_CIRCLE * ) check_alloc( n, sizeof( MANGLE_CIRCLE ) );
+    narc = ( MANGLE_INT * ) check_alloc( n, sizeof( MANGLE_INT ) );
+    arc = ( double * ) check_alloc( 2 * n * 2 * n, sizeof( double ) );
+    t = ( double * ) check_alloc( 2 * n, sizeof( double ) );
+
+    for( i = 0; i < n; i++ ) {
+        narc[i] = mply_circle( &caps[i], &cc[i] ) ?
+            mply_caps_arcs( caps, n, i, &cc[i], &arc[2 * n * i], t ) : 0;
+        nboundary += narc[i];
+    }
+
+    if( nboundary > 0 ) {
+        area = mply_caps_area_arcs( caps, n, cc, narc, arc );
+    } else {
+        /* no boundary: all of the sphere, or nothing */
+        MANGLE_VEC z = { {0.0, 0.0, 1.0} };
+        area = mply_within_caps( caps, n, &z ) ? 4.0 * PI : 0.0;
+    }
+
+    CHECK_FREE( cc );
+    CHECK_FREE( narc );
+    CHECK_FREE( arc );
+    CHECK_FREE( t );
+    return area;
+}
+
+/* pixel INDEX ipix at resolution res, as pixels at resolution to (nested) */
+static void
+mply_pix_rescale( const MANGLE_INT ipix, const int res, const int to, MANGLE_INT * const first,
+                  MANGLE_INT * const nside )
+{
+    MANGLE_INT p = mply_pow2i( res ), row = ipix / p, col = ipix % p;
+
+    if( to <= res ) {
+        int d = res - to;
+        *first = ( row >> d ) * mply_pow2i( to ) + ( col >> d );
+        *nside = 1;
+    } else {
+        int d = to - res;
+        *nside = mply_pow2i( d );
+        *first = ( row << d ) * mply_pow2i( to ) + ( col << d );
+    }
+}
+
+/* candidate polygons of b for polygon ia of a, as sorted INDEX values */
+static MANGLE_INT
+mply_intersect_candidates( MANGLE_PLY const *const a, const MANGLE_INT ia,
+                           MANGLE_PLY const *const b, MANGLE_INT ** list,
+                           MANGLE_INT * const nalloc )
+{
+    MANGLE_INT n = 0, first, nside, r, c;
+
+    if( a->pix_res < 1 || b->pix_res < 1 ) {
+        MANGLE_HOT const *h = &( a->hot[ia] );
+        mply_find_polys_in_caps_append( b, &( a->cap[h->icap] ), h->ncap, list, &n, nalloc );
+        return mply_index_sort_unique( *list, n );
+    }
+
+    mply_pix_rescale( mply_pix_index_from_id( a, a->poly[ia].pixel ), a->pix_res, b->pix_res,
+                      &first, &nside );
+    for( r = 0; r < nside; r++ ) {
+        for( c = 0; c < nside; c++ ) {
+            DATA_LIST *dl = &( b->pix[first + r * mply_pow2i( b->pix_res ) + c] );
+            while( dl != NULL && dl->data != NULL ) {
+                mply_index_push( list, &n, nalloc,
+                                 ( MANGLE_INT ) ( ( MANGLE_POLY * ) dl->data - b->poly ) );
+                dl = ( DATA_LIST * ) dl->next;
+            }
+        }
+    }
+    return nside > 1 ? mply_index_sort_unique( *list, n ) : n;
+}
+
+/* The intersection of masks a and b, combining weights by rule.  If pair
+ * is not NULL, it is set to a new array (free() it) with the INDEX in a
+ * and in b of each polygon in the result. */
+MANGLE_PLY *
+mply_intersect( MANGLE_PLY const *const a, MANGLE_PLY const *const b, const int rule,
+                MANGLE_INT ** pair )
+{
+    MANGLE_PLY *ply;
+    MANGLE_INT ia, k, *cand = NULL, ncand_alloc = 0;
+    MANGLE_INT *from = NULL, n = 0, nalloc = 0;
+    MANGLE_CAP *caps = NULL;
+    MANGLE_INT ncaps_alloc = 0;
+    int res = a->pix_res > b->pix_res ? a->pix_res : b->pix_res;
+
+    ply = mply_init( 0 );
+    for( ia = 0; ia < a->npoly; ia++ ) {
+        MANGLE_HOT const *ha = &( a->hot[ia] );
+        MANGLE_INT ncand = mply_intersect_candidates( a, ia, b, &cand, &ncand_alloc );
+
+        for( k = 0; k < ncand; k++ ) {
+            MANGLE_INT ib = cand[k], ncap;
+            MANGLE_HOT const *hb = &( b->hot[ib] );
+            MANGLE_POLY const *pa = &( a->poly[ia] ), *pb = &( b->poly[ib] );
+            MANGLE_POLY *p;
+            double weight;
+
+            if( !mply_caps_intersect( &( a->cap[ha->icap] ), ha->ncap, &( b->cap[hb->icap] ),
+                                      hb->ncap ) )
+                continue;
+
+            ncap = ha->ncap + hb->ncap;
+            if( ncap > ncaps_alloc ) {
+                ncaps_alloc = 2 * ncap;
+                caps = ( MANGLE_CAP * ) check_realloc( caps, ncaps_alloc, sizeof( MANGLE_CAP ) );
+            }
+            memcpy( caps, &( a->cap[ha->icap] ), ha->ncap * sizeof( MANGLE_CAP ) );
+            memcpy( &caps[ha->ncap], &( b->cap[hb->icap] ), hb->ncap * sizeof( MANGLE_CAP ) );
+            ncap = mply_caps_prune( caps, ncap );
+
+            if( MPLY_INTERSECT_MIN == rule )
+                weight = pa->weight < pb->weight ? pa->weight : pb->weight;
+            else
+                weight = pa->weight * pb->weight;
+
+            if( n == nalloc ) {
+                nalloc = nalloc > 0 ? 2 * nalloc : 1024;
+                ply->poly = ( MANGLE_POLY * ) check_realloc( ply->poly, nalloc,
+                                                             sizeof( MANGLE_POLY ) );
+                ply->hot = ( MANGLE_HOT * ) check_realloc( ply->hot, nalloc,
+                                                           sizeof( MANGLE_HOT ) );
+                from = ( MANGLE_INT * ) check_realloc( from, 2 * nalloc, sizeof( MANGLE_INT ) );
+            }
+            /* the finer pixelization decides the pixel */
+            p = mply_poly_alloc( ply, n, n, ncap, weight,
+                                 a->pix_res >= b->pix_res ? pa->pixel : pb->pixel,
+                                 mply_caps_area( caps, ncap ) );
+            memcpy( p->cap, caps, ncap * sizeof( MANGLE_CAP ) );
+            from[2 * n] = ia;
+            from[2 * n + 1] = ib;
+            n += 1;
+            ply->npoly = n;
+        }
+    }
+    CHECK_FREE( cand );
+    CHECK_FREE( caps );
+
+    mply_cap_shrink( ply );
+    if( res > 0 ) {
+        mply_pix_alloc( ply, res );
+        mply_pix_build( ply );
+    }
+
+    if( NULL != pair )
+        *pair = from;
+    else
+        CHECK_FREE( from );
+    return ply;
+}
+
+#endif
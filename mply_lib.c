@@ -0,0 +1,37 @@
+/* shared library build of the C functions
+ *
+ * The usual way to use this code is to include it, but bindings and other
+ * languages need a library.  Compiled with NO_INLINE, this one translation
+ * unit exports every mply_ function as a real symbol (examples/Makefile:
+ * make lib):
+ *
+ *   % gcc -O3 -D_DEFAULT_SOURCE -DNO_INLINE -fPIC -shared -I. mply_lib.c \
+ *         -o libmply.so -lm
+ *
+ * The entry points for bulk work take caller-owned contiguous arrays and
+ * never copy them:
+ *
+ *   mply_find_polyindex_radec_batch()   n ra, n dec (degrees) -> n INDEX
+ *   mply_find_polyindex_polar_batch()   n az, n el (radians)  -> n INDEX
+ *   mply_find_polyindex_xyz_batch()     n MANGLE_VEC (3 doubles each)
+ *   mply_polyid_from_index_batch(), mply_weight_from_index_batch(),
+ *   mply_area_from_index_batch()        n INDEX -> n values
+ *
+ * A MANGLE_PLY is read with mply_read_file() and freed with mply_kill().
+ * Lookups only read the mask, so several threads can share one.  The
+ * width of MANGLE_INT depends on MANGLE_INT64: callers can check it with
+ * mply_lib_int_size().  See python/ for the Python module built on these.
+ */
+#ifndef MPLY_LIB_INCLUDED
+#define MPLY_LIB_INCLUDED
+
+#include <minimal_mangle.c>
+
+/* sizeof( MANGLE_INT ) in this build */
+int
+mply_lib_int_size( void )
+{
+    return ( int ) sizeof( MANGLE_INT );
+}
+
+#endif
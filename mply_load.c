@@ -0,0 +1,414 @@
+/* parallel loading of large polygon files
+ *
+ * mply_read_file_into() parses line by line on one core, and appends each
+ * polygon to the end of its pixel list as it goes.  mply_load_file_into()
+ * builds the same MANGLE_PLY (same INDEX order, caps and pixel list order)
+ * in steps that run in parallel:
+ *
+ *   1. read the whole file into memory and parse the header
+ *   2. cut the body into chunks that start on a "polygon" line
+ *   3. per chunk, count the lines, polygons and caps
+ *   4. prefix sums give each chunk its first INDEX, cap and line number,
+ *      so the chunks are parsed straight into arrays sized once from the
+ *      header count and the cap total
+ *   5. build the pixel index with a counting sort by pixel
+ *      (mply_pix_build())
+ *
+ * Steps 3-5 use threads when compiled with OpenMP (e.g. gcc -fopenmp).
+ * Otherwise they run one after another, which is still faster than the
+ * line reader for pixelized masks.  The file text stays in memory until
+ * the parse is done.
+ */
+#pragma once
+#ifndef MPLY_LOAD_INCLUDED
+#define MPLY_LOAD_INCLUDED
+
+#include <sys/types.h>
+
+#include <minimal_mangle.c>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifndef MPLY_LOAD_CHUNKS
+#define MPLY_LOAD_CHUNKS 8      /* chunks per thread, to even out the load */
+#endif
+#define MPLY_LOAD_CHUNK_MIN ( ( size_t ) 1 << 16 )      /* bytes */
+
+typedef struct {
+    char *start;                /* [start, end): whole lines, from a polygon line */
+    char *end;
+    size_t nline;
+    long long npoly;
+    long long ncap;
+    size_t line0;               /* line number before start */
+    MANGLE_INT ipoly0;
+    MANGLE_INT icap0;
+} MANGLE_LOAD_CHUNK;
+
+/* Fill the (empty) pixel lists of ply with all its polygons.  Each list is
+ * in INDEX order, as mply_pix_addpoly() in file order would leave it, but
+ * built with a counting sort by pixel instead of walking the lists: the
+ * pixel of each polygon and the list links are done in parallel. */
+void
+mply_pix_build( MANGLE_PLY * const ply )
+{
+    size_t npix, *count;
+    MANGLE_INT *ipix, *order;
+    MANGLE_INT i;
+    size_t k;
+
+    if( ply->pix_res < 1 ) {
+        fprintf( stderr,
+                 "MANGLE Error: Tried to add pixel without proper PIXEL initialization!\n" );
+        exit( EXIT_FAILURE );
+    }
+    npix = mply_pix_count( ply->pix_res );
+    ipix = ( MANGLE_INT * ) check_alloc( ply->npoly, sizeof( MANGLE_INT ) );
+    order = ( MANGLE_INT * ) check_alloc( ply->npoly, sizeof( MANGLE_INT ) );
+    count = ( size_t * ) check_alloc( npix + 1, sizeof( size_t ) );
+
+    /* count[k + 1] = polygons in pixel k */
+#ifdef _OPENMP
+#pragma omp parallel for schedule( static )
+#endif
+    for( i = 0; i < ply->npoly; i++ ) {
+        ipix[i] = mply_pix_index_from_id( ply, ply->poly[i].pixel );
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+        count[ipix[i] + 1] += 1;
+    }
+
+    /* count[k] = start of pixel k in order[] */
+    for( k = 0; k < npix; k++ )
+        count[k + 1] += count[k];
+
+    /* scatter in INDEX order, so each bucket stays sorted (one pass of
+     * stores: cheap next to the parse, so it is left serial) */
+    for( i = 0; i < ply->npoly; i++ )
+        order[count[ipix[i]]++] = i;
+
+    /* count[k] is now the end of pixel k: link the lists */
+#ifdef _OPENMP
+#pragma omp parallel for schedule( dynamic, 1024 )
+#endif
+    for( k = 0; k < npix; k++ ) {
+        size_t j, j0 = k > 0 ? count[k - 1] : 0, j1 = count[k];
+        DATA_LIST *dl = &( ply->pix[k] );
+
+        for( j = j0; j < j1; j++ ) {
+            if( j > j0 ) {
+                dl->next = ( void * ) check_alloc( 1, sizeof( DATA_LIST ) );
+                dl = ( DATA_LIST * ) dl->next;
+            }
+            dl->data = ( void * ) &( ply->poly[order[j]] );
+            dl->next = NULL;
+        }
+    }
+
+    CHECK_FREE( ipix );
+    CHECK_FREE( order );
+    CHECK_FREE( count );
+}
+
+/* the whole file, NUL terminated (free() the result) */
+static char *
+mply_load_text( char const *const filename, size_t *const len )
+{
+    FILE *fp = check_fopen( filename, "r" );
+    off_t size;
+    char *buf;
+
+    if( fseeko( fp, 0, SEEK_END ) != 0 || ( size = ftello( fp ) ) < 0
+        || fseeko( fp, 0, SEEK_SET ) != 0 ) {
+        fprintf( stderr, "MANGLE Error: cannot find the size of file: %s\n", filename );
+        exit( EXIT_FAILURE );
+    }
+
+    buf = ( char * ) check_alloc( ( size_t ) size + 1, sizeof( char ) );
+    if( fread( buf, 1, ( size_t ) size, fp ) != ( size_t ) size ) {
+        fprintf( stderr, "MANGLE Error: short read of file: %s\n", filename );
+        exit( EXIT_FAILURE );
+    }
+    buf[size] = '\0';
+    fclose( fp );
+
+    *len = ( size_t ) size;
+    return buf;
+}
+
+/* NUL terminate the line at p (as simple_reader does), return the next */
+INLINE char *
+mply_load_line( char *const p, char *const end )
+{
+    char *e = ( char * ) memchr( p, '\n', end - p );
+    if( NULL == e )
+        return end;
+    *e = '\0';
+    return e + 1;
+}
+
+/* parse a "polygon" line, as in mply_read_poly() */
+INLINE int
+mply_load_poly_head( char const *const line, long long *const polyid, long long *const ncap,
+                     double *const weight, long long *const pixel, double *const area )
+{
+    int check = sscanf( line, "polygon %lld ( %lld caps, %lf weight, %lld pixel, %lf",
+                        polyid, ncap, weight, pixel, area );
+    return check == 5 && *ncap >= 1;
+}
+
+/* just the cap count of a "polygon" line (0 if it does not parse) */
+INLINE long long
+mply_load_poly_ncap( char const *const line )
+{
+    char *e;
+    long long ncap;
+
+    strtoll( line + 7, &e, 10 );
+    while( ' ' == *e || '\t' == *e )
+        e += 1;
+    if( '(' != *e )
+        return 0;
+    ncap = strtoll( e + 1, &e, 10 );
+    return ncap > 0 ? ncap : 0;
+}
+
+/* step 3: count one chunk, NUL terminating its lines */
+static void
+mply_load_count( MANGLE_LOAD_CHUNK * const c )
+{
+    char *p = c->start, *line;
+
+    while( p < c->end ) {
+        line = p;
+        p = mply_load_line( p, c->end );
+        c->nline += 1;
+        if( strncmp( "polygon", line, 7 ) != 0 )
+            continue;
+        c->npoly += 1;
+        /* a bad line is reported with its line number by the parse */
+        c->ncap += mply_load_poly_ncap( line );
+    }
+}
+
+/* step 4: parse one chunk into its slots */
+static void
+mply_load_parse( MANGLE_PLY * const ply, MANGLE_LOAD_CHUNK const *const c,
+                 char const *const filename )
+{
+    char *p = c->start, *line;
+    size_t linenum = c->line0;
+    MANGLE_INT ipoly = c->ipoly0, icap = c->icap0;
+
+    while( p < c->end ) {
+        long long polyid, ncap, pixel, i;
+        double weight, area;
+        MANGLE_POLY *poly;
+        MANGLE_HOT *h;
+
+        line = p;
+        p += strlen( p ) + 1;
+        linenum += 1;
+        if( strncmp( "polygon", line, 7 ) != 0 )
+            continue;
+
+        if( !mply_load_poly_head( line, &polyid, &ncap, &weight, &pixel, &area ) ) {
+            fprintf( stderr, "MANGLE Error: polygon read error line %zu in file: %s\n",
+                     linenum, filename );
+            exit( EXIT_FAILURE );
+        }
+        if( !mply_int_fits( polyid ) || !mply_int_fits( ncap ) || !mply_int_fits( pixel ) ) {
+            fprintf( stderr,
+                     "MANGLE Error: polygon values overflow MANGLE_INT line %zu in file: %s\n",
+                     linenum, filename );
+            exit( EXIT_FAILURE );
+        }
+
+        /* as mply_poly_alloc(), with the caps already reserved */
+        poly = &( ply->poly[ipoly] );
+        h = &( ply->hot[ipoly] );
+        h->icap = icap;
+        h->ncap = ( MANGLE_INT ) ncap;
+        poly->ipoly = ipoly;
+        poly->polyid = ( MANGLE_INT ) polyid;
+        poly->cap = &( ply->cap[icap] );
+        poly->ncap = ( MANGLE_INT ) ncap;
+        poly->weight = weight;
+        poly->pixel = ( MANGLE_INT ) pixel;
+        poly->area = area;
+
+        for( i = 0; i < ncap; i++ ) {
+            MANGLE_CAP *cap = &( ply->cap[icap + i] );
+            char *s, *e = NULL;
+            int k;
+
+            if( p >= c->end ) {
+                fprintf( stderr, "MANGLE Error: cap read error on line %zu in file: %s\n",
+                         linenum, filename );
+                exit( EXIT_FAILURE );
+            }
+            s = p;
+            p += strlen( p ) + 1;
+            linenum += 1;
+
+            /* strtod() is what "%lf" uses: the same values as sscanf() */
+            for( k = 0; k < 4; k++, s = e ) {
+                double x = strtod( s, &e );
+                if( e == s ) {
+                    fprintf( stderr,
+                             "MANGLE Error: cap read error on line %zu in file: %s\n",
+                             linenum, filename );
+                    exit( EXIT_FAILURE );
+                }
+                if( k < 3 )
+                    cap->x[k] = x;
+                else
+                    cap->m = x;
+            }
+        }
+
+        ipoly += 1;
+        icap += ( MANGLE_INT ) ncap;
+    }
+
+    /* the later chunks start where the counts said this one would end */
+    if( ipoly - c->ipoly0 != c->npoly || icap - c->icap0 != c->ncap ) {
+        fprintf( stderr, "MANGLE Error: polygon count mismatch before line %zu in file: %s\n",
+                 linenum, filename );
+        exit( EXIT_FAILURE );
+    }
+}
+
+void
+mply_load_file_into( MANGLE_PLY * const ply, char const *const filename )
+{
+    MANGLE_LOAD_CHUNK *chunk;
+    char *buf, *p, *body, *end;
+    size_t len, linenum = 0, nchunk, k;
+    long long npoly = 0, npoly_read = 0, ncap = 0;
+    int nthread = 1;
+
+    mply_clean( ply );
+
+    buf = mply_load_text( filename, &len );
+    end = buf + len;
+
+    /* step 1: the header, parsed as mply_read_file_into() does */
+    p = mply_load_line( buf, end );
+    linenum += 1;
+    if( sscanf( buf, "%lld polygons", &npoly ) != 1 || npoly < 1 ) {
+        fprintf( stderr, "MANGLE Error: polygons (%lld) must be positive in file: %s\n",
+                 npoly, filename );
+        exit( EXIT_FAILURE );
+    }
+    if( !mply_int_fits( npoly ) ) {
+        fprintf( stderr, "MANGLE Error: polygons (%lld) too many for MANGLE_INT in file: %s\n",
+                 npoly, filename );
+        exit( EXIT_FAILURE );
+    }
+
+    mply_alloc( ply, ( MANGLE_INT ) npoly );
+
+    body = end;
+    while( p < end ) {
+        char *line = p;
+        int res;
+
+        if( strncmp( "polygon", line, 7 ) == 0 ) {
+            body = line;        /* left unterminated, for the chunks */
+            break;
+        }
+        p = mply_load_line( p, end );
+        linenum += 1;
+
+        if( strncmp( "pixelization", line, 12 ) == 0 ) {
+            if( sscanf( line, "pixelization %ds", &res ) != 1 ) {
+                fprintf( stderr,
+                         "MANGLE Warning: Only simple pixel scheme is currently supported: %s\n",
+                         filename );
+                continue;
+            }
+            mply_pix_alloc( ply, res );
+        }
+    }
+
+    /* step 2: chunk boundaries, each moved on to the next polygon line */
+#ifdef _OPENMP
+    nthread = omp_get_max_threads(  );
+#endif
+    nchunk = ( size_t ) nthread * MPLY_LOAD_CHUNKS;
+    if( nchunk > ( size_t ) ( end - body ) / MPLY_LOAD_CHUNK_MIN + 1 )
+        nchunk = ( size_t ) ( end - body ) / MPLY_LOAD_CHUNK_MIN + 1;
+    chunk = ( MANGLE_LOAD_CHUNK * ) check_alloc( nchunk, sizeof( MANGLE_LOAD_CHUNK ) );
+    for( k = 0; k < nchunk; k++ ) {
+        char *b = body + ( size_t ) ( end - body ) / nchunk * k;
+        if( k > 0 && b < chunk[k - 1].start )
+            b = chunk[k - 1].start;
+        if( k > 0 && b > body ) {
+            b = strstr( b - 1, "\npolygon" );
+            b = NULL == b ? end : b + 1;
+        }
+        chunk[k].start = b;
+        if( k > 0 )
+            chunk[k - 1].end = b;
+    }
+    chunk[nchunk - 1].end = end;
+
+    /* step 3 */
+#ifdef _OPENMP
+#pragma omp parallel for schedule( dynamic, 1 )
+#endif
+    for( k = 0; k < nchunk; k++ )
+        mply_load_count( &chunk[k] );
+
+    for( k = 0; k < nchunk; k++ ) {
+        chunk[k].line0 = linenum;
+        chunk[k].ipoly0 = ( MANGLE_INT ) ( npoly_read < npoly ? npoly_read : 0 );
+        chunk[k].icap0 = ( MANGLE_INT ) ( ncap <= MANGLE_INT_MAX ? ncap : 0 );
+        linenum += chunk[k].nline;
+        npoly_read += chunk[k].npoly;
+        ncap += chunk[k].ncap;
+    }
+    if( npoly_read != npoly ) {
+        fprintf( stderr, "MANGLE Error: bad number of polygons read! Expected %lld, read %lld\n",
+                 npoly, npoly_read );
+        exit( EXIT_FAILURE );
+    }
+    if( ncap > MANGLE_INT_MAX ) {
+        fprintf( stderr, "MANGLE Error: too many caps (%lld), see MANGLE_INT64\n", ncap );
+        exit( EXIT_FAILURE );
+    }
+    ply->cap = ( MANGLE_CAP * ) check_alloc( ( size_t ) ncap, sizeof( MANGLE_CAP ) );
+    ply->ncap = ( MANGLE_INT ) ncap;
+    ply->ncap_alloc = ( MANGLE_INT ) ncap;
+
+    /* step 4 */
+#ifdef _OPENMP
+#pragma omp parallel for schedule( dynamic, 1 )
+#endif
+    for( k = 0; k < nchunk; k++ )
+        mply_load_parse( ply, &chunk[k], filename );
+
+    CHECK_FREE( chunk );
+    CHECK_FREE( buf );
+
+    /* step 5 */
+    if( ply->pix_res > 0 )
+        mply_pix_build( ply );
+
+    mply_cap_link( ply );
+}
+
+MANGLE_PLY *
+mply_load_file( char const *const filename )
+{
+    MANGLE_PLY *ply;
+    ply = mply_init( 0 );
+    mply_load_file_into( ply, filename );
+    return ply;
+}
+
+#endif
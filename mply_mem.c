@@ -0,0 +1,182 @@
+/* memory placement for large, read-only masks
+ *
+ * A mask of several GB is mostly cap and pixel-index data that every
+ * lookup walks.  Allocated the usual way it lands on 4 KB pages, on the
+ * NUMA node of whichever thread read the file.  After loading,
+ * mply_mem_place() can move the arrays the lookups touch:
+ *
+ *   MPLY_MEM_HUGE        2 MB aligned, with transparent huge pages requested
+ *   MPLY_MEM_INTERLEAVE  pages spread over all allowed NUMA nodes
+ *   MPLY_MEM_PIN         (for the tools) pin worker threads to CPUs
+ *
+ * Moved arrays come from posix_memalign(), so they are still released by
+ * mply_clean() with free().  That rules out explicit MAP_HUGETLB pages;
+ * transparent huge pages (madvise) are used instead.  The MANGLE_POLY
+ * metadata and the pixel list overflow entries are left where they are:
+ * the pixel lists point into the first, and each of the second is freed
+ * on its own.
+ *
+ * Everything is best effort: mply_mem_place() returns the policies that
+ * were applied, and does nothing for arrays under MPLY_MEM_MIN bytes.  The
+ * NUMA calls are made directly (no libnuma), and only on Linux.
+ */
+#pragma once
+#ifndef MPLY_MEM_INCLUDED
+#define MPLY_MEM_INCLUDED
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include <minimal_mangle.c>
+
+enum {
+    MPLY_MEM_HUGE = 1,
+    MPLY_MEM_INTERLEAVE = 2,
+    MPLY_MEM_PIN = 4
+};
+
+#ifndef MPLY_MEM_ALIGN
+#define MPLY_MEM_ALIGN ( ( size_t ) 2 << 20 )   /* x86-64 huge page */
+#endif
+#ifndef MPLY_MEM_MIN
+#define MPLY_MEM_MIN MPLY_MEM_ALIGN
+#endif
+
+#define MPLY_MEM_MAXNODE 1024
+#define MPLY_MEM_MAXCPU 1024
+
+/* parse a list like "huge,interleave,pin" (e.g. from $MANGLE_MEM) */
+int
+mply_mem_policy( char const *s )
+{
+    int policy = 0;
+
+    while( NULL != s && '\0' != *s ) {
+        size_t len = strcspn( s, ", " );
+        if( len == 4 && strncmp( s, "huge", 4 ) == 0 )
+            policy |= MPLY_MEM_HUGE;
+        else if( len == 10 && strncmp( s, "interleave", 10 ) == 0 )
+            policy |= MPLY_MEM_INTERLEAVE;
+        else if( len == 3 && strncmp( s, "pin", 3 ) == 0 )
+            policy |= MPLY_MEM_PIN;
+        else if( len > 0 )
+            fprintf( stderr, "WARNING: unknown memory policy '%.*s'\n", ( int ) len, s );
+        s += len;
+        s += strspn( s, ", " );
+    }
+
+    return policy;
+}
+
+/* interleave [p, p + len) over the allowed nodes, before it is touched */
+static int
+mply_mem_interleave( void *const p, const size_t len )
+{
+#if defined( __linux__ ) && defined( SYS_mbind ) && defined( SYS_get_mempolicy )
+    unsigned long mask[MPLY_MEM_MAXNODE / ( 8 * sizeof( unsigned long ) )];
+    size_t i;
+    int nnode = 0;
+
+    /* MPOL_F_MEMS_ALLOWED = 4, MPOL_INTERLEAVE = 3 */
+    memset( mask, 0, sizeof( mask ) );
+    if( syscall( SYS_get_mempolicy, NULL, mask, MPLY_MEM_MAXNODE, NULL, 4 ) != 0 )
+        return FALSE;
+    for( i = 0; i < sizeof( mask ) / sizeof( mask[0] ); i++ ) {
+        unsigned long m;
+        for( m = mask[i]; m != 0; m &= m - 1 )
+            nnode += 1;
+    }
+    if( nnode < 2 )
+        return FALSE;
+    return syscall( SYS_mbind, p, len, 3, mask, MPLY_MEM_MAXNODE + 1, 0 ) == 0;
+#else
+    ( void ) p;
+    ( void ) len;
+    return FALSE;
+#endif
+}
+
+/* copy nbytes of *data into fresh memory with the policy applied */
+static void *
+mply_mem_move( void *data, const size_t nbytes, const int policy, int *const applied )
+{
+    void *p = NULL;
+    size_t len;
+
+    if( NULL == data || nbytes < MPLY_MEM_MIN )
+        return data;
+
+    len = ( nbytes + MPLY_MEM_ALIGN - 1 ) / MPLY_MEM_ALIGN * MPLY_MEM_ALIGN;
+    if( posix_memalign( &p, MPLY_MEM_ALIGN, len ) != 0 )
+        return data;            /* keep what we have */
+
+#ifdef MADV_HUGEPAGE
+    if( ( policy & MPLY_MEM_HUGE ) && madvise( p, len, MADV_HUGEPAGE ) == 0 )
+        *applied |= MPLY_MEM_HUGE;
+#endif
+    if( ( policy & MPLY_MEM_INTERLEAVE ) && mply_mem_interleave( p, len ) )
+        *applied |= MPLY_MEM_INTERLEAVE;
+
+    /* first touch happens here, after the policy is set */
+    memcpy( p, data, nbytes );
+    free( data );
+    return p;
+}
+
+/* Move the lookup arrays of a loaded mask (caps, hot data, pixel heads).
+ * Returns the policies that took effect on at least one array. */
+int
+mply_mem_place( MANGLE_PLY * const ply, const int policy )
+{
+    int applied = 0;
+
+    if( 0 == ( policy & ( MPLY_MEM_HUGE | MPLY_MEM_INTERLEAVE ) ) )
+        return 0;
+
+    ply->cap = ( MANGLE_CAP * ) mply_mem_move( ply->cap, ply->ncap_alloc * sizeof( MANGLE_CAP ),
+                                               policy, &applied );
+    mply_cap_link( ply );
+#ifdef MANGLE_FLOAT_CAPS
+    ply->capf = ( MANGLE_CAPF * ) mply_mem_move( ply->capf, ply->ncap * sizeof( MANGLE_CAPF ),
+                                                 policy, &applied );
+#endif
+    ply->hot = ( MANGLE_HOT * ) mply_mem_move( ply->hot, ply->npoly * sizeof( MANGLE_HOT ),
+                                               policy, &applied );
+    if( ply->pix_res > 0 ) {
+        /* nothing points into the head array, so it can move */
+        ply->pix = ( DATA_LIST * ) mply_mem_move( ply->pix,
+                                                  mply_pix_count( ply->pix_res ) *
+                                                  sizeof( DATA_LIST ), policy, &applied );
+    }
+
+    return applied;
+}
+
+/* pin the calling thread to one CPU (taken modulo the number online) */
+int
+mply_mem_pin( const int cpu )
+{
+#if defined( __linux__ ) && defined( SYS_sched_setaffinity )
+    unsigned long mask[MPLY_MEM_MAXCPU / ( 8 * sizeof( unsigned long ) )];
+    long ncpu = sysconf( _SC_NPROCESSORS_ONLN );
+    int c;
+
+    if( ncpu < 1 )
+        return FALSE;
+    c = ( int ) ( cpu % ncpu );
+    if( c >= MPLY_MEM_MAXCPU )
+        return FALSE;
+    memset( mask, 0, sizeof( mask ) );
+    mask[c / ( 8 * sizeof( unsigned long ) )] = 1UL << ( c % ( 8 * sizeof( unsigned long ) ) );
+    return syscall( SYS_sched_setaffinity, 0, sizeof( mask ), mask ) == 0;
+#else
+    ( void ) cpu;
+    return FALSE;
+#endif
+}
+
+#endif
@@ -0,0 +1,492 @@
+/* footprint-restricted partial loading of large masks
+ *
+ * A full-sky mask can be gigabytes of text, while a job working on one
+ * survey tile only needs the polygons there.  mply_pidx_write() scans a
+ * pixelized polygon file once and writes a small binary sidecar index
+ * (FILE.pidx by default) with the byte offset of every polygon, sorted by
+ * pixel.  The loaders below work out which pixels a region touches, look
+ * those up in the index (mapped, and walked once in pixel order), and
+ * read the matching polygons in file order, seeking only over the gaps:
+ * nothing else in the polygon file is read or allocated.
+ *
+ * The result is an ordinary (smaller) MANGLE_PLY.  Polygons keep their
+ * polyid, weight and pixel, and INDEX runs over the loaded polygons only,
+ * in file order.  Points outside the loaded pixels are simply not found,
+ * so queries should stay inside the requested region.
+ *
+ * The index is in native byte order, and records the size, modification
+ * time and inode of the polygon file it was made from, so an out-of-date
+ * index is caught on load.  A copied or rewritten polygon file (even with
+ * the same contents) needs its index made again.
+ */
+#pragma once
+#ifndef MPLY_PARTIAL_INCLUDED
+#define MPLY_PARTIAL_INCLUDED
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <minimal_mangle.c>
+#include <mply_region.c>
+
+#define MPLY_PIDX_MAGIC "MPLYPIDX"
+#define MPLY_PIDX_VERSION 2
+
+#ifndef MPLY_PIDX_BUFSIZE
+#define MPLY_PIDX_BUFSIZE ( 1 << 16 )   /* polygon file buffer: seeks inside it do not read */
+#endif
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    int32_t pix_res;
+    uint64_t npoly;
+    /* of the polygon file, to catch a stale index */
+    uint64_t file_size;
+    int64_t file_mtime;
+    uint64_t file_ino;
+} MANGLE_PIDX_HEAD;
+
+typedef struct {
+    int64_t ipix;               /* pixel INDEX, not ID */
+    uint64_t offset;            /* of the "polygon" line in the polygon file */
+} MANGLE_PIDX_ENTRY;
+
+/* an open index, mapped read-only */
+typedef struct {
+    MANGLE_PIDX_HEAD head;
+    MANGLE_PIDX_ENTRY const *entry;     /* head.npoly of them, sorted by pixel */
+    void *map;
+    size_t map_len;
+} MANGLE_PIDX;
+
+/* default sidecar name: FILE.pidx (free() the result) */
+char *
+mply_pidx_name( char const *const filename )
+{
+    size_t len = strlen( filename );
+    char *name = ( char * ) check_alloc( len + 6, sizeof( char ) );
+    memcpy( name, filename, len );
+    memcpy( &name[len], ".pidx", 6 );
+    return name;
+}
+
+/* fill in the polygon file fields of head, from the open file */
+static void
+mply_pidx_stamp( FILE * fp, char const *const filename, MANGLE_PIDX_HEAD * const head )
+{
+    struct stat st;
+    if( fstat( fileno( fp ), &st ) != 0 ) {
+        fprintf( stderr, "MANGLE Error: cannot stat file: %s\n", filename );
+        exit( EXIT_FAILURE );
+    }
+    head->file_size = ( uint64_t ) st.st_size;
+    head->file_mtime = ( int64_t ) st.st_mtime;
+    head->file_ino = ( uint64_t ) st.st_ino;
+}
+
+static int
+mply_pidx_cmp( const void *a, const void *b )
+{
+    MANGLE_PIDX_ENTRY const *x = ( MANGLE_PIDX_ENTRY const * ) a;
+    MANGLE_PIDX_ENTRY const *y = ( MANGLE_PIDX_ENTRY const * ) b;
+    if( x->ipix != y->ipix )
+        return ( x->ipix > y->ipix ) - ( x->ipix < y->ipix );
+    return ( x->offset > y->offset ) - ( x->offset < y->offset );
+}
+
+static int
+mply_offset_cmp( const void *a, const void *b )
+{
+    uint64_t x = *( const uint64_t * ) a, y = *( const uint64_t * ) b;
+    return ( x > y ) - ( x < y );
+}
+
+/* Scan a pixelized polygon file and write its pixel index.  With
+ * pidx_filename NULL, the index goes to FILE.pidx.  Returns the number of
+ * polygons indexed. */
+MANGLE_INT
+mply_pidx_write( char const *const filename, char const *const pidx_filename )
+{
+    simple_reader *sr;
+    MANGLE_PLY res;             /* only pix_res is used */
+    MANGLE_PIDX_HEAD head;
+    MANGLE_PIDX_ENTRY *entry = NULL;
+    size_t n = 0, nalloc = 0;
+    char *name;
+    FILE *fp;
+    off_t off;
+
+    memset( &res, 0, sizeof( MANGLE_PLY ) );
+    memset( &head, 0, sizeof( MANGLE_PIDX_HEAD ) );
+
+    sr = sr_init( filename );
+    off = ftello( sr->fp );
+    while( sr_readline( sr ) ) {
+        char *line = sr_line( sr );
+
+        if( strncmp( "pixelization", line, 12 ) == 0 && 0 == n ) {
+            int pix_res;
+            if( sscanf( line, "pixelization %ds", &pix_res ) == 1 )
+                res.pix_res = pix_res;
+        } else if( strncmp( "polygon", line, 7 ) == 0 ) {
+            long long polyid, ncap, pixel;
+            double weight;
+
+            if( res.pix_res < 1 ) {
+                fprintf( stderr,
+                         "MANGLE Error: cannot index unpixelized polygon file: %s\n",
+                         sr_filename( sr ) );
+                exit( EXIT_FAILURE );
+            }
+            if( sscanf( line, "polygon %lld ( %lld caps, %lf weight, %lld pixel",
+                        &polyid, &ncap, &weight, &pixel ) != 4 || !mply_int_fits( pixel ) ) {
+                fprintf( stderr,
+                         "MANGLE Error: polygon read error line %zu in file: %s\n",
+                         sr_linenum( sr ), sr_filename( sr ) );
+                exit( EXIT_FAILURE );
+            }
+            if( n == nalloc ) {
+                nalloc = nalloc > 0 ? 2 * nalloc : 1024;
+                entry = ( MANGLE_PIDX_ENTRY * ) check_realloc( entry, nalloc,
+                                                               sizeof( MANGLE_PIDX_ENTRY ) );
+            }
+            entry[n].ipix = mply_pix_index_from_id( &res, ( MANGLE_INT ) pixel );
+            entry[n].offset = ( uint64_t ) off;
+            n += 1;
+        }
+        off = ftello( sr->fp );
+    }
+
+    if( !mply_int_fits( ( long long ) n ) ) {
+        fprintf( stderr, "MANGLE Error: too many polygons for MANGLE_INT in file: %s\n",
+                 sr_filename( sr ) );
+        exit( EXIT_FAILURE );
+    }
+
+    memcpy( head.magic, MPLY_PIDX_MAGIC, sizeof( head.magic ) );
+    head.version = MPLY_PIDX_VERSION;
+    head.pix_res = res.pix_res;
+    head.npoly = n;
+    mply_pidx_stamp( sr->fp, filename, &head );
+    sr = sr_kill( sr );
+
+    if( n > 0 )
+        qsort( entry, n, sizeof( MANGLE_PIDX_ENTRY ), mply_pidx_cmp );
+
+    name = pidx_filename != NULL ? ( char * ) pidx_filename : mply_pidx_name( filename );
+    fp = check_fopen( name, "wb" );
+    if( fwrite( &head, sizeof( head ), 1, fp ) != 1 ||
+        fwrite( entry, sizeof( MANGLE_PIDX_ENTRY ), n, fp ) != n || fclose( fp ) != 0 ) {
+        fprintf( stderr, "MANGLE Error: cannot write pixel index: %s\n", name );
+        exit( EXIT_FAILURE );
+    }
+    if( name != pidx_filename )
+        CHECK_FREE( name );
+    CHECK_FREE( entry );
+
+    return ( MANGLE_INT ) n;
+}
+
+/* map and check the index for filename */
+static void
+mply_pidx_open( MANGLE_PIDX * const idx, char const *const filename,
+                char const *const pidx_filename )
+{
+    MANGLE_PIDX_HEAD *head = &( idx->head ), now;
+    struct stat st;
+    char *name;
+    FILE *ply_fp;
+    int fd;
+
+    memset( idx, 0, sizeof( MANGLE_PIDX ) );
+    name = pidx_filename != NULL ? ( char * ) pidx_filename : mply_pidx_name( filename );
+    fd = open( name, O_RDONLY );
+    if( fd < 0 || fstat( fd, &st ) != 0 ) {
+        fprintf( stderr, "MANGLE Error: cannot open pixel index: %s\n", name );
+        exit( EXIT_FAILURE );
+    }
+    idx->map_len = ( size_t ) st.st_size;
+    if( idx->map_len >= sizeof( MANGLE_PIDX_HEAD ) )
+        idx->map = mmap( NULL, idx->map_len, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if( NULL == idx->map || MAP_FAILED == idx->map ) {
+        fprintf( stderr, "MANGLE Error: not a polygon pixel index: %s\n", name );
+        exit( EXIT_FAILURE );
+    }
+
+    memcpy( head, idx->map, sizeof( MANGLE_PIDX_HEAD ) );
+    if( memcmp( head->magic, MPLY_PIDX_MAGIC, sizeof( head->magic ) ) != 0 ) {
+        fprintf( stderr, "MANGLE Error: not a polygon pixel index: %s\n", name );
+        exit( EXIT_FAILURE );
+    }
+    if( head->version != MPLY_PIDX_VERSION ) {
+        fprintf( stderr, "MANGLE Error: pixel index %s is version %u, expected %d "
+                 "(make it again with mply_pidx)\n", name, ( unsigned ) head->version,
+                 MPLY_PIDX_VERSION );
+        exit( EXIT_FAILURE );
+    }
+    if( head->pix_res < 1 || head->pix_res > MANGLE_PIX_RES_MAX ||
+        !mply_int_fits( ( long long ) head->npoly ) ) {
+        fprintf( stderr, "MANGLE Error: pixel index does not fit MANGLE_INT: %s\n", name );
+        exit( EXIT_FAILURE );
+    }
+    if( idx->map_len !=
+        sizeof( MANGLE_PIDX_HEAD ) + ( size_t ) head->npoly * sizeof( MANGLE_PIDX_ENTRY ) ) {
+        fprintf( stderr, "MANGLE Error: pixel index has the wrong size: %s\n", name );
+        exit( EXIT_FAILURE );
+    }
+    idx->entry =
+        ( MANGLE_PIDX_ENTRY const * ) ( ( char const * ) idx->map + sizeof( MANGLE_PIDX_HEAD ) );
+
+    ply_fp = check_fopen( filename, "r" );
+    mply_pidx_stamp( ply_fp, filename, &now );
+    if( now.file_size != head->file_size || now.file_mtime != head->file_mtime ||
+        now.file_ino != head->file_ino ) {
+        fprintf( stderr, "MANGLE Error: pixel index %s is out of date for: %s "
+                 "(make it again with mply_pidx)\n", name, filename );
+        exit( EXIT_FAILURE );
+    }
+    fclose( ply_fp );
+
+    if( name != pidx_filename )
+        CHECK_FREE( name );
+}
+
+static void
+mply_pidx_close( MANGLE_PIDX * const idx )
+{
+    if( NULL != idx->map )
+        munmap( idx->map, idx->map_len );
+    memset( idx, 0, sizeof( MANGLE_PIDX ) );
+}
+
+/* first entry from lo on with ipix >= the given pixel */
+static uint64_t
+mply_pidx_lower_bound( MANGLE_PIDX const *const idx, uint64_t lo, const int64_t ipix )
+{
+    uint64_t hi = idx->head.npoly;
+    while( lo < hi ) {
+        uint64_t mid = lo + ( hi - lo ) / 2;
+        if( idx->entry[mid].ipix < ipix )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Load the polygons at the n given offsets (any order; offset is sorted
+ * and freed) into ply.  Returns the number of polygons loaded. */
+static MANGLE_INT
+mply_read_pidx_offsets( MANGLE_PLY * const ply, char const *const filename,
+                        MANGLE_PIDX_HEAD const *const head, uint64_t * offset, const size_t n )
+{
+    MANGLE_INT i;
+    uint64_t pos;
+    simple_reader *sr;
+    char *buf;
+
+    /* read in file order, which keeps INDEX order the same as a full load */
+    if( n > 0 )
+        qsort( offset, n, sizeof( uint64_t ), mply_offset_cmp );
+
+    mply_clean( ply );
+    mply_alloc( ply, ( MANGLE_INT ) n );
+    mply_pix_alloc( ply, head->pix_res );
+
+    /* a bigger buffer than stdio's, so a seek over a short gap stays inside
+     * it (glibc ignores the size unless it is given the buffer) */
+    buf = ( char * ) check_alloc( MPLY_PIDX_BUFSIZE, sizeof( char ) );
+    sr = sr_init( filename );
+    setvbuf( sr->fp, buf, _IOFBF, MPLY_PIDX_BUFSIZE );
+    pos = 0;
+    for( i = 0; i < ( MANGLE_INT ) n; i++ ) {
+        MANGLE_POLY *p;
+        char *line = NULL;
+
+        /* polygons next to each other in the file are read straight on */
+        if( offset[i] == pos || fseeko( sr->fp, ( off_t ) offset[i], SEEK_SET ) == 0 )
+            line = sr_readline( sr );
+        if( NULL == line || strncmp( "polygon", line, 7 ) != 0 ) {
+            fprintf( stderr, "MANGLE Error: pixel index does not match polygon file: %s\n",
+                     sr_filename( sr ) );
+            exit( EXIT_FAILURE );
+        }
+        p = mply_read_poly( ply, i, sr );
+        mply_pix_addpoly( ply, p );
+        pos = ( uint64_t ) ftello( sr->fp );
+    }
+    sr = sr_kill( sr );
+    CHECK_FREE( buf );
+    CHECK_FREE( offset );
+
+    mply_cap_shrink( ply );
+
+    return ply->npoly;
+}
+
+/* Load only the polygons in the given pixels (pixel INDEX values, in any
+ * order) into ply.  Returns the number of polygons loaded. */
+static MANGLE_INT
+mply_read_pidx_pixels( MANGLE_PLY * const ply, char const *const filename,
+                       MANGLE_PIDX const *const idx, MANGLE_INT * const pix, MANGLE_INT npix )
+{
+    MANGLE_INT k;
+    uint64_t lo = 0, *offset = NULL;
+    size_t n = 0, nalloc = 0;
+
+    npix = mply_index_sort_unique( pix, npix );
+
+    /* both are sorted by pixel: one walk over the entries, with a binary
+     * search (from where the last pixel ended) to skip to each pixel */
+    for( k = 0; k < npix; k++ ) {
+        lo = mply_pidx_lower_bound( idx, lo, pix[k] );
+        for( ; lo < idx->head.npoly && idx->entry[lo].ipix == pix[k]; lo++ ) {
+            if( n == nalloc ) {
+                nalloc = nalloc > 0 ? 2 * nalloc : 1024;
+                offset = ( uint64_t * ) check_realloc( offset, nalloc, sizeof( uint64_t ) );
+            }
+            offset[n++] = idx->entry[lo].offset;
+        }
+    }
+
+    return mply_read_pidx_offsets( ply, filename, &( idx->head ), offset, n );
+}
+
+/* Load the polygons in the given pixels (pixel INDEX values) from
+ * filename, using its pixel index (pidx_filename NULL means FILE.pidx).
+ * Returns the number of polygons loaded. */
+MANGLE_INT
+mply_read_pixels_into( MANGLE_PLY * const ply, char const *const filename,
+                       char const *const pidx_filename, MANGLE_INT const *const pix,
+                       const MANGLE_INT npix )
+{
+    MANGLE_PIDX idx;
+    MANGLE_INT n, *list = NULL;
+
+    mply_pidx_open( &idx, filename, pidx_filename );
+    if( npix > 0 ) {
+        list = ( MANGLE_INT * ) check_alloc( npix, sizeof( MANGLE_INT ) );
+        memcpy( list, pix, npix * sizeof( MANGLE_INT ) );
+    }
+    n = mply_read_pidx_pixels( ply, filename, &idx, list, npix );
+    mply_pidx_close( &idx );
+    CHECK_FREE( list );
+    return n;
+}
+
+/* Load the polygons with pixel INDEX in [pix0, pix1). */
+MANGLE_INT
+mply_read_pixel_range_into( MANGLE_PLY * const ply, char const *const filename,
+                            char const *const pidx_filename, const MANGLE_INT pix0,
+                            const MANGLE_INT pix1 )
+{
+    MANGLE_PIDX idx;
+    MANGLE_INT n;
+    uint64_t k, t0, t1, *offset = NULL;
+
+    mply_pidx_open( &idx, filename, pidx_filename );
+    t0 = mply_pidx_lower_bound( &idx, 0, pix0 );
+    t1 = pix1 > pix0 ? mply_pidx_lower_bound( &idx, t0, pix1 ) : t0;
+    if( t1 > t0 ) {
+        /* entries in a range are contiguous */
+        offset = ( uint64_t * ) check_alloc( t1 - t0, sizeof( uint64_t ) );
+        for( k = t0; k < t1; k++ )
+            offset[k - t0] = idx.entry[k].offset;
+    }
+
+    n = mply_read_pidx_offsets( ply, filename, &( idx.head ), offset, ( size_t ) ( t1 - t0 ) );
+    mply_pidx_close( &idx );
+    return n;
+}
+
+/* Split the pixels into nshard contiguous INDEX ranges holding about the
+ * same number of polygons (whole pixels only, so a range can be empty),
+ * and return range ishard as [*pix0, *pix1).  Together the ranges cover
+ * every pixel, including those without polygons. */
+void
+mply_pidx_shard_range( char const *const filename, char const *const pidx_filename,
+                       const int ishard, const int nshard, MANGLE_INT * const pix0,
+                       MANGLE_INT * const pix1 )
+{
+    MANGLE_PIDX idx;
+    MANGLE_INT bound[2];
+    int j;
+
+    if( nshard < 1 || ishard < 0 || ishard >= nshard ) {
+        fprintf( stderr, "MANGLE Error: invalid shard %d of %d\n", ishard, nshard );
+        exit( EXIT_FAILURE );
+    }
+
+    mply_pidx_open( &idx, filename, pidx_filename );
+    for( j = 0; j < 2; j++ ) {
+        int s = ishard + j;
+        uint64_t t = ( uint64_t ) ( ( double ) idx.head.npoly * s / nshard );
+        if( 0 == s ) {
+            bound[j] = 0;
+        } else if( nshard == s || t >= idx.head.npoly ) {
+            bound[j] = ( MANGLE_INT ) mply_pix_count( idx.head.pix_res );
+        } else {
+            /* start at the pixel of the polygon at this quantile */
+            bound[j] = ( MANGLE_INT ) idx.entry[t].ipix;
+        }
+    }
+    mply_pidx_close( &idx );
+
+    *pix0 = bound[0];
+    *pix1 = bound[1];
+}
+
+/* Load the polygons in every pixel touching the region (an intersection
+ * of caps).  This is a superset of the polygons that intersect the region. */
+MANGLE_INT
+mply_read_caps_into( MANGLE_PLY * const ply, char const *const filename,
+                     char const *const pidx_filename, MANGLE_CAP const *const region,
+                     const MANGLE_INT nregion )
+{
+    MANGLE_PIDX idx;
+    MANGLE_PLY res;
+    MANGLE_INT n, npix = 0, nalloc = 0, *pix = NULL;
+
+    mply_pidx_open( &idx, filename, pidx_filename );
+    memset( &res, 0, sizeof( MANGLE_PLY ) );
+    res.pix_res = idx.head.pix_res;
+    mply_find_pix_in_caps_append( &res, region, nregion, &pix, &npix, &nalloc );
+
+    n = mply_read_pidx_pixels( ply, filename, &idx, pix, npix );
+    mply_pidx_close( &idx );
+    CHECK_FREE( pix );
+    return n;
+}
+
+/* same for ra0 < ra < ra1, dec0 < dec < dec1 (degrees, see mply_box_caps) */
+MANGLE_INT
+mply_read_box_into( MANGLE_PLY * const ply, char const *const filename,
+                    char const *const pidx_filename, const double ra0, const double ra1,
+                    const double dec0, const double dec1 )
+{
+    MANGLE_PIDX idx;
+    MANGLE_PLY res;
+    MANGLE_CAP caps[2][4];
+    MANGLE_INT n, npix = 0, nalloc = 0, *pix = NULL;
+    int k, ncap[2], npart;
+
+    mply_pidx_open( &idx, filename, pidx_filename );
+    memset( &res, 0, sizeof( MANGLE_PLY ) );
+    res.pix_res = idx.head.pix_res;
+    npart = mply_box_caps( ra0, ra1, dec0, dec1, caps, ncap );
+    for( k = 0; k < npart; k++ )
+        mply_find_pix_in_caps_append( &res, caps[k], ncap[k], &pix, &npix, &nalloc );
+
+    n = mply_read_pidx_pixels( ply, filename, &idx, pix, npix );
+    mply_pidx_close( &idx );
+    CHECK_FREE( pix );
+    return n;
+}
+
+#endif
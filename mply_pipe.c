@@ -0,0 +1,369 @@
+/* pipelined reader / compute / writer for the streaming tools
+ *
+ * The catalog tools all do the same thing: read lines of "ra dec ...",
+ * look up each point, and write out some version of each line.  Here that
+ * is split across three threads working on a ring of chunks:
+ *
+ *   reader:  large fread()s into a chunk buffer, cut at the last newline;
+ *            gzip / zstd input is decompressed here (see mply_zread.c)
+ *   compute: (calling thread) split lines, parse ra/dec, run the batch
+ *            lookup, then hand the chunk to the tool's callback, which
+ *            fills the chunk output buffer.  An optional filter, run
+ *            before the lookup, can drop lines (keep[i] = FALSE) so only
+ *            the lines kept are looked up: see mply_pipe_run_filter()
+ *   writer:  one fwrite() per chunk output buffer
+ *
+ * With MPLY_PIPE_NSLOT chunks in the ring, reading and writing overlap with
+ * the lookups, so throughput is set by the slowest stage rather than the sum.
+ *
+ * Lines that are empty or start with '#' are skipped, as are lines where
+ * ra/dec cannot be read (with a warning), exactly as the original tools did.
+ */
+#pragma once
+#ifndef MPLY_PIPE_INCLUDED
+#define MPLY_PIPE_INCLUDED
+
+#include <pthread.h>
+
+#include <minimal_mangle.c>
+#include <mply_zread.c>
+
+#ifndef MPLY_PIPE_NSLOT
+#define MPLY_PIPE_NSLOT 4
+#endif
+
+#ifndef MPLY_PIPE_BUFSIZE
+#define MPLY_PIPE_BUFSIZE ( 1 << 22 )   /* bytes per read, also the maximum line length */
+#endif
+
+enum {
+    MPLY_PIPE_FREE = 0,         /* ready for the reader */
+    MPLY_PIPE_READ,             /* filled, ready for compute */
+    MPLY_PIPE_DONE              /* output ready for the writer */
+};
+
+typedef struct {
+    int state;
+    int last;                   /* final chunk of the input */
+    char *buf;                  /* input, complete lines only */
+    size_t buf_len;
+    size_t nline;               /* data lines in this chunk */
+    size_t nline_alloc;
+    char **line;                /* NUL terminated, pointing into buf */
+    size_t *line_len;
+    double *ra;
+    double *dec;
+    MANGLE_INT *index;          /* lookup result for each line */
+    char *keep;                 /* FALSE for lines dropped by the filter (index -1) */
+    char *out;
+    size_t out_len;
+    size_t out_size;
+} MANGLE_PIPE_CHUNK;
+
+typedef void ( *mply_pipe_fn ) ( MANGLE_PIPE_CHUNK * const chunk, void *arg );
+
+typedef struct {
+    MANGLE_PLY const *ply;
+    MANGLE_ZREAD in;
+    char const *in_name;
+    FILE *out;
+    mply_pipe_fn filter;        /* may be NULL */
+    void *filter_arg;
+    mply_pipe_fn fn;
+    void *arg;
+    size_t line_num;            /* input line number, kept by the compute stage */
+    size_t nread;               /* data lines processed */
+    char *carry;                /* partial line left over from the last read */
+    size_t carry_len;
+    MANGLE_PIPE_CHUNK chunk[MPLY_PIPE_NSLOT];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} MANGLE_PIPE;
+
+/* output helpers, for use inside the callback */
+INLINE char *
+mply_pipe_out_reserve( MANGLE_PIPE_CHUNK * const c, const size_t len )
+{
+    if( c->out_len + len > c->out_size ) {
+        size_t size = c->out_size > 0 ? c->out_size : MPLY_PIPE_BUFSIZE;
+        while( size < c->out_len + len )
+            size *= 2;
+        c->out = ( char * ) check_realloc( c->out, size, sizeof( char ) );
+        c->out_size = size;
+    }
+    return &( c->out[c->out_len] );
+}
+
+INLINE void
+mply_pipe_out_write( MANGLE_PIPE_CHUNK * const c, char const *const s, const size_t len )
+{
+    char *o = mply_pipe_out_reserve( c, len );
+    memcpy( o, s, len );
+    c->out_len += len;
+}
+
+/* pass input line i straight through */
+INLINE void
+mply_pipe_out_line( MANGLE_PIPE_CHUNK * const c, const size_t i )
+{
+    char *o = mply_pipe_out_reserve( c, c->line_len[i] + 1 );
+    memcpy( o, c->line[i], c->line_len[i] );
+    o[c->line_len[i]] = '\n';
+    c->out_len += c->line_len[i] + 1;
+}
+
+static inline void
+mply_pipe_wait( MANGLE_PIPE * const pipe, MANGLE_PIPE_CHUNK const *const c, const int state )
+{
+    pthread_mutex_lock( &pipe->lock );
+    while( c->state != state )
+        pthread_cond_wait( &pipe->cond, &pipe->lock );
+    pthread_mutex_unlock( &pipe->lock );
+}
+
+static inline void
+mply_pipe_post( MANGLE_PIPE * const pipe, MANGLE_PIPE_CHUNK * const c, const int state )
+{
+    pthread_mutex_lock( &pipe->lock );
+    c->state = state;
+    pthread_cond_broadcast( &pipe->cond );
+    pthread_mutex_unlock( &pipe->lock );
+}
+
+static void *
+mply_pipe_reader( void *arg )
+{
+    MANGLE_PIPE *pipe = ( MANGLE_PIPE * ) arg;
+    size_t k = 0;
+    int last = FALSE;
+
+    while( !last ) {
+        MANGLE_PIPE_CHUNK *c = &( pipe->chunk[k] );
+        size_t len, nr;
+
+        mply_pipe_wait( pipe, c, MPLY_PIPE_FREE );
+
+        memcpy( c->buf, pipe->carry, pipe->carry_len );
+        len = pipe->carry_len;
+        nr = mply_zread_read( &( pipe->in ), &( c->buf[len] ), MPLY_PIPE_BUFSIZE - len );
+        len += nr;
+
+        if( len < MPLY_PIPE_BUFSIZE ) {
+            /* a short read is the end of the input (errors have exited) */
+            last = TRUE;
+            c->buf_len = len;
+            pipe->carry_len = 0;
+        } else {
+            size_t end = len;
+            while( end > 0 && c->buf[end - 1] != '\n' )
+                end -= 1;
+            if( 0 == end ) {
+                fprintf( stderr, "Error: exceeded maximum length (%d) for a line in file: %s\n",
+                         MPLY_PIPE_BUFSIZE, pipe->in_name );
+                exit( EXIT_FAILURE );
+            }
+            c->buf_len = end;
+            pipe->carry_len = len - end;
+            memcpy( pipe->carry, &( c->buf[end] ), pipe->carry_len );
+        }
+        c->last = last;
+
+        mply_pipe_post( pipe, c, MPLY_PIPE_READ );
+        k = ( k + 1 ) % MPLY_PIPE_NSLOT;
+    }
+
+    return NULL;
+}
+
+static void *
+mply_pipe_writer( void *arg )
+{
+    MANGLE_PIPE *pipe = ( MANGLE_PIPE * ) arg;
+    size_t k = 0;
+    int last = FALSE;
+
+    while( !last ) {
+        MANGLE_PIPE_CHUNK *c = &( pipe->chunk[k] );
+
+        mply_pipe_wait( pipe, c, MPLY_PIPE_DONE );
+
+        if( c->out_len > 0 && fwrite( c->out, 1, c->out_len, pipe->out ) != c->out_len ) {
+            perror( "Error: cannot write output" );
+            exit( EXIT_FAILURE );
+        }
+        last = c->last;
+
+        mply_pipe_post( pipe, c, MPLY_PIPE_FREE );
+        k = ( k + 1 ) % MPLY_PIPE_NSLOT;
+    }
+
+    return NULL;
+}
+
+/* split a chunk into lines and parse ra/dec, skipping as simple_reader users do */
+static inline void
+mply_pipe_parse( MANGLE_PIPE * const pipe, MANGLE_PIPE_CHUNK * const c )
+{
+    char *p, *end;
+
+    c->nline = 0;
+    p = c->buf;
+    end = &( c->buf[c->buf_len] );
+    while( p < end ) {
+        char *nl, *e1, *e2;
+        size_t len;
+
+        nl = ( char * ) memchr( p, '\n', end - p );
+        if( NULL == nl )
+            nl = end;           /* final line without a newline: buf has room for the NUL */
+        *nl = '\0';
+        len = nl - p;
+        pipe->line_num += 1;
+
+        if( len > 0 && '#' != p[0] ) {
+            if( c->nline == c->nline_alloc ) {
+                c->nline_alloc = c->nline_alloc > 0 ? 2 * c->nline_alloc : 4096;
+                c->line = ( char ** ) check_realloc( c->line, c->nline_alloc, sizeof( char * ) );
+                c->line_len =
+                    ( size_t * ) check_realloc( c->line_len, c->nline_alloc, sizeof( size_t ) );
+                c->ra = ( double * ) check_realloc( c->ra, c->nline_alloc, sizeof( double ) );
+                c->dec = ( double * ) check_realloc( c->dec, c->nline_alloc, sizeof( double ) );
+                c->index =
+                    ( MANGLE_INT * ) check_realloc( c->index, c->nline_alloc,
+                                                    sizeof( MANGLE_INT ) );
+                c->keep = ( char * ) check_realloc( c->keep, c->nline_alloc, sizeof( char ) );
+            }
+            c->ra[c->nline] = strtod( p, &e1 );
+            c->dec[c->nline] = strtod( e1, &e2 );
+            if( e1 == p || e2 == e1 ) {
+                fprintf( stderr,
+                         "WARNING: skipped line, couldn't read RA/DEC on line %zu in file %s\n",
+                         pipe->line_num, pipe->in_name );
+            } else {
+                c->line[c->nline] = p;
+                c->line_len[c->nline] = len;
+                c->keep[c->nline] = TRUE;
+                c->nline += 1;
+            }
+        }
+        p = nl + 1;
+    }
+}
+
+/* batch lookup of the lines kept by the filter, gathered MANGLE_BATCH at a
+ * time; the others get index -1 */
+static void
+mply_pipe_lookup_kept( MANGLE_PLY const *const ply, MANGLE_PIPE_CHUNK * const c )
+{
+    double ra[MANGLE_BATCH], dec[MANGLE_BATCH];
+    MANGLE_INT index[MANGLE_BATCH];
+    size_t row[MANGLE_BATCH], i, j, nb = 0;
+
+    for( i = 0; i < c->nline; i++ ) {
+        c->index[i] = -1;
+        if( c->keep[i] ) {
+            ra[nb] = c->ra[i];
+            dec[nb] = c->dec[i];
+            row[nb] = i;
+            nb += 1;
+        }
+        if( nb == MANGLE_BATCH || ( nb > 0 && i + 1 == c->nline ) ) {
+            mply_find_polyindex_radec_batch( ply, nb, ra, dec, index );
+            for( j = 0; j < nb; j++ )
+                c->index[row[j]] = index[j];
+            nb = 0;
+        }
+    }
+}
+
+/* Run the whole pipeline over an input stream, calling fn() for each chunk;
+ * with ply = NULL no lookup is done, and the callback gets only ra/dec.
+ * filter (if not NULL) is called on each chunk before the lookup, with
+ * every keep[i] TRUE, and clears keep[i] for the lines not to look up. */
+size_t
+mply_pipe_run_filter( MANGLE_PLY const *const ply, FILE * in, char const *const in_name,
+                      FILE * out, mply_pipe_fn filter, void *filter_arg, mply_pipe_fn fn,
+                      void *arg )
+{
+    MANGLE_PIPE pipe;
+    pthread_t reader, writer;
+    size_t k = 0, i;
+    int last = FALSE;
+
+    memset( &pipe, 0, sizeof( MANGLE_PIPE ) );
+    pipe.ply = ply;
+    mply_zread_open( &( pipe.in ), in, in_name );
+    pipe.in_name = in_name;
+    pipe.out = out;
+    pipe.filter = filter;
+    pipe.filter_arg = filter_arg;
+    pipe.fn = fn;
+    pipe.arg = arg;
+    pipe.carry = ( char * ) check_alloc( MPLY_PIPE_BUFSIZE, sizeof( char ) );
+    for( i = 0; i < MPLY_PIPE_NSLOT; i++ ) {
+        /* one extra byte so an unterminated final line can be NUL terminated */
+        pipe.chunk[i].buf = ( char * ) check_alloc( MPLY_PIPE_BUFSIZE + 1, sizeof( char ) );
+    }
+    pthread_mutex_init( &pipe.lock, NULL );
+    pthread_cond_init( &pipe.cond, NULL );
+
+    if( pthread_create( &reader, NULL, mply_pipe_reader, &pipe ) != 0 ||
+        pthread_create( &writer, NULL, mply_pipe_writer, &pipe ) != 0 ) {
+        fprintf( stderr, "MANGLE Error: cannot start pipeline threads\n" );
+        exit( EXIT_FAILURE );
+    }
+
+    while( !last ) {
+        MANGLE_PIPE_CHUNK *c = &( pipe.chunk[k] );
+
+        mply_pipe_wait( &pipe, c, MPLY_PIPE_READ );
+
+        mply_pipe_parse( &pipe, c );
+        if( NULL != filter ) {
+            filter( c, filter_arg );
+            if( NULL != ply )
+                mply_pipe_lookup_kept( ply, c );
+        } else if( NULL != ply ) {
+            mply_find_polyindex_radec_batch( ply, c->nline, c->ra, c->dec, c->index );
+        }
+        pipe.nread += c->nline;
+
+        c->out_len = 0;
+        fn( c, arg );
+        last = c->last;
+
+        mply_pipe_post( &pipe, c, MPLY_PIPE_DONE );
+        k = ( k + 1 ) % MPLY_PIPE_NSLOT;
+    }
+
+    pthread_join( reader, NULL );
+    pthread_join( writer, NULL );
+    fflush( out );
+
+    pthread_cond_destroy( &pipe.cond );
+    pthread_mutex_destroy( &pipe.lock );
+    for( i = 0; i < MPLY_PIPE_NSLOT; i++ ) {
+        MANGLE_PIPE_CHUNK *c = &( pipe.chunk[i] );
+        CHECK_FREE( c->buf );
+        CHECK_FREE( c->line );
+        CHECK_FREE( c->line_len );
+        CHECK_FREE( c->ra );
+        CHECK_FREE( c->dec );
+        CHECK_FREE( c->index );
+        CHECK_FREE( c->keep );
+        CHECK_FREE( c->out );
+    }
+    CHECK_FREE( pipe.carry );
+    mply_zread_close( &( pipe.in ) );
+
+    return pipe.nread;
+}
+
+size_t
+mply_pipe_run( MANGLE_PLY const *const ply, FILE * in, char const *const in_name, FILE * out,
+               mply_pipe_fn fn, void *arg )
+{
+    return mply_pipe_run_filter( ply, in, in_name, out, NULL, NULL, fn, arg );
+}
+
+#endif
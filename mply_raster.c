@@ -0,0 +1,483 @@
+/* rasterize a mask onto a fine pixel map
+ *
+ * Each map pixel gets the mean polygon weight over the pixel, i.e. the
+ * covered fraction times the weight (0 outside the mask).  Two map schemes:
+ *
+ *   MPLY_RASTER_SIMPLE   mangle's simple scheme at resolution res:
+ *                        4^res pixels, INDEX = row * 2^res + column
+ *   MPLY_RASTER_HEALPIX  HEALPix NESTED ordering with nside = 2^res:
+ *                        12 * 4^res pixels
+ *
+ * Work per map pixel:
+ *   1. candidate polygons come from the mask's pixel index, limited to the
+ *      mask pixels overlapping the map pixel's z / azimuth range;
+ *   2. candidates are kept only if they share interior with the map pixel
+ *      (exact cap test, see mply_region.c);
+ *   3. no candidates: 0.  Pixel inside the first candidate (checked cap by
+ *      cap, exactly): that polygon's weight;
+ *   4. otherwise the pixel is on a boundary, and is averaged over 4^sub
+ *      equal-area sub-pixels (a 2^sub x 2^sub grid in z and azimuth for the
+ *      simple scheme, the NESTED children at nside * 2^sub for HEALPix),
+ *      each moved slightly off center (MPLY_RASTER_NUDGE).
+ *
+ * HEALPix pixels are not intersections of caps, so steps 2-3 use a cap
+ * bounding the pixel: that only sends a few more pixels to step 4.
+ *
+ * Map pixels are processed in parallel when compiled with OpenMP.
+ *
+ * mply_raster_write() output (native byte order):
+ *   MANGLE_RASTER_HEAD, then double map[npix] in INDEX order
+ */
+#pragma once
+#ifndef MPLY_RASTER_INCLUDED
+#define MPLY_RASTER_INCLUDED
+
+#include <stdint.h>
+
+#include <minimal_mangle.c>
+#include <mply_region.c>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define MPLY_RASTER_MAGIC "MPLYMAP"
+
+/* Sample points are moved off the sub-pixel centers by this fraction of
+ * the sub-pixel size.  Masks are often cut along pixel edges, and a sample
+ * exactly on an edge shared by two polygons is inside neither. */
+#define MPLY_RASTER_NUDGE 1.0e-3
+
+enum {
+    MPLY_RASTER_SIMPLE = 0,
+    MPLY_RASTER_HEALPIX = 1     /* NESTED ordering */
+};
+
+typedef struct {
+    int scheme;
+    int res;                    /* simple resolution, or HEALPix order: nside = 2^res */
+    int sub;                    /* boundary pixels are split into 4^sub samples */
+    size_t npix;
+    double *map;
+    size_t nempty;              /* pixel classification from mply_raster_fill() */
+    size_t nfull;
+    size_t nboundary;
+} MANGLE_RASTER;
+
+typedef struct {
+    char magic[8];
+    int32_t scheme;
+    int32_t res;
+    uint64_t npix;
+} MANGLE_RASTER_HEAD;
+
+/* HEALPix NESTED pixel center (as in chealpix pix2ang_nest) */
+static inline uint64_t
+mply_hpx_compress_bits( uint64_t x )
+{
+    x &= 0x5555555555555555ULL;
+    x = ( x | ( x >> 1 ) ) & 0x3333333333333333ULL;
+    x = ( x | ( x >> 2 ) ) & 0x0F0F0F0F0F0F0F0FULL;
+    x = ( x | ( x >> 4 ) ) & 0x00FF00FF00FF00FFULL;
+    x = ( x | ( x >> 8 ) ) & 0x0000FFFF0000FFFFULL;
+    x = ( x | ( x >> 16 ) ) & 0x00000000FFFFFFFFULL;
+    return x;
+}
+
+void
+mply_hpx_nest2vec( const int order, const uint64_t ipix, MANGLE_VEC * const vec3 )
+{
+    static const int jrll[12] = { 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4 };
+    static const int jpll[12] = { 1, 3, 5, 7, 0, 2, 4, 6, 1, 3, 5, 7 };
+    const int64_t nside = ( int64_t ) 1 << order;
+    const uint64_t npface = ( uint64_t ) 1 << ( 2 * order );
+    int face = ( int ) ( ipix >> ( 2 * order ) );
+    uint64_t ipf = ipix & ( npface - 1 );
+    int64_t ix, iy, jr, jp, nr;
+    int kshift;
+    double z, phi, st;
+
+    ix = ( int64_t ) mply_hpx_compress_bits( ipf );
+    iy = ( int64_t ) mply_hpx_compress_bits( ipf >> 1 );
+    jr = jrll[face] * nside - ix - iy - 1;
+
+    if( jr < nside ) {
+        nr = jr;
+        z = 1.0 - ( double ) nr * nr / ( 3.0 * npface );
+        kshift = 0;
+    } else if( jr > 3 * nside ) {
+        nr = 4 * nside - jr;
+        z = ( double ) nr * nr / ( 3.0 * npface ) - 1.0;
+        kshift = 0;
+    } else {
+        nr = nside;
+        z = ( 2 * nside - jr ) * 2.0 / ( 3.0 * nside );
+        kshift = ( int ) ( ( jr - nside ) & 1 );
+    }
+
+    jp = ( jpll[face] * nr + ix - iy + 1 + kshift ) / 2;
+    if( jp > 4 * nside )
+        jp -= 4 * nside;
+    if( jp < 1 )
+        jp += 4 * nside;
+    phi = ( jp - ( kshift + 1 ) * 0.5 ) * ( 0.5 * PI / nr );
+
+    st = sqrt( ( 1.0 - z ) * ( 1.0 + z ) );
+    vec3->x[0] = st * cos( phi );
+    vec3->x[1] = st * sin( phi );
+    vec3->x[2] = z;
+}
+
+/* largest angle between a pixel center and its corners (Healpix_Base::max_pixrad) */
+double
+mply_hpx_max_pixrad( const int order )
+{
+    const double nside = ( double ) ( ( int64_t ) 1 << order );
+    double t, za, zb, sa, sb, d;
+
+    za = 2.0 / 3.0;
+    t = 1.0 - 1.0 / nside;
+    zb = 1.0 - t * t / 3.0;
+    sa = sqrt( ( 1.0 - za ) * ( 1.0 + za ) );
+    sb = sqrt( ( 1.0 - zb ) * ( 1.0 + zb ) );
+    /* va at phi = pi / (4 nside), vb at phi = 0 */
+    d = sa * cos( PI / ( 4.0 * nside ) ) * sb + za * zb;
+    return acos( d > 1.0 ? 1.0 : d );
+}
+
+void
+mply_raster_alloc( MANGLE_RASTER * const r, const int scheme, const int res, const int sub )
+{
+    if( res < 0 || res > 29 || sub < 0 || res + sub > 29 ||
+        ( scheme != MPLY_RASTER_SIMPLE && scheme != MPLY_RASTER_HEALPIX ) ) {
+        fprintf( stderr, "MANGLE Error: bad raster scheme / resolution (%d, %d, %d)\n",
+                 scheme, res, sub );
+        exit( EXIT_FAILURE );
+    }
+    r->scheme = scheme;
+    r->res = res;
+    r->sub = sub;
+    r->npix = ( ( size_t ) 1 << ( 2 * res ) ) * ( MPLY_RASTER_HEALPIX == scheme ? 12 : 1 );
+    r->map = ( double * ) check_alloc( r->npix, sizeof( double ) );
+    r->nempty = r->nfull = r->nboundary = 0;
+}
+
+void
+mply_raster_clean( MANGLE_RASTER * const r )
+{
+    CHECK_FREE( r->map );
+    r->npix = 0;
+}
+
+MANGLE_RASTER *
+mply_raster_init( const int scheme, const int res, const int sub )
+{
+    MANGLE_RASTER *r;
+    r = ( MANGLE_RASTER * ) check_alloc( 1, sizeof( MANGLE_RASTER ) );
+    mply_raster_alloc( r, scheme, res, sub );
+    return r;
+}
+
+MANGLE_RASTER *
+mply_raster_kill( MANGLE_RASTER * r )
+{
+    mply_raster_clean( r );
+    CHECK_FREE( r );
+    return NULL;
+}
+
+/* Polygons in mask pixels overlapping z0 <= z <= z1 and (unless full_az)
+ * az0 <= az <= az1, az0 in [0, 2 pi) and az1 >= az0 possibly past 2 pi. */
+static void
+mply_raster_candidates( MANGLE_PLY const *const ply, const double z0, const double z1,
+                        const int full_az, const double az0, const double az1,
+                        MANGLE_INT ** list, MANGLE_INT * n, MANGLE_INT * nalloc )
+{
+    MANGLE_INT i, pow2r, row, row0, row1, col, col0, col1;
+
+    *n = 0;
+    if( ply->pix_res < 1 ) {
+        for( i = 0; i < ply->npoly; i++ )
+            mply_index_push( list, n, nalloc, i );
+        return;
+    }
+
+    /* one row / column of slack absorbs round-off at the edges */
+    pow2r = mply_pow2i( ply->pix_res );
+    row0 = ( MANGLE_INT ) ceil( ( 1.0 - z1 ) / 2.0 * pow2r ) - 2;
+    row1 = ( MANGLE_INT ) ceil( ( 1.0 - z0 ) / 2.0 * pow2r );
+    row0 = row0 < 0 ? 0 : row0;
+    row1 = row1 > pow2r - 1 ? pow2r - 1 : row1;
+    if( full_az ) {
+        col0 = 0;
+        col1 = pow2r - 1;
+    } else {
+        col0 = ( MANGLE_INT ) floor( az0 / ( 2.0 * PI ) * pow2r ) - 1;
+        col1 = ( MANGLE_INT ) floor( az1 / ( 2.0 * PI ) * pow2r ) + 1;
+        if( col1 - col0 >= pow2r ) {
+            col0 = 0;
+            col1 = pow2r - 1;
+        }
+    }
+
+    for( row = row0; row <= row1; row++ ) {
+        for( col = col0; col <= col1; col++ ) {
+            MANGLE_INT c = ( ( col % pow2r ) + pow2r ) % pow2r;
+            DATA_LIST *dl = ( DATA_LIST * ) & ply->pix[row * pow2r + c];
+            while( dl != NULL && dl->data != NULL ) {
+                i = ( MANGLE_INT ) ( ( MANGLE_POLY const * ) dl->data - ply->poly );
+                mply_index_push( list, n, nalloc, i );
+                dl = ( DATA_LIST * ) dl->next;
+            }
+        }
+    }
+}
+
+/* is the region (intersection of caps) inside polygon INDEX? */
+static int
+mply_raster_inside( MANGLE_PLY const *const ply, const MANGLE_INT index,
+                    MANGLE_CAP const *const region, const int nregion )
+{
+    MANGLE_INT k;
+    MANGLE_HOT const *h = &( ply->hot[index] );
+
+    for( k = 0; k < h->ncap; k++ ) {
+        /* the region must miss the complement of each cap */
+        MANGLE_CAP out = ply->cap[h->icap + k];
+        out.m = 0.0 == out.m ? 2.0 : -out.m;
+        if( mply_caps_intersect( region, nregion, &out, 1 ) )
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* Quick test of polygon INDEX against a cap of angular radius rad around
+ * center: -1 the cap misses the polygon, 1 the cap is inside it, 0 unknown. */
+static int
+mply_raster_bound( MANGLE_PLY const *const ply, const MANGLE_INT index,
+                   MANGLE_VEC const *const center, const double rad )
+{
+    MANGLE_INT k;
+    MANGLE_HOT const *h = &( ply->hot[index] );
+    int inside = TRUE;
+
+    for( k = 0; k < h->ncap; k++ ) {
+        MANGLE_CAP const *c = &( ply->cap[h->icap + k] );
+        double cd, d, R;
+
+        cd = c->x[0] * center->x[0] + c->x[1] * center->x[1] + c->x[2] * center->x[2];
+        d = acos( cd > 1.0 ? 1.0 : ( cd < -1.0 ? -1.0 : cd ) );
+        R = 1.0 - fabs( c->m );
+        R = acos( R < -1.0 ? -1.0 : R );
+        if( c->m >= 0.0 ) {
+            if( d - rad >= R )
+                return -1;
+            if( d + rad >= R )
+                inside = FALSE;
+        } else {
+            if( d + rad <= R )
+                return -1;
+            if( d - rad <= R )
+                inside = FALSE;
+        }
+    }
+    return inside ? 1 : 0;
+}
+
+/* weight at a sample point, only looking at the candidates */
+static inline double
+mply_raster_sample( MANGLE_PLY const *const ply, MANGLE_INT const *const cand,
+                    const MANGLE_INT ncand, MANGLE_VEC const *const v )
+{
+    MANGLE_INT k;
+    for( k = 0; k < ncand; k++ ) {
+        if( mply_within_index( ply, cand[k], v ) )
+            return ply->poly[cand[k]].weight;
+    }
+    return 0.0;
+}
+
+/* returns 0 empty, 1 full, 2 boundary */
+static int
+mply_raster_pixel( MANGLE_RASTER * const r, MANGLE_PLY const *const ply, const size_t ipix,
+                   MANGLE_INT ** cand, MANGLE_INT * nalloc )
+{
+    MANGLE_CAP region[4];
+    MANGLE_VEC center;
+    int nregion, full_az = FALSE, first = 0;
+    double z0, z1, az0 = 0.0, az1 = 0.0, rad, sum = 0.0;
+    MANGLE_INT k, n, ncand = 0;
+    size_t j, nsub = ( size_t ) 1 << r->sub;
+
+    if( MPLY_RASTER_SIMPLE == r->scheme ) {
+        size_t pow2r = ( size_t ) 1 << r->res;
+        size_t row = ipix / pow2r, col = ipix % pow2r;
+        z1 = 1.0 - 2.0 * row / ( double ) pow2r;
+        z0 = 1.0 - 2.0 * ( row + 1 ) / ( double ) pow2r;
+        az0 = 2.0 * PI * col / pow2r;
+        az1 = 2.0 * PI * ( col + 1 ) / pow2r;
+        full_az = ( 1 == pow2r );
+        nregion = mply_zbox_caps( region, az0, az1, z0, z1 );
+
+        /* bounding cap: around the middle, out to the farthest corner */
+        {
+            double zm = 0.5 * ( z0 + z1 ), azm = 0.5 * ( az0 + az1 ), sm, d0, d1;
+            sm = sqrt( ( 1.0 - zm ) * ( 1.0 + zm ) );
+            center.x[0] = sm * cos( azm );
+            center.x[1] = sm * sin( azm );
+            center.x[2] = zm;
+            d0 = sm * sqrt( ( 1.0 - z0 ) * ( 1.0 + z0 ) ) * cos( azm - az0 ) + zm * z0;
+            d1 = sm * sqrt( ( 1.0 - z1 ) * ( 1.0 + z1 ) ) * cos( azm - az0 ) + zm * z1;
+            d0 = d0 < d1 ? d0 : d1;
+            rad = acos( d0 < -1.0 ? -1.0 : ( d0 > 1.0 ? 1.0 : d0 ) ) * ( 1.0 + 1.0e-6 ) + 1.0e-12;
+            if( full_az || z1 - z0 >= 1.0 )
+                rad = PI;       /* too big to bother */
+        }
+    } else {
+        double el;
+        mply_hpx_nest2vec( r->res, ipix, &center );
+        rad = mply_hpx_max_pixrad( r->res ) * ( 1.0 + 1.0e-6 ) + 1.0e-12;
+        region[0].x[0] = center.x[0];
+        region[0].x[1] = center.x[1];
+        region[0].x[2] = center.x[2];
+        region[0].m = 1.0 - cos( rad );
+        nregion = 1;
+
+        el = asin( center.x[2] );
+        z0 = el - rad <= -0.5 * PI ? -1.0 : sin( el - rad );
+        z1 = el + rad >= 0.5 * PI ? 1.0 : sin( el + rad );
+        if( el - rad <= -0.5 * PI || el + rad >= 0.5 * PI ) {
+            full_az = TRUE;
+        } else {
+            double az = atan2( center.x[1], center.x[0] ), s = sin( rad ) / cos( el );
+            double half = s >= 1.0 ? PI : asin( s );
+            az = az < 0.0 ? az + 2.0 * PI : az;
+            az0 = az - half;
+            az1 = az + half;
+            if( az0 < 0.0 ) {
+                az0 += 2.0 * PI;
+                az1 += 2.0 * PI;
+            }
+            full_az = half >= PI;
+        }
+    }
+
+    mply_raster_candidates( ply, z0, z1, full_az, az0, az1, cand, &n, nalloc );
+
+    /* keep the polygons that really touch the pixel, in INDEX order: the
+     * bounding cap settles most of them without the exact test */
+    n = mply_index_sort_unique( *cand, n );
+    for( k = 0; k < n; k++ ) {
+        MANGLE_INT i = ( *cand )[k];
+        int q = mply_raster_bound( ply, i, &center, rad );
+        if( q < 0 )
+            continue;
+        if( 0 == q && !mply_caps_intersect( region, nregion, &( ply->cap[ply->hot[i].icap] ),
+                                            ply->hot[i].ncap ) )
+            continue;
+        if( 0 == ncand )
+            first = q;
+        ( *cand )[ncand++] = i;
+    }
+
+    if( 0 == ncand ) {
+        r->map[ipix] = 0.0;
+        return 0;
+    }
+    if( first > 0 || mply_raster_inside( ply, ( *cand )[0], region, nregion ) ) {
+        r->map[ipix] = ply->poly[( *cand )[0]].weight;
+        return 1;
+    }
+
+    if( MPLY_RASTER_SIMPLE == r->scheme ) {
+        size_t i;
+        for( i = 0; i < nsub; i++ ) {
+            double z = z1 - ( z1 - z0 ) * ( i + 0.5 + MPLY_RASTER_NUDGE ) / nsub;
+            double st = sqrt( ( 1.0 - z ) * ( 1.0 + z ) );
+            for( j = 0; j < nsub; j++ ) {
+                MANGLE_VEC v;
+                double az = az0 + ( az1 - az0 ) * ( j + 0.5 + 0.7 * MPLY_RASTER_NUDGE ) / nsub;
+                v.x[0] = st * cos( az );
+                v.x[1] = st * sin( az );
+                v.x[2] = z;
+                sum += mply_raster_sample( ply, *cand, ncand, &v );
+            }
+        }
+    } else {
+        uint64_t child = ( uint64_t ) ipix << ( 2 * r->sub );
+        double eps = MPLY_RASTER_NUDGE * sqrt( 4.0 * PI / ( r->npix * nsub * nsub ) );
+        for( j = 0; j < nsub * nsub; j++ ) {
+            MANGLE_VEC v;
+            double norm;
+            mply_hpx_nest2vec( r->res + r->sub, child + j, &v );
+            v.x[0] += eps * 0.48;
+            v.x[1] += eps * 0.60;
+            v.x[2] += eps * 0.64;
+            norm = sqrt( v.x[0] * v.x[0] + v.x[1] * v.x[1] + v.x[2] * v.x[2] );
+            v.x[0] /= norm;
+            v.x[1] /= norm;
+            v.x[2] /= norm;
+            sum += mply_raster_sample( ply, *cand, ncand, &v );
+        }
+    }
+    r->map[ipix] = sum / ( double ) ( nsub * nsub );
+    return 2;
+}
+
+/* fill the whole map from the mask */
+void
+mply_raster_fill( MANGLE_RASTER * const r, MANGLE_PLY const *const ply )
+{
+    size_t nempty = 0, nfull = 0, nboundary = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel reduction( +:nempty, nfull, nboundary )
+#endif
+    {
+        MANGLE_INT *cand = NULL, nalloc = 0;
+        size_t ipix;
+
+#ifdef _OPENMP
+#pragma omp for schedule( dynamic, 64 )
+#endif
+        for( ipix = 0; ipix < r->npix; ipix++ ) {
+            switch ( mply_raster_pixel( r, ply, ipix, &cand, &nalloc ) ) {
+            case 0:
+                nempty += 1;
+                break;
+            case 1:
+                nfull += 1;
+                break;
+            default:
+                nboundary += 1;
+            }
+        }
+        CHECK_FREE( cand );
+    }
+
+    r->nempty = nempty;
+    r->nfull = nfull;
+    r->nboundary = nboundary;
+}
+
+void
+mply_raster_write( MANGLE_RASTER const *const r, char const *const filename )
+{
+    MANGLE_RASTER_HEAD head;
+    FILE *fp;
+
+    memset( &head, 0, sizeof( MANGLE_RASTER_HEAD ) );
+    memcpy( head.magic, MPLY_RASTER_MAGIC, sizeof( MPLY_RASTER_MAGIC ) );
+    head.scheme = r->scheme;
+    head.res = r->res;
+    head.npix = r->npix;
+
+    fp = check_fopen( filename, "wb" );
+    if( fwrite( &head, sizeof( head ), 1, fp ) != 1 ||
+        fwrite( r->map, sizeof( double ), r->npix, fp ) != r->npix || fclose( fp ) != 0 ) {
+        fprintf( stderr, "MANGLE Error: cannot write map file: %s\n", filename );
+        exit( EXIT_FAILURE );
+    }
+}
+
+#endif
@@ -0,0 +1,450 @@
+/* region queries: which polygons intersect a cap or an RA/Dec box?
+ *
+ * Candidates come from the pixel index (only pixels that intersect the
+ * region are visited), and each candidate is confirmed with an exact test
+ * of whether the polygon caps and the region caps have a common interior.
+ *
+ * The intersection test walks the boundary circle of each cap: on that
+ * circle, every other cap is an arc (or all / nothing), so the caps have a
+ * common interior exactly when some point between arc endpoints, on some
+ * boundary circle, is strictly inside all the other caps.  Polygons that
+ * only touch the region along an edge or at a point are NOT included.
+ */
+#pragma once
+#ifndef MPLY_REGION_INCLUDED
+#define MPLY_REGION_INCLUDED
+
+#include <minimal_mangle.c>
+
+#define MPLY_REGION_EPS 1.0e-15
+
+/* a cap around a center with an angular radius (radians) */
+INLINE void
+mply_cap_from_polar( MANGLE_CAP * const cap, const double az, const double el,
+                     const double radius )
+{
+    MANGLE_VEC v;
+    mply_vec_from_polar( &v, az, el );
+    cap->x[0] = v.x[0];
+    cap->x[1] = v.x[1];
+    cap->x[2] = v.x[2];
+    cap->m = 1.0 - cos( radius );
+}
+
+INLINE void
+mply_cap_from_radec( MANGLE_CAP * const cap, const double ra, const double dec,
+                     const double radius )
+{
+    /* all in degrees */
+    mply_cap_from_polar( cap, ra * DEG2RAD, dec * DEG2RAD, radius * DEG2RAD );
+}
+
+/* Caps bounding az0 < az < az1 and z0 < z < z1 (z = sin(el)).  The azimuth
+ * range must be no wider than PI, unless it is the full circle.  Returns the
+ * number of caps written (up to 4). */
+int
+mply_zbox_caps( MANGLE_CAP caps[4], const double az0, const double az1, const double z0,
+                const double z1 )
+{
+    int n = 0;
+
+    if( z0 > -1.0 ) {
+        caps[n].x[0] = 0.0;
+        caps[n].x[1] = 0.0;
+        caps[n].x[2] = 1.0;
+        caps[n].m = 1.0 - z0;
+        n += 1;
+    }
+    if( z1 < 1.0 ) {
+        caps[n].x[0] = 0.0;
+        caps[n].x[1] = 0.0;
+        caps[n].x[2] = 1.0;
+        caps[n].m = -( 1.0 - z1 );
+        n += 1;
+    }
+    if( az1 - az0 < 2.0 * PI ) {
+        /* two hemispheres, bounded by the great circles at az0 and az1 */
+        caps[n].x[0] = -sin( az0 );
+        caps[n].x[1] = cos( az0 );
+        caps[n].x[2] = 0.0;
+        caps[n].m = 1.0;
+        n += 1;
+        caps[n].x[0] = sin( az1 );
+        caps[n].x[1] = -cos( az1 );
+        caps[n].x[2] = 0.0;
+        caps[n].m = 1.0;
+        n += 1;
+    }
+    return n;
+}
+
+/* the caps bounding pixel INDEX ipix */
+INLINE int
+mply_pix_caps( MANGLE_PLY const *const ply, const MANGLE_INT ipix, MANGLE_CAP caps[4] )
+{
+    MANGLE_INT pow2r, n, m;
+
+    pow2r = mply_pow2i( ply->pix_res );
+    n = ipix / pow2r;
+    m = ipix % pow2r;
+
+    return mply_zbox_caps( caps, 2.0 * PI * m / pow2r, 2.0 * PI * ( m + 1 ) / pow2r,
+                           1.0 - 2.0 * ( n + 1 ) / ( double ) pow2r,
+                           1.0 - 2.0 * n / ( double ) pow2r );
+}
+
+static inline MANGLE_CAP const *
+mply_caps_get( MANGLE_CAP const *const a, const MANGLE_INT na, MANGLE_CAP const *const b,
+               const MANGLE_INT k )
+{
+    return k < na ? &a[k] : &b[k - na];
+}
+
+static int
+mply_double_cmp( const void *a, const void *b )
+{
+    double x = *( const double * ) a, y = *( const double * ) b;
+    return ( x > y ) - ( x < y );
+}
+
+/* Do the caps a[0..na) and b[0..nb) have a common interior?  (Either list
+ * can be empty.) */
+int
+mply_caps_intersect( MANGLE_CAP const *const a, const MANGLE_INT na,
+                     MANGLE_CAP const *const b, const MANGLE_INT nb )
+{
+    MANGLE_INT i, j, k, n = na + nb;
+    double tbuf[128], *t;
+    char sbuf[64], *skip;
+    int any_boundary = FALSE, found = FALSE;
+
+    /* a cap that covers nothing makes the whole thing empty */
+    for( k = 0; k < n; k++ ) {
+        double m = mply_caps_get( a, na, b, k )->m;
+        if( m == 0.0 || m <= -2.0 )
+            return FALSE;
+    }
+
+    t = n <= 64 ? tbuf : ( double * ) check_alloc( 2 * n, sizeof( double ) );
+    skip = n <= 64 ? sbuf : ( char * ) check_alloc( n, sizeof( char ) );
+
+    for( i = 0; i < n && !found; i++ ) {
+        MANGLE_CAP const *ci = mply_caps_get( a, na, b, i );
+        MANGLE_VEC u, w;
+        double hi, r, di, e[3] = { 0.0, 0.0, 0.0 };
+        int kmin = 0, nt = 0, ok = TRUE;
+
+        hi = 1.0 - fabs( ci->m );
+        if( hi <= -1.0 || hi >= 1.0 )
+            continue;           /* whole sphere, or all but a point: no boundary circle */
+        any_boundary = TRUE;
+        r = sqrt( 1.0 - hi * hi );
+        di = ci->m >= 0.0 ? 1.0 : -1.0;
+
+        /* orthonormal basis (u, w) of the plane of the boundary circle */
+        for( k = 1; k < 3; k++ ) {
+            if( fabs( ci->x[k] ) < fabs( ci->x[kmin] ) )
+                kmin = k;
+        }
+        e[kmin] = 1.0;
+        for( k = 0; k < 3; k++ )
+            u.x[k] = e[k] - ci->x[kmin] * ci->x[k];
+        {
+            double norm = sqrt( u.x[0] * u.x[0] + u.x[1] * u.x[1] + u.x[2] * u.x[2] );
+            for( k = 0; k < 3; k++ )
+                u.x[k] /= norm;
+        }
+        w.x[0] = ci->x[1] * u.x[2] - ci->x[2] * u.x[1];
+        w.x[1] = ci->x[2] * u.x[0] - ci->x[0] * u.x[2];
+        w.x[2] = ci->x[0] * u.x[1] - ci->x[1] * u.x[0];
+
+        /* on the circle, cap j holds where A + P cos(t) + Q sin(t) is on its inner side */
+        for( j = 0; j < n && ok; j++ ) {
+            MANGLE_CAP const *cj;
+            double A, P, Q, B, hj, dj, cc, phi, d;
+
+            skip[j] = TRUE;
+            if( j == i )
+                continue;
+            cj = mply_caps_get( a, na, b, j );
+            hj = 1.0 - fabs( cj->m );
+            dj = cj->m >= 0.0 ? 1.0 : -1.0;
+            A = hi * ( cj->x[0] * ci->x[0] + cj->x[1] * ci->x[1] + cj->x[2] * ci->x[2] );
+            P = r * ( cj->x[0] * u.x[0] + cj->x[1] * u.x[1] + cj->x[2] * u.x[2] );
+            Q = r * ( cj->x[0] * w.x[0] + cj->x[1] * w.x[1] + cj->x[2] * w.x[2] );
+            B = sqrt( P * P + Q * Q );
+
+            if( B < MPLY_REGION_EPS ) {
+                /* parallel circles: decide just inside cap i, off the circle */
+                double s, gap = A - hj;
+                s = cj->x[0] * ci->x[0] + cj->x[1] * ci->x[1] + cj->x[2] * ci->x[2] > 0.0 ?
+                    1.0 : -1.0;
+                if( fabs( gap ) > MPLY_REGION_EPS )
+                    ok = dj * gap > 0.0;
+                else
+                    ok = dj * s * di > 0.0;
+                continue;
+            }
+
+            cc = ( hj - A ) / B;
+            if( dj > 0.0 ) {
+                if( cc >= 1.0 )
+                    ok = FALSE;
+                if( cc < -1.0 )
+                    continue;   /* the whole circle */
+            } else {
+                if( cc <= -1.0 )
+                    ok = FALSE;
+                if( cc > 1.0 )
+                    continue;
+            }
+            if( !ok )
+                break;
+
+            skip[j] = FALSE;
+            phi = atan2( Q, P );
+            d = acos( cc );
+            t[nt++] = fmod( phi - d + 4.0 * PI, 2.0 * PI );
+            t[nt++] = fmod( phi + d + 4.0 * PI, 2.0 * PI );
+        }
+        if( !ok )
+            continue;
+
+        /* try the middle of every gap between arc endpoints */
+        if( 0 == nt ) {
+            t[nt++] = 0.0;
+        } else {
+            qsort( t, nt, sizeof( double ), mply_double_cmp );
+        }
+        for( k = 0; k < nt && !found; k++ ) {
+            double tm;
+            MANGLE_VEC v;
+            int inside = TRUE;
+
+            if( k + 1 < nt )
+                tm = 0.5 * ( t[k] + t[k + 1] );
+            else
+                tm = 0.5 * ( t[k] + t[0] + 2.0 * PI );
+
+            for( j = 0; j < 3; j++ )
+                v.x[j] = hi * ci->x[j] + r * ( cos( tm ) * u.x[j] + sin( tm ) * w.x[j] );
+
+            for( j = 0; j < n && inside; j++ ) {
+                if( skip[j] )
+                    continue;
+                inside = mply_within_cap( mply_caps_get( a, na, b, j ), &v );
+            }
+            found = inside;
+        }
+    }
+
+    if( t != tbuf )
+        CHECK_FREE( t );
+    if( skip != sbuf )
+        CHECK_FREE( skip );
+
+    if( !any_boundary )
+        return TRUE;
+    return found;
+}
+
+/* does polygon INDEX have a common interior with the region caps? */
+INLINE int
+mply_poly_intersects_caps( MANGLE_PLY const *const ply, const MANGLE_INT index,
+                           MANGLE_CAP const *const region, const MANGLE_INT nregion )
+{
+    MANGLE_HOT const *h = &( ply->hot[index] );
+    return mply_caps_intersect( &( ply->cap[h->icap] ), h->ncap, region, nregion );
+}
+
+static int
+mply_index_cmp( const void *a, const void *b )
+{
+    MANGLE_INT x = *( const MANGLE_INT * ) a, y = *( const MANGLE_INT * ) b;
+    return ( x > y ) - ( x < y );
+}
+
+static inline void
+mply_index_push( MANGLE_INT ** list, MANGLE_INT * n, MANGLE_INT * nalloc, const MANGLE_INT i )
+{
+    if( *n == *nalloc ) {
+        *nalloc = *nalloc > 0 ? 2 * *nalloc : 64;
+        *list = ( MANGLE_INT * ) check_realloc( *list, *nalloc, sizeof( MANGLE_INT ) );
+    }
+    ( *list )[*n] = i;
+    *n += 1;
+}
+
+/* Append the pixel INDEX of every pixel intersecting the region to *list.
+ * Only ply->pix_res is required: if ply->pix is NULL every intersecting
+ * pixel is listed, otherwise only those holding polygons. */
+void
+mply_find_pix_in_caps_append( MANGLE_PLY const *const ply, MANGLE_CAP const *const region,
+                              const MANGLE_INT nregion, MANGLE_INT ** list, MANGLE_INT * n,
+                              MANGLE_INT * nalloc )
+{
+    MANGLE_INT i, pow2r, row, row0, row1, col;
+    double zmin = -1.0, zmax = 1.0;
+
+    /* limit the pixel rows with the z extent of the (positive) region caps */
+    for( i = 0; i < nregion; i++ ) {
+        double el, theta, lo, hi;
+        MANGLE_CAP const *c = &region[i];
+        if( c->m < 0.0 || c->m >= 2.0 )
+            continue;
+        el = asin( c->x[2] > 1.0 ? 1.0 : ( c->x[2] < -1.0 ? -1.0 : c->x[2] ) );
+        theta = acos( 1.0 - c->m );
+        lo = el - theta;
+        hi = el + theta;
+        if( lo > -PI / 2.0 && sin( lo ) > zmin )
+            zmin = sin( lo );
+        if( hi < PI / 2.0 && sin( hi ) < zmax )
+            zmax = sin( hi );
+    }
+    if( zmin > zmax )
+        return;
+
+    pow2r = mply_pow2i( ply->pix_res );
+    row0 = ( MANGLE_INT ) ceil( ( 1.0 - zmax ) / 2.0 * pow2r ) - 2;
+    row1 = ( MANGLE_INT ) ceil( ( 1.0 - zmin ) / 2.0 * pow2r );
+    row0 = row0 < 0 ? 0 : row0;
+    row1 = row1 > pow2r - 1 ? pow2r - 1 : row1;
+
+    for( row = row0; row <= row1; row++ ) {
+        for( col = 0; col < pow2r; col++ ) {
+            MANGLE_CAP pcap[4];
+            MANGLE_INT ipix = row * pow2r + col;
+            int npcap;
+
+            if( NULL != ply->pix && NULL == ply->pix[ipix].data )
+                continue;
+            npcap = mply_pix_caps( ply, ipix, pcap );
+            if( mply_caps_intersect( pcap, npcap, region, nregion ) )
+                mply_index_push( list, n, nalloc, ipix );
+        }
+    }
+}
+
+/* Append the INDEX of every polygon intersecting the region (given as an
+ * intersection of caps) to *list, which holds *n of *nalloc entries. */
+void
+mply_find_polys_in_caps_append( MANGLE_PLY const *const ply, MANGLE_CAP const *const region,
+                                const MANGLE_INT nregion, MANGLE_INT ** list, MANGLE_INT * n,
+                                MANGLE_INT * nalloc )
+{
+    MANGLE_INT i, k, npix = 0, npix_alloc = 0;
+    MANGLE_INT *pix = NULL;
+
+    if( ply->pix_res < 1 ) {
+        for( i = 0; i < ply->npoly; i++ ) {
+            if( mply_poly_intersects_caps( ply, i, region, nregion ) )
+                mply_index_push( list, n, nalloc, i );
+        }
+        return;
+    }
+
+    mply_find_pix_in_caps_append( ply, region, nregion, &pix, &npix, &npix_alloc );
+    for( k = 0; k < npix; k++ ) {
+        DATA_LIST *dl = ( DATA_LIST * ) & ply->pix[pix[k]];
+        while( dl != NULL && dl->data != NULL ) {
+            i = ( MANGLE_INT ) ( ( MANGLE_POLY const * ) dl->data - ply->poly );
+            dl = ( DATA_LIST * ) dl->next;
+            if( mply_poly_intersects_caps( ply, i, region, nregion ) )
+                mply_index_push( list, n, nalloc, i );
+        }
+    }
+    CHECK_FREE( pix );
+}
+
+/* sort a list of INDEX values and drop duplicates, returns the new count */
+MANGLE_INT
+mply_index_sort_unique( MANGLE_INT * const list, const MANGLE_INT n )
+{
+    MANGLE_INT i, nu = 0;
+
+    if( n < 1 )
+        return 0;
+    qsort( list, n, sizeof( MANGLE_INT ), mply_index_cmp );
+    for( i = 0; i < n; i++ ) {
+        if( 0 == nu || list[i] != list[nu - 1] )
+            list[nu++] = list[i];
+    }
+    return nu;
+}
+
+/* Find all polygons intersecting the cap.  Returns the number found, and
+ * sets *index to a newly allocated (sorted) array of their INDEX values,
+ * which the caller should free(). */
+MANGLE_INT
+mply_find_polys_in_cap( MANGLE_PLY const *const ply, MANGLE_CAP const *const cap,
+                        MANGLE_INT ** index )
+{
+    MANGLE_INT n = 0, nalloc = 0;
+
+    *index = NULL;
+    mply_find_polys_in_caps_append( ply, cap, 1, index, &n, &nalloc );
+
+    return mply_index_sort_unique( *index, n );
+}
+
+/* Split ra0 < ra < ra1, dec0 < dec < dec1 (degrees) into intersections of
+ * caps.  The RA range may wrap through zero (ra1 < ra0, e.g. 350 to 10).
+ * ra1 == ra0 (or the two a multiple of 360 apart, going down) is an empty
+ * box; the full circle has to be asked for as ra1 - ra0 >= 360 (e.g. 0 to
+ * 360).  A range wider than 180 degrees is not an intersection of caps, so
+ * it comes back as two halves.  Returns the number of parts (0, 1 or 2),
+ * with ncap[] caps in each. */
+int
+mply_box_caps( const double ra0, const double ra1, const double dec0, const double dec1,
+               MANGLE_CAP caps[2][4], int ncap[2] )
+{
+    double az0, width, z0, z1;
+
+    az0 = fmod( ra0, 360.0 );
+    if( az0 < 0.0 )
+        az0 += 360.0;
+    width = ra1 - ra0;
+    if( width < 0.0 ) {
+        /* wraps through zero */
+        width = fmod( width, 360.0 ) + 360.0;
+        if( width >= 360.0 )
+            width = 0.0;
+    }
+    if( width <= 0.0 )
+        return 0;
+    z0 = dec0 <= -90.0 ? -1.0 : sin( dec0 * DEG2RAD );
+    z1 = dec1 >= 90.0 ? 1.0 : sin( dec1 * DEG2RAD );
+
+    if( width >= 360.0 ) {
+        ncap[0] = mply_zbox_caps( caps[0], 0.0, 2.0 * PI, z0, z1 );
+        return 1;
+    } else if( width <= 180.0 ) {
+        ncap[0] = mply_zbox_caps( caps[0], az0 * DEG2RAD, ( az0 + width ) * DEG2RAD, z0, z1 );
+        return 1;
+    } else {
+        double half = 0.5 * width;
+        ncap[0] = mply_zbox_caps( caps[0], az0 * DEG2RAD, ( az0 + half ) * DEG2RAD, z0, z1 );
+        ncap[1] = mply_zbox_caps( caps[1], ( az0 + half ) * DEG2RAD, ( az0 + width ) * DEG2RAD,
+                                  z0, z1 );
+        return 2;
+    }
+}
+
+/* Same as mply_find_polys_in_cap(), for an RA/Dec box (see mply_box_caps) */
+MANGLE_INT
+mply_find_polys_in_box( MANGLE_PLY const *const ply, const double ra0, const double ra1,
+                        const double dec0, const double dec1, MANGLE_INT ** index )
+{
+    MANGLE_INT n = 0, nalloc = 0;
+    MANGLE_CAP caps[2][4];
+    int k, ncap[2], npart;
+
+    *index = NULL;
+    npart = mply_box_caps( ra0, ra1, dec0, dec1, caps, ncap );
+    for( k = 0; k < npart; k++ )
+        mply_find_polys_in_caps_append( ply, caps[k], ncap[k], index, &n, &nalloc );
+
+    return mply_index_sort_unique( *index, n );
+}
+
+#endif
@@ -0,0 +1,201 @@
+/* reorder and compact a mask before writing it back out
+ *
+ * These rebuild the MANGLE_PLY in place: the polygon, hot and cap arrays
+ * are rewritten in the new order (so caps stay contiguous) and the pixel
+ * index is rebuilt.  INDEX values from before the call are not valid
+ * afterwards.
+ *
+ *   mply_sort_by_pixel()      polygons in pixel order, file order within a pixel
+ *   mply_drop_zero_weight()   remove polygons with weight == 0
+ *   mply_dedupe()             remove repeats (same caps and weight)
+ *   mply_renumber()           set polyid to 0 .. npoly-1
+ *
+ * A mask written out after mply_sort_by_pixel() loads with each pixel's
+ * polygons next to each other, so queries touch fewer cache lines.
+ */
+#pragma once
+#ifndef MPLY_REWRITE_INCLUDED
+#define MPLY_REWRITE_INCLUDED
+
+#include <stdint.h>
+
+#include <minimal_mangle.c>
+#include <mply_load.c>
+
+typedef struct {
+    uint64_t key;
+    MANGLE_INT index;
+} MANGLE_SORT_KEY;
+
+static int
+mply_sort_key_cmp( const void *a, const void *b )
+{
+    MANGLE_SORT_KEY const *x = ( MANGLE_SORT_KEY const * ) a;
+    MANGLE_SORT_KEY const *y = ( MANGLE_SORT_KEY const * ) b;
+    if( x->key != y->key )
+        return ( x->key > y->key ) - ( x->key < y->key );
+    return ( x->index > y->index ) - ( x->index < y->index );
+}
+
+/* keep only the n polygons listed by INDEX, in that order */
+void
+mply_keep_index( MANGLE_PLY * const ply, MANGLE_INT const *const index, const MANGLE_INT n )
+{
+    MANGLE_PLY old = *ply;
+    MANGLE_INT i, ncap = 0;
+    int pix_res = ply->pix_res;
+
+    for( i = 0; i < n; i++ )
+        ncap += old.hot[index[i]].ncap;
+
+    mply_alloc( ply, n );
+    if( ncap > 0 ) {
+        ply->cap = ( MANGLE_CAP * ) check_alloc( ncap, sizeof( MANGLE_CAP ) );
+        ply->ncap_alloc = ncap;
+    }
+    for( i = 0; i < n; i++ ) {
+        MANGLE_POLY const *p = &( old.poly[index[i]] );
+        MANGLE_HOT const *h = &( old.hot[index[i]] );
+        MANGLE_POLY *q;
+
+        q = mply_poly_alloc( ply, i, p->polyid, h->ncap, p->weight, p->pixel, p->area );
+        memcpy( q->cap, &( old.cap[h->icap] ), h->ncap * sizeof( MANGLE_CAP ) );
+    }
+    mply_cap_link( ply );
+
+    mply_clean( &old );
+    if( pix_res > 0 ) {
+        mply_pix_alloc( ply, pix_res );
+        mply_pix_build( ply );
+    }
+}
+
+/* stable sort of the polygons by pixel */
+void
+mply_sort_by_pixel( MANGLE_PLY * const ply )
+{
+    MANGLE_INT i, *index;
+    MANGLE_SORT_KEY *key;
+
+    if( ply->npoly < 2 )
+        return;
+
+    key = ( MANGLE_SORT_KEY * ) check_alloc( ply->npoly, sizeof( MANGLE_SORT_KEY ) );
+    index = ( MANGLE_INT * ) check_alloc( ply->npoly, sizeof( MANGLE_INT ) );
+    for( i = 0; i < ply->npoly; i++ ) {
+        /* offset so negative pixel values sort first */
+        key[i].key = ( uint64_t ) ( ( int64_t ) ply->poly[i].pixel - INT64_MIN );
+        key[i].index = i;
+    }
+    qsort( key, ply->npoly, sizeof( MANGLE_SORT_KEY ), mply_sort_key_cmp );
+    for( i = 0; i < ply->npoly; i++ )
+        index[i] = key[i].index;
+
+    mply_keep_index( ply, index, ply->npoly );
+
+    CHECK_FREE( key );
+    CHECK_FREE( index );
+}
+
+/* returns the number of polygons removed */
+MANGLE_INT
+mply_drop_zero_weight( MANGLE_PLY * const ply )
+{
+    MANGLE_INT i, n = 0, *index;
+
+    index = ( MANGLE_INT * ) check_alloc( ply->npoly > 0 ? ply->npoly : 1, sizeof( MANGLE_INT ) );
+    for( i = 0; i < ply->npoly; i++ ) {
+        if( ply->poly[i].weight != 0.0 )
+            index[n++] = i;
+    }
+    n = ply->npoly - n;
+    if( n > 0 )
+        mply_keep_index( ply, index, ply->npoly - n );
+
+    CHECK_FREE( index );
+    return n;
+}
+
+/* FNV-1a over the bytes that make a polygon a repeat of another */
+static inline uint64_t
+mply_poly_hash( MANGLE_PLY const *const ply, const MANGLE_INT i )
+{
+    MANGLE_HOT const *h = &( ply->hot[i] );
+    unsigned char const *b;
+    uint64_t hash = 14695981039346656037ULL;
+    size_t k, len;
+
+    b = ( unsigned char const * ) &( ply->poly[i].weight );
+    for( k = 0; k < sizeof( double ); k++ )
+        hash = ( hash ^ b[k] ) * 1099511628211ULL;
+    b = ( unsigned char const * ) &( ply->cap[h->icap] );
+    len = h->ncap * sizeof( MANGLE_CAP );
+    for( k = 0; k < len; k++ )
+        hash = ( hash ^ b[k] ) * 1099511628211ULL;
+    return hash;
+}
+
+static inline int
+mply_poly_same( MANGLE_PLY const *const ply, const MANGLE_INT i, const MANGLE_INT j )
+{
+    MANGLE_HOT const *a = &( ply->hot[i] ), *b = &( ply->hot[j] );
+    if( a->ncap != b->ncap || ply->poly[i].weight != ply->poly[j].weight )
+        return FALSE;
+    return memcmp( &( ply->cap[a->icap] ), &( ply->cap[b->icap] ),
+                   a->ncap * sizeof( MANGLE_CAP ) ) == 0;
+}
+
+/* Remove polygons with exactly the same caps (bit for bit, in the same
+ * order) and weight as an earlier one.  Returns the number removed. */
+MANGLE_INT
+mply_dedupe( MANGLE_PLY * const ply )
+{
+    MANGLE_INT i, j, n = 0, *index;
+    MANGLE_SORT_KEY *key;
+    char *repeat;
+
+    if( ply->npoly < 2 )
+        return 0;
+
+    key = ( MANGLE_SORT_KEY * ) check_alloc( ply->npoly, sizeof( MANGLE_SORT_KEY ) );
+    index = ( MANGLE_INT * ) check_alloc( ply->npoly, sizeof( MANGLE_INT ) );
+    repeat = ( char * ) check_alloc( ply->npoly, sizeof( char ) );
+    for( i = 0; i < ply->npoly; i++ ) {
+        key[i].key = mply_poly_hash( ply, i );
+        key[i].index = i;
+    }
+    qsort( key, ply->npoly, sizeof( MANGLE_SORT_KEY ), mply_sort_key_cmp );
+
+    /* within a run of equal hashes, the earliest copy comes first */
+    for( i = 0; i < ply->npoly; i++ ) {
+        if( repeat[key[i].index] )
+            continue;
+        for( j = i + 1; j < ply->npoly && key[j].key == key[i].key; j++ ) {
+            if( !repeat[key[j].index] && mply_poly_same( ply, key[i].index, key[j].index ) )
+                repeat[key[j].index] = TRUE;
+        }
+    }
+    CHECK_FREE( key );
+
+    for( i = 0; i < ply->npoly; i++ ) {
+        if( !repeat[i] )
+            index[n++] = i;
+    }
+    n = ply->npoly - n;
+    if( n > 0 )
+        mply_keep_index( ply, index, ply->npoly - n );
+
+    CHECK_FREE( index );
+    CHECK_FREE( repeat );
+    return n;
+}
+
+void
+mply_renumber( MANGLE_PLY * const ply )
+{
+    MANGLE_INT i;
+    for( i = 0; i < ply->npoly; i++ )
+        ply->poly[i].polyid = i;
+}
+
+#endif
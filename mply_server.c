@@ -0,0 +1,316 @@
+/* local mask-query server and client over a Unix domain socket
+ *
+ * A server loads one or more masks once and answers batch queries, so that
+ * many short jobs do not each pay for mply_read_file().  The transport is
+ * a Unix domain socket only: nothing is reachable from off the machine.
+ *
+ * Wire format (native byte order, both ends are on the same host):
+ *   request:  MANGLE_SERVER_REQ, then ra[n], dec[n] as doubles (degrees)
+ *   response: MANGLE_SERVER_RES, then (if status is 0)
+ *             polyid[n] as int64, weight[n] as double, index[n] as int64
+ * Points outside the mask get polyid = -1, weight = 0, index = -1.
+ * A connection can carry any number of request / response pairs.
+ */
+#pragma once
+#ifndef MPLY_SERVER_INCLUDED
+#define MPLY_SERVER_INCLUDED
+
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <minimal_mangle.c>
+
+#define MPLY_SERVER_MAGIC 0x796c706dU   /* "mply" */
+#define MPLY_SERVER_MAXPOINTS ( ( uint64_t ) 1 << 24 )  /* per request */
+
+enum {
+    MPLY_SERVER_OK = 0,
+    MPLY_SERVER_BAD_MAGIC,
+    MPLY_SERVER_BAD_MASK,
+    MPLY_SERVER_TOO_MANY
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t mask;              /* which mask, in server load order */
+    uint64_t n;
+} MANGLE_SERVER_REQ;
+
+typedef struct {
+    uint32_t magic;
+    int32_t status;
+    uint64_t n;
+} MANGLE_SERVER_RES;
+
+/* read / write exactly len bytes: returns FALSE on EOF or error */
+static inline int
+mply_sock_read( const int fd, void *buf, size_t len )
+{
+    char *p = ( char * ) buf;
+    while( len > 0 ) {
+        ssize_t r = read( fd, p, len );
+        if( r < 0 && EINTR == errno )
+            continue;
+        if( r <= 0 )
+            return FALSE;
+        p += r;
+        len -= r;
+    }
+    return TRUE;
+}
+
+static inline int
+mply_sock_write( const int fd, void const *buf, size_t len )
+{
+    char const *p = ( char const * ) buf;
+    while( len > 0 ) {
+        ssize_t r = send( fd, p, len, MSG_NOSIGNAL );
+        if( r < 0 && EINTR == errno )
+            continue;
+        if( r <= 0 )
+            return FALSE;
+        p += r;
+        len -= r;
+    }
+    return TRUE;
+}
+
+static inline int
+mply_sock_address( struct sockaddr_un *addr, char const *const path )
+{
+    memset( addr, 0, sizeof( struct sockaddr_un ) );
+    addr->sun_family = AF_UNIX;
+    if( strlen( path ) >= sizeof( addr->sun_path ) ) {
+        fprintf( stderr, "MANGLE Error: socket path too long: %s\n", path );
+        return FALSE;
+    }
+    strncpy( addr->sun_path, path, sizeof( addr->sun_path ) - 1 );
+    return TRUE;
+}
+
+/* SERVER */
+
+/* create the listening socket, only accessible by the current user */
+int
+mply_server_listen( char const *const path )
+{
+    int fd;
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if( !mply_sock_address( &addr, path ) )
+        exit( EXIT_FAILURE );
+
+    /* clear out a stale socket from an earlier run, but nothing else: if
+     * something answers on it, a server is still running there */
+    if( stat( path, &st ) == 0 && S_ISSOCK( st.st_mode ) ) {
+        int err, probe = socket( AF_UNIX, SOCK_STREAM, 0 );
+
+        if( probe < 0 ) {
+            perror( "MANGLE Error: cannot create socket" );
+            exit( EXIT_FAILURE );
+        }
+        if( connect( probe, ( struct sockaddr * ) &addr, sizeof( addr ) ) == 0 ) {
+            fprintf( stderr, "MANGLE Error: a server is already running on %s\n", path );
+            exit( EXIT_FAILURE );
+        }
+        err = errno;
+        close( probe );
+        if( ECONNREFUSED != err ) {
+            fprintf( stderr, "MANGLE Error: cannot tell if %s is in use: %s\n", path,
+                     strerror( err ) );
+            exit( EXIT_FAILURE );
+        }
+        unlink( path );
+    }
+
+    fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( fd < 0 || bind( fd, ( struct sockaddr * ) &addr, sizeof( addr ) ) != 0 ||
+        chmod( path, S_IRUSR | S_IWUSR ) != 0 || listen( fd, 64 ) != 0 ) {
+        perror( "MANGLE Error: cannot listen on socket" );
+        exit( EXIT_FAILURE );
+    }
+
+    return fd;
+}
+
+/* answer requests on one connection until the client hangs up */
+void
+mply_server_handle( const int fd, MANGLE_PLY * const *const ply, const size_t nply )
+{
+    MANGLE_SERVER_REQ req;
+    size_t nalloc = 0;
+    double *radec = NULL, *weight = NULL;
+    int64_t *polyid = NULL, *index64 = NULL;
+    MANGLE_INT *index = NULL;
+
+    while( mply_sock_read( fd, &req, sizeof( req ) ) ) {
+        MANGLE_SERVER_RES res;
+        size_t i, n;
+
+        res.magic = MPLY_SERVER_MAGIC;
+        res.status = MPLY_SERVER_OK;
+        res.n = req.n;
+
+        if( req.magic != MPLY_SERVER_MAGIC )
+            res.status = MPLY_SERVER_BAD_MAGIC;
+        else if( req.n > MPLY_SERVER_MAXPOINTS )
+            res.status = MPLY_SERVER_TOO_MANY;
+        else if( req.mask >= nply )
+            res.status = MPLY_SERVER_BAD_MASK;
+
+        if( res.status != MPLY_SERVER_OK && res.status != MPLY_SERVER_BAD_MASK ) {
+            /* cannot trust the rest of the stream */
+            res.n = 0;
+            mply_sock_write( fd, &res, sizeof( res ) );
+            break;
+        }
+
+        n = req.n;
+        if( n > nalloc ) {
+            nalloc = n;
+            radec = ( double * ) check_realloc( radec, 2 * nalloc, sizeof( double ) );
+            weight = ( double * ) check_realloc( weight, nalloc, sizeof( double ) );
+            polyid = ( int64_t * ) check_realloc( polyid, nalloc, sizeof( int64_t ) );
+            index64 = ( int64_t * ) check_realloc( index64, nalloc, sizeof( int64_t ) );
+            index = ( MANGLE_INT * ) check_realloc( index, nalloc, sizeof( MANGLE_INT ) );
+        }
+        if( !mply_sock_read( fd, radec, 2 * n * sizeof( double ) ) )
+            break;
+
+        if( res.status != MPLY_SERVER_OK ) {
+            res.n = 0;
+            if( !mply_sock_write( fd, &res, sizeof( res ) ) )
+                break;
+            continue;
+        }
+
+        mply_find_polyindex_radec_batch( ply[req.mask], n, radec, &radec[n], index );
+        for( i = 0; i < n; i++ ) {
+            polyid[i] = mply_polyid_from_index( ply[req.mask], index[i] );
+            weight[i] = mply_weight_from_index( ply[req.mask], index[i] );
+            index64[i] = index[i];
+        }
+
+        if( !mply_sock_write( fd, &res, sizeof( res ) ) ||
+            !mply_sock_write( fd, polyid, n * sizeof( int64_t ) ) ||
+            !mply_sock_write( fd, weight, n * sizeof( double ) ) ||
+            !mply_sock_write( fd, index64, n * sizeof( int64_t ) ) )
+            break;
+    }
+
+    CHECK_FREE( radec );
+    CHECK_FREE( weight );
+    CHECK_FREE( polyid );
+    CHECK_FREE( index64 );
+    CHECK_FREE( index );
+}
+
+/* CLIENT */
+
+/* returns a connected socket, or -1 */
+int
+mply_client_connect( char const *const path )
+{
+    int fd;
+    struct sockaddr_un addr;
+
+    if( !mply_sock_address( &addr, path ) )
+        return -1;
+
+    fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( fd < 0 )
+        return -1;
+    if( connect( fd, ( struct sockaddr * ) &addr, sizeof( addr ) ) != 0 ) {
+        close( fd );
+        return -1;
+    }
+    return fd;
+}
+
+int
+mply_client_close( const int fd )
+{
+    return close( fd );
+}
+
+/* read count values of size bytes into out, or discard them if out is NULL */
+static int
+mply_client_read_array( const int fd, void *out, const size_t count, const size_t size )
+{
+    char skip[4096];
+    size_t len = count * size;
+
+    if( NULL != out )
+        return mply_sock_read( fd, out, len );
+
+    while( len > 0 ) {
+        size_t l = len < sizeof( skip ) ? len : sizeof( skip );
+        if( !mply_sock_read( fd, skip, l ) )
+            return FALSE;
+        len -= l;
+    }
+    return TRUE;
+}
+
+static int
+mply_client_query_chunk( const int fd, const uint32_t mask, const size_t n,
+                         double const *const ra, double const *const dec,
+                         int64_t * const polyid, double *const weight, int64_t * const index )
+{
+    MANGLE_SERVER_REQ req;
+    MANGLE_SERVER_RES res;
+
+    req.magic = MPLY_SERVER_MAGIC;
+    req.mask = mask;
+    req.n = n;
+
+    if( !mply_sock_write( fd, &req, sizeof( req ) ) ||
+        !mply_sock_write( fd, ra, n * sizeof( double ) ) ||
+        !mply_sock_write( fd, dec, n * sizeof( double ) ) ||
+        !mply_sock_read( fd, &res, sizeof( res ) ) )
+        return -1;
+
+    if( res.magic != MPLY_SERVER_MAGIC )
+        return -1;
+    if( res.status != MPLY_SERVER_OK )
+        return res.status;
+    if( res.n != n )
+        return -1;
+
+    if( !mply_client_read_array( fd, polyid, n, sizeof( int64_t ) ) ||
+        !mply_client_read_array( fd, weight, n, sizeof( double ) ) ||
+        !mply_client_read_array( fd, index, n, sizeof( int64_t ) ) )
+        return -1;
+
+    return MPLY_SERVER_OK;
+}
+
+/* Query n points against mask number "mask".  Any of the output arrays
+ * may be NULL.  Large queries are split to respect MPLY_SERVER_MAXPOINTS.
+ * Returns MPLY_SERVER_OK, a server status, or -1 if the connection failed. */
+int
+mply_client_query( const int fd, const uint32_t mask, const size_t n,
+                   double const *const ra, double const *const dec,
+                   int64_t * const polyid, double *const weight, int64_t * const index )
+{
+    size_t i, nb;
+    int status = MPLY_SERVER_OK;
+
+    for( i = 0; i < n && MPLY_SERVER_OK == status; i += nb ) {
+        nb = n - i < MPLY_SERVER_MAXPOINTS ? n - i : MPLY_SERVER_MAXPOINTS;
+        status = mply_client_query_chunk( fd, mask, nb, &ra[i], &dec[i],
+                                          polyid != NULL ? &polyid[i] : NULL,
+                                          weight != NULL ? &weight[i] : NULL,
+                                          index != NULL ? &index[i] : NULL );
+    }
+
+    return status;
+}
+
+#endif
@@ -0,0 +1,183 @@
+/* process-sharded catalog runs: split by pixel range, merge by row
+ *
+ * For catalogs (or masks) too big for one process, the streaming tools can
+ * run as N independent shards, e.g. with MANGLE_SHARD=3/8 in the
+ * environment.  Each shard:
+ *
+ *   - loads only the polygons in its contiguous range of pixel INDEX
+ *     values (mply_pidx_shard_range(), about 1/N of the polygons, through
+ *     the FILE.pidx index, see mply_partial.c)
+ *   - reads the whole catalog, but looks up and handles only the rows
+ *     whose pixel (mply_pix_which_index()) is in its range: run the pipe
+ *     with mply_shard_filter() as its filter, and the chunk callback
+ *     skips the rows where mply_shard_owns() is FALSE
+ *   - writes each output line prefixed with its row number (data rows,
+ *     counted from 0) and a space
+ *
+ * Every row falls in exactly one shard, and its lookup only needs polygons
+ * in that row's pixel, so the shards agree with a single full run.
+ * mply_shard_merge() (see examples/mply_merge) does an N-way merge on the
+ * row numbers, drops the prefix, and restores the input order.  Shards are
+ * plain processes with plain files: run them locally or on any cluster.
+ */
+#pragma once
+#ifndef MPLY_SHARD_INCLUDED
+#define MPLY_SHARD_INCLUDED
+
+#include <minimal_mangle.c>
+#include <mply_partial.c>
+#include <mply_pipe.c>
+
+#ifndef MPLY_SHARD_LINE_MAX
+#define MPLY_SHARD_LINE_MAX ( 1 << 20 )  /* per shard file being merged */
+#endif
+
+typedef struct {
+    int ishard;
+    int nshard;
+    MANGLE_INT pix0;            /* pixel INDEX range [pix0, pix1) */
+    MANGLE_INT pix1;
+    MANGLE_PLY const *ply;      /* as loaded by mply_shard_read() */
+    size_t row;                 /* data rows before the current chunk */
+} MANGLE_SHARD;
+
+/* Parse "K/N" (0 <= K < N).  Returns FALSE (no sharding) for NULL or "". */
+int
+mply_shard_parse( MANGLE_SHARD * const sh, char const *const s )
+{
+    int k, n;
+    char c;
+
+    memset( sh, 0, sizeof( MANGLE_SHARD ) );
+    if( NULL == s || '\0' == s[0] )
+        return FALSE;
+
+    if( sscanf( s, "%d/%d%c", &k, &n, &c ) != 2 || n < 1 || k < 0 || k >= n ) {
+        fprintf( stderr, "MANGLE Error: shard should be K/N with 0 <= K < N: '%s'\n", s );
+        exit( EXIT_FAILURE );
+    }
+    sh->ishard = k;
+    sh->nshard = n;
+    return TRUE;
+}
+
+/* load the polygons of this shard (the mask needs a FILE.pidx index) */
+MANGLE_PLY *
+mply_shard_read( MANGLE_SHARD * const sh, char const *const filename )
+{
+    MANGLE_PLY *ply = mply_init( 0 );
+
+    mply_pidx_shard_range( filename, NULL, sh->ishard, sh->nshard, &sh->pix0, &sh->pix1 );
+    mply_read_pixel_range_into( ply, filename, NULL, sh->pix0, sh->pix1 );
+    sh->row = 0;
+    sh->ply = ply;
+
+    return ply;
+}
+
+/* Pipe filter (arg is the MANGLE_SHARD): keep only the lines of the chunk
+ * in this shard, so the others are not looked up.  (Any ra: the pixel
+ * choice wraps it into [0, 360), as the lookup does.) */
+void
+mply_shard_filter( MANGLE_PIPE_CHUNK * const c, void *arg )
+{
+    MANGLE_SHARD const *sh = ( MANGLE_SHARD const * ) arg;
+    size_t i;
+
+    for( i = 0; i < c->nline; i++ ) {
+        MANGLE_INT ipix =
+            mply_pix_which_index( sh->ply, c->ra[i] * DEG2RAD, c->dec[i] * DEG2RAD );
+        c->keep[i] = ipix >= sh->pix0 && ipix < sh->pix1;
+    }
+}
+
+/* is line i of the chunk in this shard?  (as decided by mply_shard_filter) */
+INLINE int
+mply_shard_owns( MANGLE_PIPE_CHUNK const *const c, const size_t i )
+{
+    return c->keep[i];
+}
+
+/* write the row number prefix for line i of the chunk */
+INLINE void
+mply_shard_out_row( MANGLE_SHARD const *const sh, MANGLE_PIPE_CHUNK * const c, const size_t i )
+{
+    char *o = mply_pipe_out_reserve( c, 24 );
+    c->out_len += snprintf( o, 24, "%zu ", sh->row + i );
+}
+
+/* call at the end of each chunk callback */
+INLINE void
+mply_shard_next( MANGLE_SHARD * const sh, MANGLE_PIPE_CHUNK const *const c )
+{
+    sh->row += c->nline;
+}
+
+/* next line of a shard file, split into its row number and the rest */
+static char *
+mply_shard_readline( simple_reader * const sr, size_t * const row )
+{
+    char *line, *e;
+
+    line = sr_readline( sr );
+    if( NULL == line )
+        return NULL;
+
+    *row = ( size_t ) strtoull( line, &e, 10 );
+    if( e == line || ' ' != *e ) {
+        fprintf( stderr, "MANGLE Error: no row number on line %zu of shard %s\n",
+                 sr_linenum( sr ), sr_filename( sr ) );
+        exit( EXIT_FAILURE );
+    }
+    return e + 1;
+}
+
+/* Merge shard files (each in row order) into out, in row order and without
+ * the row prefix.  Returns the number of lines written. */
+size_t
+mply_shard_merge( FILE * out, char **filename, const int nfile )
+{
+    simple_reader **sr;
+    size_t *row, nout = 0;
+    char **line;
+    int i;
+
+    sr = ( simple_reader ** ) check_alloc( nfile, sizeof( simple_reader * ) );
+    row = ( size_t * ) check_alloc( nfile, sizeof( size_t ) );
+    line = ( char ** ) check_alloc( nfile, sizeof( char * ) );
+
+    for( i = 0; i < nfile; i++ ) {
+        sr[i] = sr_init( filename[i] );
+        sr_set_line_maxlen( sr[i], MPLY_SHARD_LINE_MAX );
+    }
+
+    for( i = 0; i < nfile; i++ )
+        line[i] = mply_shard_readline( sr[i], &row[i] );
+
+    while( TRUE ) {
+        int imin = -1;
+
+        /* a handful of shards: a linear scan beats a heap */
+        for( i = 0; i < nfile; i++ ) {
+            if( NULL != line[i] && ( imin < 0 || row[i] < row[imin] ) )
+                imin = i;
+        }
+        if( imin < 0 )
+            break;
+
+        fputs( line[imin], out );
+        fputc( '\n', out );
+        nout += 1;
+        line[imin] = mply_shard_readline( sr[imin], &row[imin] );
+    }
+
+    for( i = 0; i < nfile; i++ )
+        sr[i] = sr_kill( sr[i] );
+    CHECK_FREE( sr );
+    CHECK_FREE( row );
+    CHECK_FREE( line );
+
+    return nout;
+}
+
+#endif
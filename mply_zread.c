@@ -0,0 +1,403 @@
+/* compressed catalog input for the streaming tools
+ *
+ * mply_zread_open() looks at the first bytes of a stream: gzip (or zlib)
+ * input is inflated with zlib when built with MANGLE_ZLIB, and zstd input
+ * is decompressed with libzstd when built with MANGLE_ZSTD; anything else
+ * is read as it is.  mply_zread_read() then fills a buffer the way fread()
+ * does (short only at the end of the input).  mply_pipe.c reads through
+ * it, so decompression runs on the pipeline's reader thread, straight into
+ * the chunk buffers, while the lookups run on the compute thread.  No
+ * temporary files, and no zcat in front of the tool.
+ *
+ * A zstd file is a series of independent frames.  One `zstd` run writes a
+ * single frame, but pzstd, the seekable format, or simply concatenating
+ * compressed pieces give many.  Complete frames in the input buffer that
+ * record their decompressed size are decompressed together, one frame per
+ * thread when compiled with -fopenmp.  A frame larger than the input
+ * buffer, or without a recorded size, is streamed.  gzip has no such
+ * boundaries, so it is always inflated as one stream (concatenated members
+ * are fine).
+ */
+#pragma once
+#ifndef MPLY_ZREAD_INCLUDED
+#define MPLY_ZREAD_INCLUDED
+
+#include <stdint.h>
+
+#include <minimal_mangle.c>
+
+#ifdef MANGLE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef MANGLE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifndef MPLY_ZREAD_BUFSIZE
+#define MPLY_ZREAD_BUFSIZE ( 1 << 25 )  /* compressed input buffered */
+#endif
+#define MPLY_ZREAD_NFRAME 64    /* most zstd frames decompressed together */
+#define MPLY_ZREAD_OUTMAX ( ( size_t ) 1 << 28 )        /* most bytes decompressed together */
+
+#define MPLY_ZSTD_MAGIC 0xFD2FB528U
+#define MPLY_ZSTD_SKIPPABLE 0x184D2A50U /* low 4 bits free */
+
+enum {
+    MPLY_ZREAD_PLAIN = 0,
+    MPLY_ZREAD_GZIP,
+    MPLY_ZREAD_ZSTD
+};
+
+typedef struct {
+    FILE *fp;
+    char const *name;
+    int format;
+    int eof;                    /* fp is at its end */
+    unsigned char *in;          /* input not yet used is in[in_pos .. in_len] */
+    size_t in_pos;
+    size_t in_len;
+#ifdef MANGLE_ZLIB
+    z_stream z;
+    int z_done;                 /* at the end of a gzip member */
+#endif
+#ifdef MANGLE_ZSTD
+    ZSTD_DStream *zd;
+    int zd_active;              /* part way through a streamed frame */
+    char *out;                  /* frames decompressed together, out[out_pos .. out_len] left */
+    size_t out_pos;
+    size_t out_len;
+    size_t out_size;
+#endif
+} MANGLE_ZREAD;
+
+/* move the unused input to the front and read more after it */
+void
+mply_zread_fill( MANGLE_ZREAD * const zr )
+{
+    size_t nr;
+
+    if( zr->in_pos > 0 ) {
+        memmove( zr->in, &( zr->in[zr->in_pos] ), zr->in_len - zr->in_pos );
+        zr->in_len -= zr->in_pos;
+        zr->in_pos = 0;
+    }
+    if( zr->eof )
+        return;
+
+    nr = fread( &( zr->in[zr->in_len] ), 1, MPLY_ZREAD_BUFSIZE - zr->in_len, zr->fp );
+    zr->in_len += nr;
+    if( zr->in_len < MPLY_ZREAD_BUFSIZE ) {
+        if( ferror( zr->fp ) ) {
+            fprintf( stderr, "Error: Cannot read file: %s\n", zr->name );
+            perror( "Error:" );
+            exit( EXIT_FAILURE );
+        }
+        zr->eof = TRUE;
+    }
+}
+
+void
+mply_zread_corrupt( MANGLE_ZREAD const *const zr, char const *const why )
+{
+    fprintf( stderr, "MANGLE Error: cannot decompress %s: %s\n", zr->name, why );
+    exit( EXIT_FAILURE );
+}
+
+static inline uint32_t
+mply_zread_magic( unsigned char const *const b )
+{
+    return ( uint32_t ) b[0] | ( uint32_t ) b[1] << 8 | ( uint32_t ) b[2] << 16 |
+        ( uint32_t ) b[3] << 24;
+}
+
+/* what the first bytes say (at least 4 of them, or the whole input) */
+static int
+mply_zread_format( unsigned char const *const b, const size_t len )
+{
+    uint32_t magic;
+
+    if( len >= 2 && b[0] == 0x1f && b[1] == 0x8b )
+        return MPLY_ZREAD_GZIP;
+    if( len < 4 )
+        return MPLY_ZREAD_PLAIN;
+    magic = mply_zread_magic( b );
+    /* a zstd frame, or a skippable frame as pzstd starts with */
+    if( magic == MPLY_ZSTD_MAGIC || ( magic & 0xFFFFFFF0U ) == MPLY_ZSTD_SKIPPABLE )
+        return MPLY_ZREAD_ZSTD;
+    return MPLY_ZREAD_PLAIN;
+}
+
+void
+mply_zread_open( MANGLE_ZREAD * const zr, FILE * fp, char const *const name )
+{
+    memset( zr, 0, sizeof( MANGLE_ZREAD ) );
+    zr->fp = fp;
+    zr->name = name;
+    zr->in = ( unsigned char * ) check_alloc( 4, sizeof( unsigned char ) );
+
+    /* only a few bytes, so plain input goes on with fread() straight into
+     * the caller's buffer; compressed input gets the full buffer */
+    zr->in_len = fread( zr->in, 1, 4, fp );
+    if( zr->in_len < 4 ) {
+        if( ferror( fp ) ) {
+            fprintf( stderr, "Error: Cannot read file: %s\n", name );
+            perror( "Error:" );
+            exit( EXIT_FAILURE );
+        }
+        zr->eof = TRUE;
+    }
+    zr->format = mply_zread_format( zr->in, zr->in_len );
+    if( zr->format != MPLY_ZREAD_PLAIN )
+        zr->in = ( unsigned char * ) check_realloc( zr->in, MPLY_ZREAD_BUFSIZE,
+                                                    sizeof( unsigned char ) );
+
+    switch ( zr->format ) {
+    case MPLY_ZREAD_GZIP:
+#ifdef MANGLE_ZLIB
+        /* 15 + 32: any window size, gzip or zlib header */
+        if( inflateInit2( &( zr->z ), 15 + 32 ) != Z_OK )
+            mply_zread_corrupt( zr, "cannot start zlib" );
+#else
+        fprintf( stderr, "MANGLE Error: %s is gzip compressed: build with MANGLE_ZLIB"
+                 " (see mply_zread.c), or decompress it first\n", name );
+        exit( EXIT_FAILURE );
+#endif
+        break;
+    case MPLY_ZREAD_ZSTD:
+#ifdef MANGLE_ZSTD
+        zr->zd = ZSTD_createDStream(  );
+        if( NULL == zr->zd )
+            mply_zread_corrupt( zr, "cannot start zstd" );
+#else
+        fprintf( stderr, "MANGLE Error: %s is zstd compressed: build with MANGLE_ZSTD"
+                 " (see mply_zread.c), or decompress it first\n", name );
+        exit( EXIT_FAILURE );
+#endif
+        break;
+    default:
+        break;
+    }
+}
+
+void
+mply_zread_close( MANGLE_ZREAD * const zr )
+{
+#ifdef MANGLE_ZLIB
+    if( zr->format == MPLY_ZREAD_GZIP )
+        inflateEnd( &( zr->z ) );
+#endif
+#ifdef MANGLE_ZSTD
+    if( NULL != zr->zd )
+        ZSTD_freeDStream( zr->zd );
+    zr->zd = NULL;
+    CHECK_FREE( zr->out );
+#endif
+    CHECK_FREE( zr->in );
+}
+
+static size_t
+mply_zread_plain( MANGLE_ZREAD * const zr, char *const buf, const size_t len )
+{
+    size_t got = zr->in_len - zr->in_pos;
+
+    /* the bytes read to tell the format */
+    if( got > len )
+        got = len;
+    memcpy( buf, &( zr->in[zr->in_pos] ), got );
+    zr->in_pos += got;
+
+    if( got < len && !zr->eof ) {
+        got += fread( &( buf[got] ), 1, len - got, zr->fp );
+        if( got < len ) {
+            if( ferror( zr->fp ) ) {
+                fprintf( stderr, "Error: Cannot read file: %s\n", zr->name );
+                perror( "Error:" );
+                exit( EXIT_FAILURE );
+            }
+            zr->eof = TRUE;
+        }
+    }
+    return got;
+}
+
+#ifdef MANGLE_ZLIB
+static size_t
+mply_zread_gzip( MANGLE_ZREAD * const zr, char *const buf, const size_t len )
+{
+    z_stream *z = &( zr->z );
+
+    z->next_out = ( Bytef * ) buf;
+    z->avail_out = ( uInt ) len;
+    while( z->avail_out > 0 ) {
+        int ret;
+
+        if( zr->in_pos == zr->in_len ) {
+            mply_zread_fill( zr );
+            if( zr->in_len == 0 ) {
+                /* the end of the input has to be the end of a member */
+                if( !zr->z_done )
+                    mply_zread_corrupt( zr, "unexpected end of input" );
+                break;
+            }
+        }
+        if( zr->z_done ) {
+            /* another member follows */
+            inflateReset( z );
+            zr->z_done = FALSE;
+        }
+
+        z->next_in = &( zr->in[zr->in_pos] );
+        z->avail_in = ( uInt ) ( zr->in_len - zr->in_pos );
+        ret = inflate( z, Z_NO_FLUSH );
+        zr->in_pos = zr->in_len - z->avail_in;
+
+        if( ret == Z_STREAM_END )
+            zr->z_done = TRUE;
+        else if( ret != Z_OK && ret != Z_BUF_ERROR )
+            mply_zread_corrupt( zr, NULL != z->msg ? z->msg : "zlib error" );
+    }
+    return len - z->avail_out;
+}
+#endif
+
+#ifdef MANGLE_ZSTD
+/* Decompress the complete frames at the front of the input into zr->out,
+ * in parallel.  Returns FALSE if the first frame is not complete, or does
+ * not record its size (then it has to be streamed). */
+static int
+mply_zread_zstd_frames( MANGLE_ZREAD * const zr )
+{
+    size_t src[MPLY_ZREAD_NFRAME], csize[MPLY_ZREAD_NFRAME];
+    size_t dst[MPLY_ZREAD_NFRAME], dsize[MPLY_ZREAD_NFRAME];
+    size_t pos = zr->in_pos, total = 0;
+    int k, nframe = 0, bad = FALSE;
+
+    while( nframe < MPLY_ZREAD_NFRAME && pos < zr->in_len ) {
+        unsigned char const *p = &( zr->in[pos] );
+        size_t c = ZSTD_findFrameCompressedSize( p, zr->in_len - pos );
+        unsigned long long d;
+
+        if( ZSTD_isError( c ) )
+            break;              /* not all here (or not a frame: streaming reports it) */
+        if( ( mply_zread_magic( p ) & 0xFFFFFFF0U ) == MPLY_ZSTD_SKIPPABLE )
+            d = 0;
+        else
+            d = ZSTD_getFrameContentSize( p, zr->in_len - pos );
+        if( d == ZSTD_CONTENTSIZE_UNKNOWN || d == ZSTD_CONTENTSIZE_ERROR )
+            break;
+        if( total + d > MPLY_ZREAD_OUTMAX && nframe > 0 )
+            break;
+
+        src[nframe] = pos;
+        csize[nframe] = c;
+        dst[nframe] = total;
+        dsize[nframe] = ( size_t ) d;
+        pos += c;
+        total += ( size_t ) d;
+        nframe += 1;
+        if( total > MPLY_ZREAD_OUTMAX )
+            break;              /* one large frame: done alone */
+    }
+    if( nframe == 0 || total > MPLY_ZREAD_OUTMAX )
+        return FALSE;
+
+    if( total > zr->out_size ) {
+        CHECK_FREE( zr->out );
+        zr->out = ( char * ) check_alloc( total, sizeof( char ) );
+        zr->out_size = total;
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule( dynamic, 1 )
+#endif
+    for( k = 0; k < nframe; k++ ) {
+        size_t r;
+
+        if( dsize[k] == 0 )
+            continue;
+        r = ZSTD_decompress( &( zr->out[dst[k]] ), dsize[k], &( zr->in[src[k]] ), csize[k] );
+        if( ZSTD_isError( r ) || r != dsize[k] )
+            bad = TRUE;
+    }
+    if( bad )
+        mply_zread_corrupt( zr, "bad zstd frame" );
+
+    zr->in_pos = pos;
+    zr->out_pos = 0;
+    zr->out_len = total;
+    return TRUE;
+}
+
+static size_t
+mply_zread_zstd( MANGLE_ZREAD * const zr, char *const buf, const size_t len )
+{
+    size_t got = 0;
+
+    while( got < len ) {
+        if( zr->out_pos < zr->out_len ) {
+            size_t n = zr->out_len - zr->out_pos;
+
+            if( n > len - got )
+                n = len - got;
+            memcpy( &( buf[got] ), &( zr->out[zr->out_pos] ), n );
+            zr->out_pos += n;
+            got += n;
+        } else if( zr->zd_active ) {
+            ZSTD_inBuffer ib;
+            ZSTD_outBuffer ob;
+            size_t r;
+
+            if( zr->in_pos == zr->in_len ) {
+                mply_zread_fill( zr );
+                if( zr->in_len == 0 )
+                    mply_zread_corrupt( zr, "unexpected end of input" );
+            }
+            ib.src = &( zr->in[zr->in_pos] );
+            ib.size = zr->in_len - zr->in_pos;
+            ib.pos = 0;
+            ob.dst = &( buf[got] );
+            ob.size = len - got;
+            ob.pos = 0;
+            r = ZSTD_decompressStream( zr->zd, &ob, &ib );
+            if( ZSTD_isError( r ) )
+                mply_zread_corrupt( zr, ZSTD_getErrorName( r ) );
+            zr->in_pos += ib.pos;
+            got += ob.pos;
+            if( r == 0 )
+                zr->zd_active = FALSE;  /* end of the frame */
+        } else {
+            /* between frames: top up the input, so there are as many
+             * frames as possible to do at once */
+            if( !zr->eof )
+                mply_zread_fill( zr );
+            if( zr->in_pos == zr->in_len )
+                break;
+            if( !mply_zread_zstd_frames( zr ) ) {
+                ZSTD_DCtx_reset( zr->zd, ZSTD_reset_session_only );
+                zr->zd_active = TRUE;
+            }
+        }
+    }
+    return got;
+}
+#endif
+
+/* like fread( buf, 1, len, fp ): fewer than len bytes only at the end */
+size_t
+mply_zread_read( MANGLE_ZREAD * const zr, char *const buf, const size_t len )
+{
+    switch ( zr->format ) {
+#ifdef MANGLE_ZLIB
+    case MPLY_ZREAD_GZIP:
+        return mply_zread_gzip( zr, buf, len );
+#endif
+#ifdef MANGLE_ZSTD
+    case MPLY_ZREAD_ZSTD:
+        return mply_zread_zstd( zr, buf, len );
+#endif
+    default:
+        return mply_zread_plain( zr, buf, len );
+    }
+}
+
+#endif
@@ -0,0 +1,319 @@
+/* Python extension: batch lookups on NumPy (or any buffer) arrays
+ *
+ * The arrays are used in place through the buffer protocol: inputs and
+ * outputs must be C contiguous, of float64 or the MANGLE_INT integer type
+ * (see INT_SIZE).  Nothing is copied, and the GIL is released while the C
+ * batch functions run, so Python threads can look up chunks of one catalog
+ * on one Mask in parallel.  mply.py is the friendlier NumPy front end.
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <mply_lib.c>
+
+typedef struct {
+    PyObject_HEAD MANGLE_PLY *ply;
+} MaskObject;
+
+/* get a C contiguous buffer of n items of the given size and kind ('f' for
+ * float64, 'i' for integers) */
+static int
+mask_get_buffer( PyObject * obj, Py_buffer * b, const int writable, const Py_ssize_t itemsize,
+                 const char kind, char const *const name )
+{
+    int flags = PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | ( writable ? PyBUF_WRITABLE : 0 );
+    char f;
+
+    if( PyObject_GetBuffer( obj, b, flags ) != 0 )
+        return -1;
+
+    f = b->format ? b->format[0] : 'B';
+    if( f == '<' || f == '>' || f == '=' || f == '@' || f == '!' )
+        f = b->format[1];
+
+    if( b->itemsize != itemsize || ( kind == 'f' && f != 'd' )
+        || ( kind == 'i' && NULL == strchr( "ilqn", f ) ) ) {
+        PyErr_Format( PyExc_TypeError, "%s: expected contiguous %s%zd, got format '%s'", name,
+                      kind == 'f' ? "float" : "int", 8 * itemsize, b->format ? b->format : "B" );
+        PyBuffer_Release( b );
+        return -1;
+    }
+    return 0;
+}
+
+static int
+mask_check_len( Py_ssize_t n0, Py_ssize_t n1, char const *const what )
+{
+    if( n0 != n1 ) {
+        PyErr_Format( PyExc_ValueError, "%s: lengths differ (%zd and %zd)", what, n0, n1 );
+        return -1;
+    }
+    return 0;
+}
+
+static int
+mask_init( MaskObject * self, PyObject * args, PyObject * kwds )
+{
+    static char *kwlist[] = { "filename", NULL };
+    PyObject *fname;
+    char const *filename;
+    FILE *fp;
+
+    if( !PyArg_ParseTupleAndKeywords( args, kwds, "O&", kwlist, PyUnicode_FSConverter, &fname ) )
+        return -1;
+    filename = PyBytes_AS_STRING( fname );
+
+    /* mply_read_file() exits on a missing file: check first */
+    fp = fopen( filename, "r" );
+    if( NULL == fp ) {
+        PyErr_SetFromErrnoWithFilename( PyExc_OSError, filename );
+        Py_DECREF( fname );
+        return -1;
+    }
+    fclose( fp );
+
+    if( NULL != self->ply )
+        self->ply = mply_kill( self->ply );
+    Py_BEGIN_ALLOW_THREADS
+    self->ply = mply_read_file( filename );
+    Py_END_ALLOW_THREADS
+    Py_DECREF( fname );
+
+    return 0;
+}
+
+static void
+mask_dealloc( MaskObject * self )
+{
+    if( NULL != self->ply )
+        self->ply = mply_kill( self->ply );
+    Py_TYPE( self )->tp_free( ( PyObject * ) self );
+}
+
+static int
+mask_ready( MaskObject * self )
+{
+    if( NULL == self->ply ) {
+        PyErr_SetString( PyExc_RuntimeError, "Mask is not initialized" );
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *
+mask_find_radec( MaskObject * self, PyObject * args )
+{
+    PyObject *ora, *odec, *oindex;
+    Py_buffer ra, dec, index;
+    size_t n;
+
+    if( !PyArg_ParseTuple( args, "OOO", &ora, &odec, &oindex ) || mask_ready( self ) )
+        return NULL;
+    if( mask_get_buffer( ora, &ra, 0, sizeof( double ), 'f', "ra" ) )
+        return NULL;
+    if( mask_get_buffer( odec, &dec, 0, sizeof( double ), 'f', "dec" ) ) {
+        PyBuffer_Release( &ra );
+        return NULL;
+    }
+    if( mask_get_buffer( oindex, &index, 1, sizeof( MANGLE_INT ), 'i', "index" ) ) {
+        PyBuffer_Release( &ra );
+        PyBuffer_Release( &dec );
+        return NULL;
+    }
+
+    n = ( size_t ) ( ra.len / ra.itemsize );
+    if( mask_check_len( ra.len / ra.itemsize, dec.len / dec.itemsize, "ra and dec" ) == 0
+        && mask_check_len( ra.len / ra.itemsize, index.len / index.itemsize,
+                           "ra and index" ) == 0 ) {
+        Py_BEGIN_ALLOW_THREADS
+        mply_find_polyindex_radec_batch( self->ply, n, ( double const * ) ra.buf,
+                                         ( double const * ) dec.buf, ( MANGLE_INT * ) index.buf );
+        Py_END_ALLOW_THREADS
+    }
+
+    PyBuffer_Release( &ra );
+    PyBuffer_Release( &dec );
+    PyBuffer_Release( &index );
+    if( PyErr_Occurred(  ) )
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+mask_find_xyz( MaskObject * self, PyObject * args )
+{
+    PyObject *oxyz, *oindex;
+    Py_buffer xyz, index;
+    Py_ssize_t n;
+
+    if( !PyArg_ParseTuple( args, "OO", &oxyz, &oindex ) || mask_ready( self ) )
+        return NULL;
+    if( mask_get_buffer( oxyz, &xyz, 0, sizeof( double ), 'f', "xyz" ) )
+        return NULL;
+    if( mask_get_buffer( oindex, &index, 1, sizeof( MANGLE_INT ), 'i', "index" ) ) {
+        PyBuffer_Release( &xyz );
+        return NULL;
+    }
+
+    /* n x 3 doubles have the layout of n MANGLE_VEC */
+    n = xyz.len / ( Py_ssize_t ) sizeof( MANGLE_VEC );
+    if( xyz.len % ( Py_ssize_t ) sizeof( MANGLE_VEC ) != 0 )
+        PyErr_SetString( PyExc_ValueError, "xyz: expected 3 values per point" );
+    else if( mask_check_len( n, index.len / index.itemsize, "xyz and index" ) == 0 ) {
+        Py_BEGIN_ALLOW_THREADS
+        mply_find_polyindex_xyz_batch( self->ply, ( size_t ) n, ( MANGLE_VEC const * ) xyz.buf,
+                                       ( MANGLE_INT * ) index.buf );
+        Py_END_ALLOW_THREADS
+    }
+
+    PyBuffer_Release( &xyz );
+    PyBuffer_Release( &index );
+    if( PyErr_Occurred(  ) )
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+/* polyid, weight and area from INDEX values: which = 0, 1, 2 */
+static PyObject *
+mask_from_index( MaskObject * self, PyObject * args, const int which )
+{
+    PyObject *oindex, *oout;
+    Py_buffer index, out;
+    MANGLE_INT const *ii;
+    Py_ssize_t n, i;
+
+    if( !PyArg_ParseTuple( args, "OO", &oindex, &oout ) || mask_ready( self ) )
+        return NULL;
+    if( mask_get_buffer( oindex, &index, 0, sizeof( MANGLE_INT ), 'i', "index" ) )
+        return NULL;
+    if( mask_get_buffer( oout, &out, 1, which == 0 ? sizeof( MANGLE_INT ) : sizeof( double ),
+                         which == 0 ? 'i' : 'f', "out" ) ) {
+        PyBuffer_Release( &index );
+        return NULL;
+    }
+
+    n = index.len / index.itemsize;
+    ii = ( MANGLE_INT const * ) index.buf;
+    if( mask_check_len( n, out.len / out.itemsize, "index and out" ) == 0 ) {
+        /* the C functions exit on a bad INDEX */
+        for( i = 0; i < n; i++ ) {
+            if( ii[i] >= self->ply->npoly ) {
+                PyErr_Format( PyExc_IndexError, "invalid INDEX %zd", ( Py_ssize_t ) ii[i] );
+                break;
+            }
+        }
+    }
+    if( !PyErr_Occurred(  ) ) {
+        Py_BEGIN_ALLOW_THREADS
+        if( which == 0 )
+            mply_polyid_from_index_batch( self->ply, ( size_t ) n, ii, ( MANGLE_INT * ) out.buf );
+        else if( which == 1 )
+            mply_weight_from_index_batch( self->ply, ( size_t ) n, ii, ( double * ) out.buf );
+        else
+            mply_area_from_index_batch( self->ply, ( size_t ) n, ii, ( double * ) out.buf );
+        Py_END_ALLOW_THREADS
+    }
+
+    PyBuffer_Release( &index );
+    PyBuffer_Release( &out );
+    if( PyErr_Occurred(  ) )
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+mask_polyid( MaskObject * self, PyObject * args )
+{
+    return mask_from_index( self, args, 0 );
+}
+
+static PyObject *
+mask_weight( MaskObject * self, PyObject * args )
+{
+    return mask_from_index( self, args, 1 );
+}
+
+static PyObject *
+mask_area( MaskObject * self, PyObject * args )
+{
+    return mask_from_index( self, args, 2 );
+}
+
+static PyObject *
+mask_get_npoly( MaskObject * self, void *closure )
+{
+    ( void ) closure;
+    if( mask_ready( self ) )
+        return NULL;
+    return PyLong_FromSsize_t( ( Py_ssize_t ) self->ply->npoly );
+}
+
+static PyObject *
+mask_get_pix_res( MaskObject * self, void *closure )
+{
+    ( void ) closure;
+    if( mask_ready( self ) )
+        return NULL;
+    return PyLong_FromLong( ( long ) self->ply->pix_res );
+}
+
+static PyMethodDef mask_methods[] = {
+    {"find_radec", ( PyCFunction ) mask_find_radec, METH_VARARGS,
+     "find_radec(ra, dec, index): INDEX (or -1) of each point, ra/dec in degrees"},
+    {"find_xyz", ( PyCFunction ) mask_find_xyz, METH_VARARGS,
+     "find_xyz(xyz, index): INDEX (or -1) of each n x 3 unit vector"},
+    {"polyid", ( PyCFunction ) mask_polyid, METH_VARARGS,
+     "polyid(index, out): POLYID of each INDEX (-1 for -1)"},
+    {"weight", ( PyCFunction ) mask_weight, METH_VARARGS,
+     "weight(index, out): weight of each INDEX (0 for -1)"},
+    {"area", ( PyCFunction ) mask_area, METH_VARARGS,
+     "area(index, out): area of each INDEX (0 for -1)"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef mask_getset[] = {
+    {"npoly", ( getter ) mask_get_npoly, NULL, "number of polygons", NULL},
+    {"pix_res", ( getter ) mask_get_pix_res, NULL, "pixel resolution (0: none)", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject MaskType = {
+    PyVarObject_HEAD_INIT( NULL, 0 )
+};
+
+static struct PyModuleDef mply_module = {
+    PyModuleDef_HEAD_INIT, "_mply", "batch lookups in mangle polygon masks", -1, NULL,
+    NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC
+PyInit__mply( void )
+{
+    PyObject *m;
+
+    MaskType.tp_name = "_mply.Mask";
+    MaskType.tp_doc = "Mask(filename): a mangle polygon file";
+    MaskType.tp_basicsize = sizeof( MaskObject );
+    MaskType.tp_flags = Py_TPFLAGS_DEFAULT;
+    MaskType.tp_new = PyType_GenericNew;
+    MaskType.tp_init = ( initproc ) mask_init;
+    MaskType.tp_dealloc = ( destructor ) mask_dealloc;
+    MaskType.tp_methods = mask_methods;
+    MaskType.tp_getset = mask_getset;
+    if( PyType_Ready( &MaskType ) < 0 )
+        return NULL;
+
+    m = PyModule_Create( &mply_module );
+    if( NULL == m )
+        return NULL;
+
+    Py_INCREF( &MaskType );
+    if( PyModule_AddObject( m, "Mask", ( PyObject * ) & MaskType ) < 0
+        || PyModule_AddIntConstant( m, "INT_SIZE", ( long ) sizeof( MANGLE_INT ) ) < 0 ) {
+        Py_DECREF( &MaskType );
+        Py_DECREF( m );
+        return NULL;
+    }
+
+    return m;
+}
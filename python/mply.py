@@ -0,0 +1,90 @@
+"""NumPy front end to the _mply extension (minimal_mangle batch lookups).
+
+    import mply
+    mask = mply.Mask("MASK.ply")
+    index = mask.find(ra, dec)           # INDEX per point, -1 outside
+    polyid = mask.polyid(index)
+    weight = mask.weight(index)          # 0 outside
+
+ra / dec are in degrees.  float64, C contiguous arrays are passed to C
+as they are; anything else is converted once with np.ascontiguousarray.
+The lookups release the GIL: with threads > 1 the points are split into
+that many chunks, looked up in parallel on the same mask.
+"""
+
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+
+import _mply
+
+INT = np.int64 if _mply.INT_SIZE == 8 else np.int32
+
+__all__ = ["Mask", "INT"]
+
+
+def _f64(a):
+    return np.ascontiguousarray(a, dtype=np.float64)
+
+
+def _split(n, threads):
+    step = -(-n // threads)
+    return [slice(i, min(i + step, n)) for i in range(0, n, step)]
+
+
+class Mask(object):
+    """A mangle polygon file, read once and queried in bulk."""
+
+    def __init__(self, filename):
+        self._m = _mply.Mask(filename)
+
+    @property
+    def npoly(self):
+        return self._m.npoly
+
+    @property
+    def pix_res(self):
+        return self._m.pix_res
+
+    def find(self, ra, dec, out=None, threads=1):
+        """INDEX of the polygon holding each ra, dec (degrees), or -1."""
+        ra, dec = _f64(ra), _f64(dec)
+        if out is None:
+            out = np.empty(ra.shape, dtype=INT)
+        if threads <= 1 or ra.size < 2 * threads:
+            self._m.find_radec(ra.ravel(), dec.ravel(), out.reshape(-1))
+            return out
+        r, d, o = ra.ravel(), dec.ravel(), out.reshape(-1)
+        with ThreadPoolExecutor(threads) as pool:
+            jobs = [pool.submit(self._m.find_radec, r[s], d[s], o[s])
+                    for s in _split(r.size, threads)]
+            for j in jobs:
+                j.result()
+        return out
+
+    def find_xyz(self, xyz, out=None):
+        """INDEX for each row of an n x 3 array of unit vectors, or -1."""
+        xyz = _f64(xyz)
+        if out is None:
+            out = np.empty(xyz.shape[:-1], dtype=INT)
+        self._m.find_xyz(xyz, out.reshape(-1))
+        return out
+
+    def _from_index(self, fn, index, dtype, out):
+        index = np.ascontiguousarray(index, dtype=INT)
+        if out is None:
+            out = np.empty(index.shape, dtype=dtype)
+        fn(index.ravel(), out.reshape(-1))
+        return out
+
+    def polyid(self, index, out=None):
+        """POLYID for each INDEX (-1 for -1)."""
+        return self._from_index(self._m.polyid, index, INT, out)
+
+    def weight(self, index, out=None):
+        """weight for each INDEX (0 for -1)."""
+        return self._from_index(self._m.weight, index, np.float64, out)
+
+    def area(self, index, out=None):
+        """area (steradians) for each INDEX (0 for -1)."""
+        return self._from_index(self._m.area, index, np.float64, out)
@@ -162,7 +162,7 @@ sr_line_isempty( simple_reader const *const sr )
     return FALSE;
 }
 
-static inline int
+static inline size_t
 sr_linenum( simple_reader const *const sr )
 {
     sr_check_not_null( sr );
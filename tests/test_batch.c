@@ -0,0 +1,128 @@
+/* the batch and group lookups against the single point ones, for points
+ * on the cap edges of a mask, where the fast sin/cos unit vectors are not
+ * good enough on their own */
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <minimal_mangle.c>
+#include <mply_edit.c>
+#include <mply_group.c>
+#include <mply_region.c>
+
+#define TEST_RES 3
+#define TEST_NPOINT 20000
+
+static int nfail = 0;
+
+/* each pixel, less a disk at a random point of it (a hole edge to test) */
+static MANGLE_PLY *
+test_mask( void )
+{
+    MANGLE_EDIT ed;
+    MANGLE_PLY *ply;
+    MANGLE_CAP caps[5];
+    MANGLE_INT ipix, pow2r;
+    int ncap;
+
+    ply = mply_init( 0 );
+    mply_pix_alloc( ply, TEST_RES );
+    mply_edit_init( &ed, ply );
+    pow2r = mply_pow2i( TEST_RES );
+
+    for( ipix = 0; ( size_t ) ipix < mply_pix_count( TEST_RES ); ipix++ ) {
+        double az = 2.0 * PI * ( ipix % pow2r + drand48(  ) ) / pow2r;
+        double z = 1.0 - 2.0 * ( ipix / pow2r + drand48(  ) ) / pow2r;
+
+        ncap = mply_pix_caps( ply, ipix, caps );
+        mply_cap_from_polar( &caps[ncap], az, asin( z ), 0.05 );
+        caps[ncap].m = -caps[ncap].m;
+        mply_edit_add( &ed, ipix, ncap + 1, caps, 1.0, ipix + mply_pix_id_start( ply ), 0.0,
+                       MPLY_EDIT_LAST );
+    }
+
+    return ply;
+}
+
+/* a point on the edge of a random cap of a random polygon */
+static void
+test_edge_point( MANGLE_PLY const *const ply, double *const ra, double *const dec )
+{
+    MANGLE_HOT const *h = &( ply->hot[lrand48(  ) % ply->npoly] );
+    MANGLE_CAP const *c = &( ply->cap[h->icap + lrand48(  ) % h->ncap] );
+    double m = fabs( c->m ), t = 2.0 * PI * drand48(  );
+    double a[3], b[3], v[3], len;
+    int k;
+
+    /* a and b: orthonormal, perpendicular to the cap axis */
+    if( fabs( c->x[2] ) < 0.9 ) {
+        a[0] = -c->x[1];
+        a[1] = c->x[0];
+        a[2] = 0.0;
+    } else {
+        a[0] = 0.0;
+        a[1] = -c->x[2];
+        a[2] = c->x[1];
+    }
+    len = sqrt( a[0] * a[0] + a[1] * a[1] + a[2] * a[2] );
+    for( k = 0; k < 3; k++ )
+        a[k] /= len;
+    b[0] = c->x[1] * a[2] - c->x[2] * a[1];
+    b[1] = c->x[2] * a[0] - c->x[0] * a[2];
+    b[2] = c->x[0] * a[1] - c->x[1] * a[0];
+
+    for( k = 0; k < 3; k++ )
+        v[k] = ( 1.0 - m ) * c->x[k] + sqrt( m * ( 2.0 - m ) ) * ( cos( t ) * a[k] +
+                                                                   sin( t ) * b[k] );
+    *ra = atan2( v[1], v[0] ) / DEG2RAD;
+    if( *ra < 0.0 )
+        *ra += 360.0;           /* may round to 360 */
+    *dec = asin( v[2] ) / DEG2RAD;
+}
+
+static void
+test_compare( MANGLE_PLY const *const ply, MANGLE_INT const *const index,
+              double const *const ra, double const *const dec, char const *const what )
+{
+    size_t i, ndiff = 0;
+
+    for( i = 0; i < TEST_NPOINT; i++ ) {
+        if( index[i] != mply_find_polyindex_radec( ply, ra[i], dec[i] ) )
+            ndiff += 1;
+    }
+    if( ndiff > 0 ) {
+        fprintf( stderr, "FAIL %s: %zu of %d edge points differ from single lookups\n", what,
+                 ndiff, TEST_NPOINT );
+        nfail += 1;
+    }
+}
+
+int
+main( void )
+{
+    static double ra[TEST_NPOINT], dec[TEST_NPOINT];
+    static MANGLE_INT index[TEST_NPOINT];
+    MANGLE_PLY *ply;
+    size_t i;
+
+    srand48( 1 );
+    ply = test_mask(  );
+    for( i = 0; i < TEST_NPOINT; i++ )
+        test_edge_point( ply, &ra[i], &dec[i] );
+
+    mply_find_polyindex_radec_batch( ply, TEST_NPOINT, ra, dec, index );
+    test_compare( ply, index, ra, dec, "batch" );
+    mply_find_polyindex_radec_group( ply, TEST_NPOINT, ra, dec, index, 0 );
+    test_compare( ply, index, ra, dec, "group" );
+
+    /* and without the pixel index */
+    mply_pix_clean( ply );
+    mply_find_polyindex_radec_batch( ply, TEST_NPOINT, ra, dec, index );
+    test_compare( ply, index, ra, dec, "batch, no pixels" );
+
+    ply = mply_kill( ply );
+
+    if( nfail > 0 )
+        return EXIT_FAILURE;
+    fprintf( stdout, "test_batch: ok\n" );
+    return EXIT_SUCCESS;
+}
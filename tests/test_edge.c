@@ -0,0 +1,140 @@
+/* mply_edge.c: the edge distance against brute force, on a mask of pixels
+ * each cut in two by a random great circle (so with acute corners), with
+ * random weights and a few pixels left out.  The brute force distance is
+ * the distance to the nearest polygon of another weight (or left out). */
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <minimal_mangle.c>
+#include <mply_edit.c>
+#include <mply_edge.c>
+#include <mply_region.c>
+
+#define TEST_RES 3
+#define TEST_NPOINT 4000
+#define TEST_TOL 1.0e-9
+
+/* every half pixel, in the mask or not (weight 0) */
+typedef struct {
+    MANGLE_CAP caps[5];
+    int ncap;
+    double weight;
+} TEST_POLY;
+
+/* a random point of pixel ipix */
+static void
+test_pix_point( const MANGLE_INT ipix, const MANGLE_INT pow2r, double *const v )
+{
+    double az = 2.0 * PI * ( ipix % pow2r + drand48(  ) ) / pow2r;
+    double z = 1.0 - 2.0 * ( ipix / pow2r + drand48(  ) ) / pow2r;
+    double r = sqrt( 1.0 - z * z );
+
+    v[0] = r * cos( az );
+    v[1] = r * sin( az );
+    v[2] = z;
+}
+
+static MANGLE_PLY *
+test_mask( TEST_POLY * const tp )
+{
+    MANGLE_EDIT ed;
+    MANGLE_PLY *ply;
+    MANGLE_INT ipix, pow2r;
+    size_t npix = mply_pix_count( TEST_RES );
+    int half, k;
+
+    ply = mply_init( 0 );
+    mply_pix_alloc( ply, TEST_RES );
+    mply_edit_init( &ed, ply );
+    pow2r = mply_pow2i( TEST_RES );
+
+    for( ipix = 0; ( size_t ) ipix < npix; ipix++ ) {
+        double p[3], q[3], cut[3];
+
+        /* the great circle through two points of the pixel */
+        test_pix_point( ipix, pow2r, p );
+        test_pix_point( ipix, pow2r, q );
+        cut[0] = p[1] * q[2] - p[2] * q[1];
+        cut[1] = p[2] * q[0] - p[0] * q[2];
+        cut[2] = p[0] * q[1] - p[1] * q[0];
+        mply_edge_normalize( cut );
+
+        for( half = 0; half < 2; half++ ) {
+            TEST_POLY *t = &tp[2 * ipix + half];
+
+            t->ncap = mply_pix_caps( ply, ipix, t->caps );
+            for( k = 0; k < 3; k++ )
+                t->caps[t->ncap].x[k] = cut[k];
+            t->caps[t->ncap].m = half == 0 ? 1.0 : -1.0;
+            t->ncap += 1;
+
+            t->weight = ipix % 7 == 3 ? 0.0 : ( double ) ( 1 + lrand48(  ) % 2 );
+            if( t->weight > 0.0 )
+                mply_edit_add( &ed, 2 * ipix + half, t->ncap, t->caps, t->weight,
+                               ipix + mply_pix_id_start( ply ), 0.0, MPLY_EDIT_LAST );
+        }
+    }
+
+    return ply;
+}
+
+static double
+test_brute( TEST_POLY const *const tp, const size_t np, const double weight,
+            double const *const p )
+{
+    double best = PI, x[3], d;
+    MANGLE_INT i, jend;
+    size_t j;
+
+    for( j = 0; j < np; j++ ) {
+        if( tp[j].weight == weight )
+            continue;
+        for( i = 0; i < tp[j].ncap; i++ ) {
+            if( !mply_edge_has_circle( &tp[j].caps[i] ) )
+                continue;
+            d = mply_edge_arc_nearest( tp[j].caps, tp[j].ncap, i, p, x, &jend );
+            if( d >= 0.0 && d < best )
+                best = d;
+        }
+    }
+    return best;
+}
+
+int
+main( void )
+{
+    static TEST_POLY tp[2 * 12 * 4 * 4 * 4 * 4];
+    size_t np = 2 * mply_pix_count( TEST_RES ), i, ndiff = 0, nin = 0;
+    MANGLE_PLY *ply;
+
+    srand48( 1 );
+    ply = test_mask( tp );
+
+    for( i = 0; i < TEST_NPOINT; i++ ) {
+        double az = 2.0 * PI * drand48(  ), el = asin( 2.0 * drand48(  ) - 1.0 );
+        MANGLE_INT index = mply_find_polyindex_polar( ply, az, el );
+        MANGLE_VEC v;
+        double d, brute;
+
+        if( index < 0 )
+            continue;
+        nin += 1;
+        mply_vec_from_polar( &v, az, el );
+        d = mply_edge_distance_index( ply, index, &v, PI );
+        brute = test_brute( tp, np, ply->poly[index].weight, v.x );
+        if( fabs( d - brute ) > TEST_TOL ) {
+            if( ndiff < 5 )
+                fprintf( stderr, "FAIL: az %.17g el %.17g: distance %.17g, brute force %.17g\n",
+                         az, el, d, brute );
+            ndiff += 1;
+        }
+    }
+    ply = mply_kill( ply );
+
+    if( ndiff > 0 ) {
+        fprintf( stderr, "FAIL: %zu of %zu points off the brute force distance\n", ndiff, nin );
+        return EXIT_FAILURE;
+    }
+    fprintf( stdout, "test_edge: ok\n" );
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,93 @@
+/* mply_edit.c: adds after mply_mem_place() has moved (and trimmed) the
+ * arrays the editor grew, with every pixel checked after each step.  Build
+ * with the sanitizers (see Makefile) to catch writes past an array. */
+#include <stdlib.h>
+#include <stdio.h>
+
+/* move even tiny arrays, without rounding them up to a huge page, so the
+ * sanitizer sees their exact size */
+#define MPLY_MEM_MIN 1
+#define MPLY_MEM_ALIGN sizeof( void * )
+
+#include <minimal_mangle.c>
+#include <mply_edit.c>
+#include <mply_mem.c>
+#include <mply_region.c>
+
+#define TEST_RES 2
+
+static int nfail = 0;
+
+/* add one polygon covering pixel INDEX ipix, with polyid = ipix */
+static void
+test_add_pix( MANGLE_EDIT * const ed, const MANGLE_INT ipix )
+{
+    MANGLE_PLY *ply = ed->ply;
+    MANGLE_CAP caps[4];
+    int ncap;
+
+    ncap = mply_pix_caps( ply, ipix, caps );
+    mply_edit_add( ed, ipix, ncap, caps, 1.0, ipix + mply_pix_id_start( ply ), 0.0,
+                   MPLY_EDIT_LAST );
+}
+
+/* the center of each pixel should be in the polygon added for it, if any */
+static void
+test_lookup( MANGLE_PLY const *const ply, const MANGLE_INT nadded, char const *const step )
+{
+    MANGLE_INT ipix, index, pow2r = mply_pow2i( ply->pix_res );
+    size_t npix = mply_pix_count( ply->pix_res );
+
+    for( ipix = 0; ( size_t ) ipix < npix; ipix++ ) {
+        double az = 2.0 * PI * ( ipix % pow2r + 0.5 ) / pow2r;
+        double z = 1.0 - 2.0 * ( ipix / pow2r + 0.5 ) / pow2r;
+        MANGLE_INT expect = ipix < nadded ? ipix : -1;
+
+        index = mply_find_polyindex_polar( ply, az, asin( z ) );
+        if( index >= 0 )
+            index = ply->poly[index].polyid;
+        if( index != expect ) {
+            fprintf( stderr, "FAIL %s: pixel %zd found %zd, expected %zd\n", step,
+                     ( ssize_t ) ipix, ( ssize_t ) index, ( ssize_t ) expect );
+            nfail += 1;
+        }
+    }
+}
+
+int
+main( void )
+{
+    MANGLE_EDIT ed;
+    MANGLE_PLY *ply;
+    MANGLE_INT i, npix;
+
+    ply = mply_init( 0 );
+    mply_pix_alloc( ply, TEST_RES );
+    npix = ( MANGLE_INT ) mply_pix_count( TEST_RES );
+    mply_edit_init( &ed, ply );
+
+    /* grow to the editor's minimum, then let placement trim it */
+    for( i = 0; i < 4; i++ )
+        test_add_pix( &ed, i );
+    test_lookup( ply, 4, "edit" );
+
+    mply_mem_place( ply, MPLY_MEM_HUGE );
+    test_lookup( ply, 4, "place" );
+
+    for( i = 4; i < npix / 2; i++ )
+        test_add_pix( &ed, i );
+    test_lookup( ply, npix / 2, "place, add" );
+
+    /* and again, with room left over from the last growth */
+    mply_mem_place( ply, MPLY_MEM_HUGE );
+    for( i = npix / 2; i < npix; i++ )
+        test_add_pix( &ed, i );
+    test_lookup( ply, npix, "place, add again" );
+
+    ply = mply_kill( ply );
+
+    if( nfail > 0 )
+        return EXIT_FAILURE;
+    fprintf( stdout, "test_edit: ok\n" );
+    return EXIT_SUCCESS;
+}
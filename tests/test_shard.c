@@ -0,0 +1,178 @@
+/* mply_shard.c: N shards of a polyid run, merged, against the full run.
+ * The catalog includes ra = 360 and other azimuths outside [0, 360), each
+ * of which must land in exactly one shard. */
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <minimal_mangle.c>
+#include <mply_edit.c>
+#include <mply_region.c>
+#include <mply_shard.c>
+
+#define TEST_RES 3
+#define TEST_NSHARD 3
+#define TEST_NROW 5000
+
+#define TEST_PLY "test_shard.ply"
+#define TEST_CAT "test_shard.cat"
+
+typedef struct {
+    MANGLE_PLY *ply;
+    int sharded;
+    MANGLE_SHARD shard;
+} TEST_ARGS;
+
+static int nfail = 0;
+
+/* as examples/mply_polyid */
+static void
+test_chunk( MANGLE_PIPE_CHUNK * const c, void *arg )
+{
+    TEST_ARGS *a = ( TEST_ARGS * ) arg;
+    size_t i;
+
+    for( i = 0; i < c->nline; i++ ) {
+        size_t len = c->line_len[i] + 32;
+        char *o;
+
+        if( a->sharded ) {
+            if( !mply_shard_owns( c, i ) )
+                continue;
+            mply_shard_out_row( &a->shard, c, i );
+        }
+        o = mply_pipe_out_reserve( c, len );
+        c->out_len += snprintf( o, len, "%6zd %s\n",
+                                ( ssize_t ) mply_polyid_from_index( a->ply, c->index[i] ),
+                                c->line[i] );
+    }
+    if( a->sharded )
+        mply_shard_next( &a->shard, c );
+}
+
+/* every pixel but the last few, as one polygon each (polyid = pixel INDEX) */
+static void
+test_write_mask( void )
+{
+    MANGLE_EDIT ed;
+    MANGLE_PLY *ply;
+    MANGLE_CAP caps[4];
+    MANGLE_INT ipix, npix;
+    int ncap;
+
+    ply = mply_init( 0 );
+    mply_pix_alloc( ply, TEST_RES );
+    mply_edit_init( &ed, ply );
+    npix = ( MANGLE_INT ) mply_pix_count( TEST_RES );
+
+    for( ipix = 0; ipix < npix - 3; ipix++ ) {
+        ncap = mply_pix_caps( ply, ipix, caps );
+        mply_edit_add( &ed, ipix, ncap, caps, 1.0, ipix + mply_pix_id_start( ply ), 0.0,
+                       MPLY_EDIT_LAST );
+    }
+    mply_edit_compact( &ed, TRUE );
+    mply_write_file( ply, TEST_PLY );
+    ply = mply_kill( ply );
+
+    mply_pidx_write( TEST_PLY, NULL );
+}
+
+static void
+test_write_catalog( void )
+{
+    static const double ra_edge[] = { 360.0, 0.0, -0.0, 720.0, -10.0, 370.0, 359.99999999999994 };
+    FILE *fp = check_fopen( TEST_CAT, "w" );
+    size_t i, nedge = sizeof( ra_edge ) / sizeof( ra_edge[0] );
+
+    srand48( 1 );
+    for( i = 0; i < TEST_NROW; i++ ) {
+        double ra = 360.0 * drand48(  ), dec = asin( 2.0 * drand48(  ) - 1.0 ) / DEG2RAD;
+        if( i % 4 == 0 )
+            ra = ra_edge[( i / 4 ) % nedge];
+        fprintf( fp, "%.17g %.17g\n", ra, dec );
+    }
+    fclose( fp );
+}
+
+/* run over the catalog into the file out_name, as shard "K/N" or in full */
+static void
+test_run( char const *const shard, char const *const out_name )
+{
+    TEST_ARGS a;
+    FILE *in, *out;
+
+    a.sharded = mply_shard_parse( &a.shard, shard );
+    if( a.sharded )
+        a.ply = mply_shard_read( &a.shard, TEST_PLY );
+    else
+        a.ply = mply_read_file( TEST_PLY );
+
+    in = check_fopen( TEST_CAT, "r" );
+    out = check_fopen( out_name, "w" );
+    mply_pipe_run_filter( a.ply, in, TEST_CAT, out, a.sharded ? mply_shard_filter : NULL,
+                          &a.shard, test_chunk, &a );
+    fclose( in );
+    fclose( out );
+    a.ply = mply_kill( a.ply );
+}
+
+/* same lines in both files? */
+static void
+test_same( char const *const name0, char const *const name1 )
+{
+    FILE *fp0 = check_fopen( name0, "r" ), *fp1 = check_fopen( name1, "r" );
+    char line0[256], line1[256];
+    size_t n = 0;
+
+    while( NULL != fgets( line0, sizeof( line0 ), fp0 ) ) {
+        n += 1;
+        if( NULL == fgets( line1, sizeof( line1 ), fp1 ) || strcmp( line0, line1 ) != 0 ) {
+            fprintf( stderr, "FAIL: %s and %s differ at line %zu\n", name0, name1, n );
+            nfail += 1;
+            break;
+        }
+    }
+    if( 0 == nfail && ( n != TEST_NROW || NULL != fgets( line1, sizeof( line1 ), fp1 ) ) ) {
+        fprintf( stderr, "FAIL: %s has %zu lines, %s has more, expected %d\n", name0, n, name1,
+                 TEST_NROW );
+        nfail += 1;
+    }
+    fclose( fp0 );
+    fclose( fp1 );
+}
+
+int
+main( void )
+{
+    char shard[32], name[TEST_NSHARD][32], *names[TEST_NSHARD];
+    FILE *fp;
+    int k;
+
+    test_write_mask(  );
+    test_write_catalog(  );
+
+    test_run( NULL, "test_shard.full" );
+    for( k = 0; k < TEST_NSHARD; k++ ) {
+        snprintf( shard, sizeof( shard ), "%d/%d", k, TEST_NSHARD );
+        snprintf( name[k], sizeof( name[k] ), "test_shard.%d", k );
+        names[k] = name[k];
+        test_run( shard, name[k] );
+    }
+
+    fp = check_fopen( "test_shard.merged", "w" );
+    mply_shard_merge( fp, names, TEST_NSHARD );
+    fclose( fp );
+    test_same( "test_shard.full", "test_shard.merged" );
+
+    remove( TEST_PLY );
+    remove( TEST_PLY ".pidx" );
+    remove( TEST_CAT );
+    remove( "test_shard.full" );
+    remove( "test_shard.merged" );
+    for( k = 0; k < TEST_NSHARD; k++ )
+        remove( name[k] );
+
+    if( nfail > 0 )
+        return EXIT_FAILURE;
+    fprintf( stdout, "test_shard: ok\n" );
+    return EXIT_SUCCESS;
+}